@@ -0,0 +1,104 @@
+// Encoding one DB batch of tick rows, before anything is sent: the text
+// VALUES list of --db-sink insert, the binary COPY stream of --db-sink copy
+// and the unnest() array parameters of --db-sink pipeline.
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "aggregator/pg_copy.hpp"
+#include "aggregator/pg_pipeline.hpp"
+
+namespace {
+
+struct Row {
+    std::string_view ticker;
+    double price;
+    int volume;
+    long long timestamp_ns;
+    double latency_ms;
+};
+
+std::vector<Row> make_rows(size_t n) {
+    static const char *const tickers[] = {"AAPL", "MSFT", "GOOGL", "AMZN", "NVDA", "META", "TSLA", "JPM"};
+    std::vector<Row> rows;
+    for (size_t i = 0; i < n; i++) {
+        rows.push_back({tickers[i % 8], 100.0 + (i % 997) * 0.01, static_cast<int>(100 + i % 50),
+                        1760000000000000000LL + static_cast<long long>(i) * 1000, 2.5 + (i % 7) * 0.1});
+    }
+    return rows;
+}
+
+}  // namespace
+
+// Same format string as write_batch_insert in cmd/aggregator/main.cpp
+static void BM_RowEncode_SnprintfValues(benchmark::State &state) {
+    std::vector<Row> rows = make_rows(static_cast<size_t>(state.range(0)));
+    std::string query;
+    for (auto _ : state) {
+        query = "INSERT INTO market_updates (time, ticker, price, volume, latency_ms) VALUES ";
+        bool first = true;
+        for (const Row &r : rows) {
+            char value_str[320];
+            snprintf(value_str, sizeof(value_str), "(to_timestamp(%lld / 1000.0), '%.*s', %f, %d, %f)",
+                     r.timestamp_ns / 1000000, (int)r.ticker.size(), r.ticker.data(), r.price, r.volume,
+                     r.latency_ms);
+            if (!first) query += ",";
+            query += value_str;
+            first = false;
+        }
+        benchmark::DoNotOptimize(query.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(query.size()));
+}
+BENCHMARK(BM_RowEncode_SnprintfValues)->Arg(1000)->Arg(20000);
+
+// write_batch_copy's row layout
+static void BM_RowEncode_CopyBinary(benchmark::State &state) {
+    std::vector<Row> rows = make_rows(static_cast<size_t>(state.range(0)));
+    PgCopyBinaryEncoder encoder;
+    for (auto _ : state) {
+        encoder.begin();
+        for (const Row &r : rows) {
+            encoder.begin_row(5);
+            encoder.add_timestamptz_ns(r.timestamp_ns);
+            encoder.add_text(r.ticker.data(), r.ticker.size());
+            encoder.add_float8(r.price);
+            encoder.add_int4(r.volume);
+            encoder.add_float8(r.latency_ms);
+        }
+        encoder.finish();
+        benchmark::DoNotOptimize(encoder.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(encoder.size()));
+}
+BENCHMARK(BM_RowEncode_CopyBinary)->Arg(1000)->Arg(20000);
+
+// send_rows_pipelined's column arrays
+static void BM_RowEncode_UnnestArrays(benchmark::State &state) {
+    std::vector<Row> rows = make_rows(static_cast<size_t>(state.range(0)));
+    PgArrayEncoder time, ticker, price, volume, latency;
+    for (auto _ : state) {
+        time.begin(pg_oid::TIMESTAMPTZ);
+        ticker.begin(pg_oid::TEXT);
+        price.begin(pg_oid::FLOAT8);
+        volume.begin(pg_oid::INT4);
+        latency.begin(pg_oid::FLOAT8);
+        for (const Row &r : rows) {
+            time.add_timestamptz_ns(r.timestamp_ns);
+            ticker.add_text(r.ticker.data(), r.ticker.size());
+            price.add_float8(r.price);
+            volume.add_int4(r.volume);
+            latency.add_float8(r.latency_ms);
+        }
+        for (PgArrayEncoder *c : {&time, &ticker, &price, &volume, &latency}) c->finish(rows.size());
+        benchmark::DoNotOptimize(time.data());
+        benchmark::DoNotOptimize(latency.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RowEncode_UnnestArrays)->Arg(1000)->Arg(20000);
+
+BENCHMARK_MAIN();
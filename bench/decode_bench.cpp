@@ -0,0 +1,131 @@
+// Decode paths of the aggregator's consumer loop, one Kafka payload per
+// iteration: protobuf ParseFromArray (--decoder protobuf), the hand-written
+// wire reader (--decoder wire), the 32-byte packed layout, and both decoders
+// on MarketUpdateBatch records.
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "market_data.pb.h"
+#include "common/packed_format.hpp"
+#include "common/wire_format.hpp"
+
+static const char *const TICKERS[] = {"AAPL", "MSFT", "GOOGL", "AMZN", "NVDA", "META", "TSLA", "JPM"};
+
+static std::string single_payload() {
+    marketdata::MarketUpdate u;
+    u.set_ticker("AAPL");
+    u.set_price(187.34);
+    u.set_volume(1200);
+    u.set_timestamp_ns(1760000000123456789LL);
+    return u.SerializeAsString();
+}
+
+// Delta form as UpdateBatcher writes it
+static std::string batch_payload(int ticks) {
+    marketdata::MarketUpdateBatch b;
+    for (const char *t : TICKERS) b.add_symbols(t);
+    std::vector<long long> last_price(8, 0);
+    long long ts = 1760000000000000000LL;
+    for (int i = 0; i < ticks; i++) {
+        int s = i % 8;
+        long long fixed = std::llround((100.0 + s + (i % 13) * 0.01) * 1e6);
+        b.add_symbol_index(s);
+        b.add_price_delta(fixed - last_price[s]);
+        b.add_timestamp_delta_ns(i == 0 ? ts : 1000);
+        b.add_volume(100 + i);
+        last_price[s] = fixed;
+    }
+    return b.SerializeAsString();
+}
+
+static void BM_Decode_ProtobufParse(benchmark::State &state) {
+    std::string payload = single_payload();
+    marketdata::MarketUpdate u;
+    MarketUpdateView view;
+    for (auto _ : state) {
+        bool ok = u.ParseFromArray(payload.data(), static_cast<int>(payload.size()));
+        view.ticker = u.ticker();
+        view.price = u.price();
+        view.volume = u.volume();
+        view.timestamp_ns = u.timestamp_ns();
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(view);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Decode_ProtobufParse);
+
+static void BM_Decode_Wire(benchmark::State &state) {
+    std::string payload = single_payload();
+    MarketUpdateView view;
+    for (auto _ : state) {
+        bool ok = decode_market_update(payload.data(), payload.size(), view);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(view);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Decode_Wire);
+
+static void BM_Decode_Packed(benchmark::State &state) {
+    char payload[packed::SIZE];
+    packed::encode({3, 187.34, 1200, 1760000000123456789LL}, payload);
+    packed::Update u;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(payload);
+        bool ok = packed::decode(payload, sizeof(payload), u);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(u);
+        benchmark::ClobberMemory();  // otherwise the loads are hoisted out of the loop
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Decode_Packed);
+
+// Items are ticks, so ns/item compares directly with the single-tick cases
+static void BM_DecodeBatch_ProtobufParse(benchmark::State &state) {
+    std::string payload = batch_payload(static_cast<int>(state.range(0)));
+    marketdata::MarketUpdateBatch b;
+    std::vector<MarketUpdateView> views;
+    std::vector<int64_t> last_price;
+    for (auto _ : state) {
+        // Parse plus the delta walk of decode_batch in cmd/aggregator/main.cpp
+        bool ok = b.ParseFromArray(payload.data(), static_cast<int>(payload.size()));
+        views.clear();
+        last_price.assign(b.symbols_size(), 0);
+        int64_t timestamp_ns = 0;
+        for (int i = 0; i < b.symbol_index_size(); i++) {
+            uint32_t index = b.symbol_index(i);
+            int64_t &price = last_price[index];
+            price += b.price_delta(i);
+            timestamp_ns += b.timestamp_delta_ns(i);
+            MarketUpdateView view;
+            view.ticker = b.symbols(index);
+            view.price = price / 1e6;
+            view.volume = b.volume(i);
+            view.timestamp_ns = timestamp_ns;
+            views.push_back(view);
+        }
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(views.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DecodeBatch_ProtobufParse)->RangeMultiplier(4)->Range(8, 512);
+
+static void BM_DecodeBatch_Wire(benchmark::State &state) {
+    std::string payload = batch_payload(static_cast<int>(state.range(0)));
+    std::vector<MarketUpdateView> views;
+    MarketUpdateBatchScratch scratch;
+    for (auto _ : state) {
+        bool ok = decode_market_update_batch(payload.data(), payload.size(), views, scratch);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(views.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DecodeBatch_Wire)->RangeMultiplier(4)->Range(8, 512);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,67 @@
+// Cost of recording one latency sample with N consumer threads: the shared
+// atomic sum/min/max of the original update_latency_stats, whose cache line
+// every thread writes, against the per-thread LatencyHistogram the
+// aggregator records into now.
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <benchmark/benchmark.h>
+#include "common/latency_histogram.hpp"
+
+namespace {
+
+std::atomic<long long> total_processed(0);
+std::atomic<long long> total_latency_ns(0);
+std::atomic<long long> min_latency_ns(LLONG_MAX);
+std::atomic<long long> max_latency_ns(0);
+
+// As in the first version of cmd/aggregator/main.cpp
+void update_latency_stats(long long latency_ns) {
+    total_processed++;
+    total_latency_ns += latency_ns;
+
+    long long current_min = min_latency_ns.load();
+    while (latency_ns < current_min &&
+           !min_latency_ns.compare_exchange_weak(current_min, latency_ns));
+
+    long long current_max = max_latency_ns.load();
+    while (latency_ns > current_max &&
+           !max_latency_ns.compare_exchange_weak(current_max, latency_ns));
+}
+
+// Spread of a few microseconds to a few milliseconds, different per thread
+struct LatencySource {
+    explicit LatencySource(int seed) : x(0x9E3779B97F4A7C15ULL * (seed + 1)) {}
+    long long next() {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return static_cast<long long>(1000 + (x % 5000000));
+    }
+    uint64_t x;
+};
+
+constexpr int MAX_THREADS = 64;
+std::unique_ptr<LatencyHistogram> histograms[MAX_THREADS];
+
+}  // namespace
+
+static void BM_LatencyStats_SharedAtomics(benchmark::State &state) {
+    LatencySource source(state.thread_index());
+    for (auto _ : state) update_latency_stats(source.next());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LatencyStats_SharedAtomics)->ThreadRange(1, 16)->UseRealTime();
+
+static void BM_LatencyStats_PerThreadHistogram(benchmark::State &state) {
+    int t = state.thread_index();
+    if (!histograms[t]) histograms[t].reset(new LatencyHistogram);
+    LatencyHistogram &h = *histograms[t];
+    LatencySource source(t);
+    for (auto _ : state) h.record(source.next());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LatencyStats_PerThreadHistogram)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
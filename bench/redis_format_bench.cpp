@@ -0,0 +1,95 @@
+// Building Redis commands for price updates, without any I/O: hiredis'
+// printf-style formatting behind redisAppendCommand("SET %b %f") and
+// redisFormatCommandArgv, against RespWriter (common/resp_writer.hpp).
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <hiredis/hiredis.h>
+#include "common/resp_writer.hpp"
+
+static const char *const TICKERS[] = {"AAPL", "MSFT", "GOOGL", "AMZN", "NVDA", "META", "TSLA", "JPM"};
+
+static double price_at(int64_t i) { return 100.0 + (i % 997) * 0.01; }
+
+// One command per tick; formatting is all redisAppendCommand does besides
+// appending to the output buffer
+static void BM_RedisEncode_FormatCommand(benchmark::State &state) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        std::string_view ticker = TICKERS[i % 8];
+        char *cmd = NULL;
+        int len = redisFormatCommand(&cmd, "SET %b %f", ticker.data(), ticker.size(), price_at(i++));
+        benchmark::DoNotOptimize(len);
+        free(cmd);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RedisEncode_FormatCommand);
+
+// Coalesced flush: one MSET of range(0) prices, items are keys. The argv
+// baseline is what the flush did before RespWriter.
+static void BM_RedisEncode_FormatCommandArgvMset(benchmark::State &state) {
+    std::string buf;
+    std::vector<size_t> offsets, lens;
+    std::vector<const char *> argv;
+    int64_t i = 0;
+    for (auto _ : state) {
+        buf.assign("MSET");
+        offsets.assign(1, 0);
+        lens.assign(1, 4);
+        for (int64_t k = 0; k < state.range(0); k++) {
+            std::string_view ticker = TICKERS[k % 8];
+            offsets.push_back(buf.size());
+            lens.push_back(ticker.size());
+            buf.append(ticker.data(), ticker.size());
+            char value[64];
+            int n = snprintf(value, sizeof(value), "%f", price_at(i++));
+            offsets.push_back(buf.size());
+            lens.push_back(static_cast<size_t>(n));
+            buf.append(value, static_cast<size_t>(n));
+        }
+        argv.resize(offsets.size());
+        for (size_t a = 0; a < offsets.size(); a++) argv[a] = buf.data() + offsets[a];
+        char *cmd = NULL;
+        int len = redisFormatCommandArgv(&cmd, static_cast<int>(argv.size()), argv.data(), lens.data());
+        benchmark::DoNotOptimize(len);
+        free(cmd);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RedisEncode_FormatCommandArgvMset)->Arg(8)->Arg(512);
+
+static void BM_RedisEncode_RespWriterMset(benchmark::State &state) {
+    RespWriter args;
+    int64_t i = 0;
+    for (auto _ : state) {
+        args.reset("MSET");
+        for (int64_t k = 0; k < state.range(0); k++) {
+            args.add(TICKERS[k % 8]);
+            args.add(price_at(i++));
+        }
+        benchmark::DoNotOptimize(args.command().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RedisEncode_RespWriterMset)->Arg(8)->Arg(512);
+
+// What the per-tick SET of the sync path and the async sink now do
+static void BM_RedisEncode_RespWriterSet(benchmark::State &state) {
+    RespWriter args;
+    int64_t i = 0;
+    for (auto _ : state) {
+        args.reset("SET");
+        args.add(TICKERS[i % 8]);
+        args.add(price_at(i++));
+        benchmark::DoNotOptimize(args.command().data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RedisEncode_RespWriterSet);
+
+BENCHMARK_MAIN();
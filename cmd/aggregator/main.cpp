@@ -1,39 +1,161 @@
 #include <cstddef>
 #include <cstdio>
 #include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <hiredis/read.h>
 #include <iostream>
-#include <mutex>
 #include <string>
 #include <csignal>
 #include <thread>
-#include <queue>
 #include <vector>
 #include <chrono>
 #include <atomic>
+#include <climits>
+#include <deque>
+#include <map>
 #include <librdkafka/rdkafka.h>
 #include <hiredis/hiredis.h>
 #include <google/protobuf/port.h>
 #include <ostream>
 #include <libpq-fe.h>
 #include "market_data.pb.h"
+#include "aggregator/bar_engine.hpp"
+#include "aggregator/batch_controller.hpp"
+#include "aggregator/db_spool.hpp"
+#include "aggregator/db_symbol_ids.hpp"
+#include "aggregator/last_value_table.hpp"
+#include "aggregator/offset_tracker.hpp"
+#include "aggregator/partition_throttle.hpp"
+#include "aggregator/options.hpp"
+#include "aggregator/pg_copy.hpp"
+#include "aggregator/pg_pipeline.hpp"
+#include "aggregator/redis_async_sink.hpp"
+#include "aggregator/schema.hpp"
+#include "common/clock_sync.hpp"
+#include "common/http_server.hpp"
+#include "common/latency_histogram.hpp"
+#include "common/metrics.hpp"
+#include "common/packed_format.hpp"
+#include "common/ring_buffer.hpp"
+#include "common/symbol_loader.hpp"
+#include "common/symbol_table.hpp"
+#include "common/wakeup.hpp"
+#include "common/wire_format.hpp"
 
 static volatile sig_atomic_t run = 1;
-std::atomic<long long> total_processed(0);
-std::atomic<long long> total_latency_ns(0);
-std::atomic<long long> min_latency_ns(LLONG_MAX);
-std::atomic<long long> max_latency_ns(0);
-
+std::atomic<long long> queue_full_stalls(0);
+std::atomic<long long> bars_emitted(0);
+std::atomic<long long> consumer_errors(0);
+std::atomic<long long> decode_errors(0);
+std::atomic<long long> symbol_overflows(0);
+std::atomic<long long> unknown_symbol_ids(0);
+std::atomic<long long> batch_records(0);
+std::atomic<long long> negative_latencies(0);  // cross-host latencies below 0 after clock correction
+std::atomic<long long> redis_commands_total(0);
+std::atomic<long long> redis_flushes_total(0);
+std::atomic<long long> redis_dropped(0);
+std::atomic<long long> db_rows_written(0);
+std::atomic<long long> db_batches_written(0);
+std::atomic<long long> db_write_errors(0);
+std::atomic<long long> db_last_batch_rows(0);
+std::atomic<long long> db_rows_dropped(0);
+std::atomic<long long> db_rows_rejected(0);
+std::atomic<long long> db_bars_rejected(0);
+std::atomic<long long> db_rows_shed(0);
+std::atomic<long long> kafka_commits(0);
+std::atomic<long long> kafka_commit_errors(0);
+KafkaStatsCache kafka_stats;
+
+// Fixed-size so ring slots are preallocated and copying one never allocates.
+// The ticker travels as its SymbolTable ID and is resolved only by the sinks.
+// Every row carries its Kafka coordinates (seq is the tick's index inside a
+// batch record). With --commit manual, a record that produced no row still
+// sends one marker (symbol_id INVALID) so its offset gets committed.
 struct MessageBatch {
-    std::string ticker;
+    uint32_t symbol_id;
     double price;
     int volume;
     long long timestamp_ns;
     double latency_ms;
+    long long enqueue_ns;  // monotonic, for the db_queue stage
+    int32_t partition;
+    int32_t seq;
+    long long offset;
+    bool last_in_record;   // writing this row completes the record: commit offset + 1
+};
+
+// One TimescaleDB connection and the thread that writes through it. Rows are
+// routed by Kafka partition, so a partition's rows stay in order on one
+// connection and each writer commits only its own partitions. Bars follow
+// their ticker's partition too, so a writer's commits never wait on a bar in
+// another writer's spool. The atomics are read by /metrics.
+struct DbWriter {
+    int id = 0;
+    PGconn *conn = NULL;
+    std::unique_ptr<BoundedRingBuffer<MessageBatch>> rows;
+    std::unique_ptr<BoundedRingBuffer<CompletedBar>> bars;
+    Wakeup wakeup;  // producers of rows/bars wake the sleeping writer
+    std::thread thread;
+    PgPipeline pipeline;  // --db-sink pipeline
+    std::atomic<bool> healthy{true};  // connection up and session prepared
+    std::atomic<long long> reconnects{0};
+    std::atomic<long long> target_rows{0};
+    std::atomic<double> ingest_rate{0};
+    std::atomic<double> write_overhead_ns{0};
+    std::atomic<double> write_cost_ns{0};
+    DbSpool *spool = NULL;  // --db-spool, owned by db_spools
+    // Writer thread only: batches go to the spool rather than the database
+    // until its replayer has caught up
+    bool spooling = false;
+    long long spool_synced_ns = 0;
+    PgCopyBinaryEncoder spool_ticks{0}, spool_bars{0};
 };
 
-std::queue<MessageBatch> batch_queue;
-std::mutex queue_mutex;
+std::vector<std::unique_ptr<DbWriter>> db_writers;
+// One per writer-<i> directory under --db-spool; left over from a run with
+// more writers, the extra ones are only replayed
+std::vector<std::unique_ptr<DbSpool>> db_spools;
+long long spool_sync_ns = 0;
+std::atomic<bool> replayers_stop(false);
+std::unique_ptr<SymbolTable> symbols;
+uint32_t dictionary_size = 0;  // IDs below this came from --symbols and are valid in packed payloads
+std::unique_ptr<RedisAsyncSink> redis_sink;  // NULL with --redis-mode sync
+std::unique_ptr<LastValueTable> last_values;  // NULL with --redis-coalesce-us 0
+long long redis_coalesce_ns = 0;
+PriceOutputs price_outputs;
+CommitMode commit_mode = CommitMode::Manual;
+DbSinkMode db_sink = DbSinkMode::Copy;
+DbSchema db_schema = DbSchema::Rows;
+std::unique_ptr<DbSymbolIds> db_symbol_ids;  // --db-schema compact only
+std::unique_ptr<BarFloors> bar_floors;  // --commit manual with bars in market_bars
+bool db_idempotent = false;
+OverloadPolicy overload = OverloadPolicy::Block;
+int pause_high_pct = 80, pause_low_pct = 50;
+PartitionThrottle partition_throttle;  // --overload block, driven by the thread polling rk
+rd_kafka_t *kafka_consumer = NULL;  // set before any row is queued; the writer commits through it
+// Writers drain their queues until main sets writer_stop after the workers
+// exit; producers keep waiting for queue room while any is still running.
+std::atomic<bool> writer_stop(false);
+std::atomic<int> writers_running(0);
+std::unique_ptr<ClockProbe> clock_probe;  // --clock-sync on
+
+// Producer clock minus ours, added to every latency measured from a producer
+// timestamp (kafka, db_e2e); 0 until the probe hears from a single responder.
+inline long long clock_correction_ns() {
+    return clock_probe ? clock_probe->correction_ns() : 0;
+}
+
+// Per-thread latency histograms, merged by stats_reporter. Stages:
+//   kafka       producer timestamp -> consumer receives the message (clock corrected)
+//   decode      protobuf parse
+//   redis_flush draining one Redis pipeline
+//   redis_staleness first price update -> coalesced MSET sent
+//   db_queue    row enqueued -> picked up by batch_writer
+//   db_write    one batch write to TimescaleDB
+//   db_e2e      producer timestamp -> row committed to TimescaleDB (clock corrected)
+HistogramRegistry latency_registry;
 
 static void stop(int sig) {
     run = 0;
@@ -45,53 +167,227 @@ long long current_timestamp_ns() {
     ).count();
 }
 
-void update_latency_stats(long long latency_ns) {
-    total_processed++;
-    total_latency_ns += latency_ns;
+// A bar is in TimescaleDB, spooled or given up on: its partition's commits
+// may pass its first tick.
+void release_bars(const CompletedBar *bars, size_t n) {
+    if (!bar_floors) return;
+    for (size_t i = 0; i < n; i++) bar_floors->release(bars[i].partition, bars[i].first_offset);
+}
+
+// Bounded queue: wait for the writer rather than growing without limit
+template <typename T>
+void push_blocking(BoundedRingBuffer<T>& queue, const T& value) {
+    if (queue.try_push(value)) return;
+    queue_full_stalls++;
+    while ((run || writers_running > 0) && !queue.try_push(value)) {
+        std::this_thread::yield();
+    }
+}
+
+long long monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// --overload redis-only sheds a row that finds its writer's queue full. Its
+// offset is still committed by the next row of the partition that gets
+// through, so the tick is gone from TimescaleDB for good; Redis saw it.
+void queue_row(const MessageBatch& row) {
+    DbWriter& dw = *db_writers[static_cast<size_t>(row.partition) % db_writers.size()];
+    if (overload == OverloadPolicy::RedisOnly) {
+        if (!dw.rows->try_push(row)) {
+            if (row.symbol_id != SymbolTable::INVALID) db_rows_shed++;
+            return;
+        }
+    } else {
+        push_blocking(*dw.rows, row);
+    }
+    dw.wakeup.notify(dw.rows->size_approx());
+}
+
+void queue_bar(const CompletedBar& bar) {
+    DbWriter& dw = *db_writers[static_cast<size_t>(bar.partition) % db_writers.size()];
+    if (overload == OverloadPolicy::RedisOnly) {
+        if (!dw.bars->try_push(bar)) {
+            release_bars(&bar, 1);  // shed like a row: commits go on without it
+            return;
+        }
+    } else {
+        push_blocking(*dw.bars, bar);
+    }
+    dw.wakeup.notify(dw.bars->size_approx());
+}
+
+size_t db_queue_depth() {
+    size_t depth = 0;
+    for (const auto& dw : db_writers) depth += dw->rows->size_approx();
+    return depth;
+}
+
+size_t db_queue_capacity() {
+    size_t capacity = 0;
+    for (const auto& dw : db_writers) capacity += dw->rows->capacity();
+    return capacity;
+}
+
+// Watermark check for one bounded stage: 1 over the high watermark, -1 under
+// the low one, 0 in between.
+int queue_pressure(size_t depth, size_t capacity) {
+    size_t pct = depth * 100 / capacity;
+    if (pct >= static_cast<size_t>(pause_high_pct)) return 1;
+    return pct < static_cast<size_t>(pause_low_pct) ? -1 : 0;
+}
+
+// A partition feeds its own writer's row queue and the shared Redis sink;
+// it pauses when either is over budget and resumes when both have drained.
+int partition_pressure(int32_t partition) {
+    const DbWriter& dw = *db_writers[static_cast<size_t>(partition) % db_writers.size()];
+    int level = queue_pressure(dw.rows->size_approx(), dw.rows->capacity());
+    if (!redis_sink) return level;
+    int redis_level = queue_pressure(redis_sink->queue_depth(), redis_sink->queue_capacity());
+    if (level > 0 || redis_level > 0) return 1;
+    return level < 0 && redis_level < 0 ? -1 : 0;
+}
 
-    // Update min
-    long long current_min = min_latency_ns.load();
-    while (latency_ns < current_min &&
-           !min_latency_ns.compare_exchange_weak(current_min, latency_ns));
+// --overload block: the polling thread re-evaluates every 10 ms, well before
+// a queue that just crossed the high watermark can fill up.
+constexpr long long FLOW_CHECK_INTERVAL_NS = 10000000;
 
-    // Update max
-    long long current_max = max_latency_ns.load();
-    while (latency_ns > current_max &&
-           !max_latency_ns.compare_exchange_weak(current_max, latency_ns));
+void flow_control(rd_kafka_t *rk, long long& next_check_ns) {
+    long long now = monotonic_ns();
+    if (now < next_check_ns) return;
+    next_check_ns = now + FLOW_CHECK_INTERVAL_NS;
+    partition_throttle.update(rk, partition_pressure);
+}
+
+void print_percentiles(const char *label, const HistogramSnapshot& h) {
+    std::cout << label
+              << " p50: " << h.percentile(0.50) / 1e6
+              << " | p90: " << h.percentile(0.90) / 1e6
+              << " | p99: " << h.percentile(0.99) / 1e6
+              << " | p99.9: " << h.percentile(0.999) / 1e6
+              << " | Max: " << h.max / 1e6 << std::endl;
 }
 
 void stats_reporter() {
+    std::map<std::string, HistogramSnapshot> previous;
+
     while (run) {
         std::this_thread::sleep_for(std::chrono::seconds(5));
 
-        long long processed = total_processed.load();
+        HistogramSnapshot kafka = latency_registry.snapshot("kafka");
+        long long processed = kafka.count;
         if (processed == 0) continue;
 
-        long long total_lat = total_latency_ns.load();
-        long long min_lat = min_latency_ns.load();
-        long long max_lat = max_latency_ns.load();
-
-        double avg_latency_ms = (total_lat / processed) / 1e6;
-        double min_latency_ms = min_lat / 1e6;
-        double max_latency_ms = max_lat / 1e6;
-
-        int queue_size;
-        {
-            std::lock_guard<std::mutex> lock(queue_mutex);
-            queue_size = batch_queue.size();
-        }
+        HistogramSnapshot kafka_interval = kafka.since(previous["kafka"]);
+        size_t queue_size = db_queue_depth();
 
         std::cout << "\n=== Stats ===" << std::endl;
-        std::cout << "Processed: " << processed << " | Queue: " << queue_size << std::endl;
-        std::cout << "Latency (ms) - Avg: " << avg_latency_ms
-                  << " | Min: " << min_latency_ms
-                  << " | Max: " << max_latency_ms << std::endl;
+        std::cout << "Processed: " << processed << " | Queue: " << queue_size
+                  << "/" << db_queue_capacity()
+                  << " | Full stalls: " << queue_full_stalls.load()
+                  << " | Bars: " << bars_emitted.load() << std::endl;
+        print_percentiles("Latency (ms, last 5s) -", kafka_interval);
+        print_percentiles("Latency (ms, total)   -", kafka);
+        if (clock_probe && clock_probe->correcting()) {
+            std::cout << "Clock correction: " << clock_probe->correction_ns() / 1e6 << " ms";
+        } else {
+            std::cout << "Clock correction: none";
+        }
+        std::cout << " | Negative latencies: " << negative_latencies.load() << std::endl;
+
+        std::cout << "Stages (ms, last 5s p50/p99/max):";
+        for (const auto& stage : latency_registry.stages()) {
+            HistogramSnapshot total = latency_registry.snapshot(stage);
+            HistogramSnapshot interval = total.since(previous[stage]);
+            previous[stage] = std::move(total);
+            if (stage == "kafka" || interval.count == 0) continue;
+            std::cout << " " << stage << " " << interval.percentile(0.50) / 1e6
+                      << "/" << interval.percentile(0.99) / 1e6
+                      << "/" << interval.max / 1e6;
+        }
+        std::cout << std::endl;
         std::cout << "=============\n" << std::endl;
     }
 }
 
+// --db-sink pipeline: one row per array element, so a whole batch is a single
+// bind of a prepared statement. Idempotent mode needs no staging table here.
+const char *pipelined_updates_sql() {
+    if (db_schema == DbSchema::Compact) {
+        return db_idempotent
+            ? "INSERT INTO market_ticks (time, symbol_id, price, volume, kafka_partition, kafka_offset, kafka_seq) "
+              "SELECT * FROM unnest($1::timestamptz[], $2::int4[], $3::float8[], $4::int4[], $5::int4[], "
+              "$6::int8[], $7::int4[]) ON CONFLICT DO NOTHING"
+            : "INSERT INTO market_ticks (time, symbol_id, price, volume) "
+              "SELECT * FROM unnest($1::timestamptz[], $2::int4[], $3::float8[], $4::int4[])";
+    }
+    return db_idempotent
+        ? "INSERT INTO market_updates (time, ticker, price, volume, latency_ms, kafka_partition, kafka_offset, kafka_seq) "
+          "SELECT * FROM unnest($1::timestamptz[], $2::text[], $3::float8[], $4::int4[], $5::float8[], $6::int4[], "
+          "$7::int8[], $8::int4[]) ON CONFLICT DO NOTHING"
+        : "INSERT INTO market_updates (time, ticker, price, volume, latency_ms) "
+          "SELECT * FROM unnest($1::timestamptz[], $2::text[], $3::float8[], $4::int4[], $5::float8[])";
+}
+
+const char *pipelined_bars_sql() {
+    return db_idempotent
+        ? "INSERT INTO market_bars (time, ticker, interval_s, open, high, low, close, volume, vwap, trades) "
+          "SELECT * FROM unnest($1::timestamptz[], $2::text[], $3::int4[], $4::float8[], $5::float8[], $6::float8[], "
+          "$7::float8[], $8::int8[], $9::float8[], $10::int4[]) ON CONFLICT DO NOTHING"
+        : "INSERT INTO market_bars (time, ticker, interval_s, open, high, low, close, volume, vwap, trades) "
+          "SELECT * FROM unnest($1::timestamptz[], $2::text[], $3::int4[], $4::float8[], $5::float8[], $6::float8[], "
+          "$7::float8[], $8::int8[], $9::float8[], $10::int4[])";
+}
+
+bool prepare_statement(PGconn *conn, const char *name, const char *sql) {
+    PGresult *res = PQprepare(conn, name, sql, 0, NULL);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) std::cerr << "Preparing " << name << " failed: " << PQerrorMessage(conn) << std::endl;
+    PQclear(res);
+    return ok;
+}
+
+// --db-idempotent COPY sessions: batches are copied into temp staging tables
+// and moved with INSERT ... ON CONFLICT DO NOTHING.
+bool prepare_staging_tables(PGconn *conn) {
+    if (!db_idempotent) return true;
+    if (db_schema == DbSchema::Compact) {
+        return exec_command(conn, R"(
+            SET client_min_messages TO warning;
+            CREATE TEMP TABLE IF NOT EXISTS market_ticks_staging (LIKE market_ticks INCLUDING DEFAULTS);
+        )", "Staging table setup");
+    }
+    return exec_command(conn, R"(
+        SET client_min_messages TO warning;
+        CREATE TEMP TABLE IF NOT EXISTS market_updates_staging (LIKE market_updates INCLUDING DEFAULTS);
+        CREATE TEMP TABLE IF NOT EXISTS market_bars_staging (LIKE market_bars INCLUDING DEFAULTS);
+    )", "Staging table setup");
+}
+
+// Per-session state, set up again after every reconnect:
+//  - pipeline sink: the prepared unnest() INSERTs, then pipeline mode
+//  - otherwise the staging tables of --db-idempotent
+bool prepare_db_session(DbWriter& dw) {
+    PGconn *conn = dw.conn;
+    if (db_sink == DbSinkMode::Pipeline) {
+        if (!prepare_statement(conn, "insert_updates", pipelined_updates_sql()) ||
+            !prepare_statement(conn, "insert_bars", pipelined_bars_sql())) {
+            return false;
+        }
+        if (dw.pipeline.enter(conn)) return true;
+        std::cerr << "Entering pipeline mode failed: " << dw.pipeline.error() << std::endl;
+        return false;
+    }
+    return prepare_staging_tables(conn);
+}
+
+// Bounded connect time and TCP keepalives, so a reset or a write on a dead
+// link fails within seconds instead of hanging a writer.
 PGconn* connect_to_timescale(const std::string& host) {
-    std::string conninfo = "host=" + host + " port=5432 dbname=market_data user=postgres password=postgres";
+    std::string conninfo = "host=" + host + " port=5432 dbname=market_data user=postgres password=postgres"
+                           " connect_timeout=5 keepalives_idle=10 keepalives_interval=5 keepalives_count=3";
     PGconn *conn = PQconnectdb(conninfo.c_str());
 
     if (PQstatus(conn) != CONNECTION_OK) {
@@ -99,144 +395,1666 @@ PGconn* connect_to_timescale(const std::string& host) {
         PQfinish(conn);
         return NULL;
     }
+    return conn;
+}
 
-    std::cout << "Connected to TimescaleDB successfully." << std::endl;
-    // Create table if not exists
-    const char* create_table = R"(
-        CREATE TABLE IF NOT EXISTS market_updates (
-            time TIMESTAMPTZ NOT NULL,
-            ticker TEXT NOT NULL,
-            price DOUBLE PRECISION NOT NULL,
-            volume INTEGER NOT NULL,
-            latency_ms DOUBLE PRECISION NOT NULL
-        );
-
-        SELECT create_hypertable('market_updates', 'time', if_not_exists => TRUE);
-
-        CREATE INDEX IF NOT EXISTS idx_ticker_time ON market_updates (ticker, time DESC);
-    )";
-    PGresult *res = PQexec(conn, create_table);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK && PQresultStatus(res) != PGRES_TUPLES_OK) {
-        std::cerr << "Table creation failed: " << PQerrorMessage(conn) << std::endl;
-        PQclear(res);
-        PQfinish(conn);
-        return NULL;
+// Runs once, on the first writer connection: versioned migrations, then the
+// settings that depend on options (unique indexes, bar aggregates, retention).
+bool setup_schema(PGconn *conn, const AggregatorOptions& opts) {
+    if (!migrate_schema(conn)) return false;
+
+    const bool compact = db_schema == DbSchema::Compact;
+    // Rows written without --db-idempotent have NULL coordinates, which never conflict
+    if (db_idempotent && !compact && !exec_command(conn, R"(
+            CREATE UNIQUE INDEX IF NOT EXISTS idx_updates_source
+                ON market_updates (kafka_partition, kafka_offset, kafka_seq, time);
+            CREATE UNIQUE INDEX IF NOT EXISTS idx_bars_unique ON market_bars (ticker, interval_s, time);
+        )", "Unique index creation")) {
+        return false;
+    }
+    if (db_idempotent && compact && !exec_command(conn,
+            "CREATE UNIQUE INDEX IF NOT EXISTS idx_ticks_source "
+            "ON market_ticks (kafka_partition, kafka_offset, kafka_seq, time)", "Unique index creation")) {
+        return false;
+    }
+    if (compact && !ensure_bar_aggregates(conn, opts.bar_intervals)) return false;
+    if (opts.db_retention_days >= 0 &&
+        !apply_retention(conn, compact ? "market_ticks" : "market_updates", opts.db_retention_days)) {
+        return false;
     }
-    PQclear(res);
 
     std::cout << "TimescaleDB table ready." << std::endl;
-    return conn;
+    return true;
+}
+
+bool write_batch_insert(PGconn *conn, const std::vector<MessageBatch>& batch) {
+    std::string query = db_idempotent
+        ? "INSERT INTO market_updates (time, ticker, price, volume, latency_ms, kafka_partition, kafka_offset, kafka_seq) VALUES "
+        : "INSERT INTO market_updates (time, ticker, price, volume, latency_ms) VALUES ";
+
+    bool first = true;
+    for (const auto& msg : batch) {
+        if (msg.symbol_id == SymbolTable::INVALID) continue;  // offset marker
+        long long timestamp_ms = msg.timestamp_ns / 1000000;
+
+        char value_str[320];
+        std::string_view ticker = symbols->name(msg.symbol_id);
+        if (db_idempotent) {
+            snprintf(value_str, sizeof(value_str),
+                "(to_timestamp(%lld / 1000.0), '%.*s', %f, %d, %f, %d, %lld, %d)",
+                timestamp_ms, (int)ticker.size(), ticker.data(), msg.price, msg.volume, msg.latency_ms,
+                msg.partition, msg.offset, msg.seq);
+        } else {
+            snprintf(value_str, sizeof(value_str),
+                "(to_timestamp(%lld / 1000.0), '%.*s', %f, %d, %f)",
+                timestamp_ms, (int)ticker.size(), ticker.data(), msg.price, msg.volume, msg.latency_ms);
+        }
+        if (!first) query += ",";
+        query += value_str;
+        first = false;
+    }
+    if (first) return true;
+    if (db_idempotent) query += " ON CONFLICT DO NOTHING";
+
+    PGresult *res = PQexec(conn, query.c_str());
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) {
+        std::cerr << "Batch insert failed: " << PQerrorMessage(conn) << std::endl;
+        pg_note_failure(res);
+    }
+    PQclear(res);
+    return ok;
+}
+
+// --db-schema compact writes market_ticks: the symbols.id instead of the
+// ticker text and no latency_ms. Compact batches must have been resolved.
+// Returns the number of rows, offset markers excluded.
+size_t encode_batch_copy(PgCopyBinaryEncoder& encoder, const std::vector<MessageBatch>& batch) {
+    const bool compact = db_schema == DbSchema::Compact;
+    encoder.begin();
+    size_t rows = 0;
+    for (const auto& msg : batch) {
+        if (msg.symbol_id == SymbolTable::INVALID) continue;  // offset marker
+        encoder.begin_row((compact ? 4 : 5) + (db_idempotent ? 3 : 0));
+        encoder.add_timestamptz_ns(msg.timestamp_ns);
+        if (compact) {
+            encoder.add_int4(db_symbol_ids->get(msg.symbol_id));
+        } else {
+            std::string_view ticker = symbols->name(msg.symbol_id);
+            encoder.add_text(ticker.data(), ticker.size());
+        }
+        encoder.add_float8(msg.price);
+        encoder.add_int4(msg.volume);
+        if (!compact) encoder.add_float8(msg.latency_ms);
+        if (db_idempotent) {
+            encoder.add_int4(msg.partition);
+            encoder.add_int8(msg.offset);
+            encoder.add_int4(msg.seq);
+        }
+        rows++;
+    }
+    encoder.finish();
+    return rows;
+}
+
+// Sends tick rows encoded by encode_batch_copy, possibly several batches' worth.
+bool copy_ticks(PGconn *conn, const std::vector<PgCopyChunk>& stream) {
+    const bool compact = db_schema == DbSchema::Compact;
+    std::string table = compact ? "market_ticks" : "market_updates";
+    std::string columns = compact ? "time, symbol_id, price, volume" : "time, ticker, price, volume, latency_ms";
+    std::string error;
+    if (!db_idempotent) {
+        std::string copy = "COPY " + table + " (" + columns + ") FROM STDIN (FORMAT binary)";
+        if (!pg_copy_send(conn, copy.c_str(), stream, error)) {
+            std::cerr << "Batch COPY failed: " << error << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Staging is emptied first so a retried batch never inserts twice
+    columns += ", kafka_partition, kafka_offset, kafka_seq";
+    std::string truncate = "TRUNCATE " + table + "_staging";
+    std::string copy = "COPY " + table + "_staging (" + columns + ") FROM STDIN (FORMAT binary)";
+    std::string insert = "INSERT INTO " + table + " (" + columns + ") SELECT " + columns + " FROM " + table +
+                         "_staging ON CONFLICT DO NOTHING";
+    if (!exec_command(conn, truncate.c_str(), "Staging truncate")) return false;
+    if (!pg_copy_send(conn, copy.c_str(), stream, error)) {
+        std::cerr << "Batch COPY failed: " << error << std::endl;
+        return false;
+    }
+    return exec_command(conn, insert.c_str(), "Staged insert");
+}
+
+bool write_batch_copy(PGconn *conn, PgCopyBinaryEncoder& encoder, const std::vector<MessageBatch>& batch) {
+    if (db_symbol_ids && !db_symbol_ids->resolve(batch)) return false;
+    if (encode_batch_copy(encoder, batch) == 0) return true;
+    return copy_ticks(conn, {{encoder.data(), encoder.size()}});
+}
+
+void encode_bars_copy(PgCopyBinaryEncoder& encoder, const std::vector<CompletedBar>& bars) {
+    encoder.begin();
+    for (const auto& bar : bars) {
+        encoder.begin_row(10);
+        encoder.add_timestamptz_ns(bar.start_ns);
+        std::string_view ticker = symbols->name(bar.symbol_id);
+        encoder.add_text(ticker.data(), ticker.size());
+        encoder.add_int4(bar.interval_s);
+        encoder.add_float8(bar.open);
+        encoder.add_float8(bar.high);
+        encoder.add_float8(bar.low);
+        encoder.add_float8(bar.close);
+        encoder.add_int8(bar.volume);
+        encoder.add_float8(bar.vwap);
+        encoder.add_int4(static_cast<int32_t>(bar.trades));
+    }
+    encoder.finish();
+}
+
+bool copy_bars(PGconn *conn, const std::vector<PgCopyChunk>& stream) {
+    const char *columns = "(time, ticker, interval_s, open, high, low, close, volume, vwap, trades)";
+    std::string error;
+    if (db_idempotent && !exec_command(conn, "TRUNCATE market_bars_staging", "Staging truncate")) return false;
+    std::string copy = std::string("COPY ") + (db_idempotent ? "market_bars_staging " : "market_bars ") + columns +
+                       " FROM STDIN (FORMAT binary)";
+    if (!pg_copy_send(conn, copy.c_str(), stream, error)) {
+        std::cerr << "Bar COPY failed: " << error << std::endl;
+        return false;
+    }
+    if (!db_idempotent) return true;
+    // A replay rebuilds bars from the committed offset on, so the first full write of a bar wins
+    std::string insert = std::string("INSERT INTO market_bars ") + columns + " SELECT " +
+                         std::string(columns + 1, std::strlen(columns) - 2) +
+                         " FROM market_bars_staging ON CONFLICT DO NOTHING";
+    return exec_command(conn, insert.c_str(), "Staged bar insert");
+}
+
+// Bars are low-volume, so they always go through COPY regardless of --db-sink.
+bool write_bars_copy(PGconn *conn, PgCopyBinaryEncoder& encoder, const std::vector<CompletedBar>& bars) {
+    encode_bars_copy(encoder, bars);
+    return copy_bars(conn, {{encoder.data(), encoder.size()}});
+}
+
+// Called only from the writer's own thread. A session whose staging tables
+// could not be recreated is reset again on the next failure.
+static void reconnect_if_broken(DbWriter& dw) {
+    if (PQstatus(dw.conn) != CONNECTION_BAD && dw.healthy) return;
+    std::cerr << "TimescaleDB writer " << dw.id << ": connection lost, resetting..." << std::endl;
+    dw.reconnects++;
+    dw.pipeline.reset();
+    PQreset(dw.conn);
+    dw.healthy = PQstatus(dw.conn) == CONNECTION_OK && prepare_db_session(dw);
+}
+
+// Idle writers probe their connection every few seconds, so a dead one is
+// reset before the next batch needs it rather than on its first failure.
+static void check_connection(DbWriter& dw) {
+    bool ok = PQstatus(dw.conn) == CONNECTION_OK &&
+              (db_sink == DbSinkMode::Pipeline ? dw.pipeline.ping()
+                                              : exec_command(dw.conn, "SELECT 1", "TimescaleDB health check"));
+    if (ok) return;
+    dw.healthy = false;
+    reconnect_if_broken(dw);
+}
+
+// --db-spool: stores a batch the database could not take, as the COPY
+// streams the writer would have sent; `ticks_done` leaves out ticks that are
+// already written. False if the spool has no room, or for a compact batch
+// with a ticker the database has not registered yet; the batch is then
+// retried as without a spool.
+static bool spool_batch(DbWriter& dw, const std::vector<MessageBatch>& rows, const std::vector<CompletedBar>& bars,
+                        bool ticks_done) {
+    DbSpool::Entry entries[2];
+    size_t n = 0;
+    if (!ticks_done) {
+        if (db_symbol_ids && !db_symbol_ids->resolve(rows)) return false;
+        size_t count = encode_batch_copy(dw.spool_ticks, rows);
+        if (count > 0) {
+            entries[n++] = {DbSpool::Ticks, static_cast<uint32_t>(count), dw.spool_ticks.data(), dw.spool_ticks.size()};
+        }
+    }
+    if (!bars.empty()) {
+        encode_bars_copy(dw.spool_bars, bars);
+        entries[n++] = {DbSpool::Bars, static_cast<uint32_t>(bars.size()), dw.spool_bars.data(), dw.spool_bars.size()};
+    }
+    if (n > 0 && !dw.spool->append(entries, n)) return false;
+    if (!dw.spooling) {
+        dw.spooling = true;
+        dw.healthy = false;  // reset before the writer uses it again
+        std::cerr << "TimescaleDB writer " << dw.id << ": database unavailable, spooling batches to "
+                  << dw.spool->dir() << std::endl;
+    }
+    return true;
+}
+
+// False while batches have to go to the spool. Once the replayer has caught
+// up, the writer resets its session and writes directly again.
+static bool writing_directly(DbWriter& dw) {
+    if (!dw.spooling) return true;
+    if (dw.spool->pending_bytes() > 0) return false;
+    reconnect_if_broken(dw);
+    if (!dw.healthy) return false;
+    dw.spooling = false;
+    std::cout << "TimescaleDB writer " << dw.id << ": spool replayed, writing directly again" << std::endl;
+    return true;
 }
 
-void batch_writer(PGconn *conn) {
-    const int BATCH_SIZE = 5000;
-    const int FLUSH_INTERVAL_MS = 100;
+// Offsets may only be committed once the spooled batches they cover are on
+// disk. Syncs are batched, at most one per --db-spool-sync-ms unless `force`.
+// True when committing is safe now.
+static bool spool_durable(DbWriter& dw, bool force) {
+    if (!dw.spool || !dw.spool->dirty()) return true;
+    long long now_ns = monotonic_ns();
+    if (!force && now_ns < dw.spool_synced_ns + spool_sync_ns) return false;
+    dw.spool_synced_ns = now_ns;
+    return dw.spool->sync();
+}
 
+// One per --db-spool directory, on a connection of its own. Copies spooled
+// batches into TimescaleDB, merging up to 16 MiB of consecutive records of
+// one kind into a single COPY, and retries with the writers' backoff while
+// the database is down. At shutdown it stops after the current COPY; the
+// rest stays on disk and is replayed on the next start.
+//
+// A merged COPY the database rejects as invalid data (pg_error.hpp) is
+// retried one record at a time, and a record rejected on its own goes to the
+// spool's quarantine; the records around it are replayed as usual.
+void spool_replayer(DbSpool *spool, std::string host) {
+    const size_t max_bytes = 16 << 20;
+    const size_t header = PgCopyBinaryEncoder::HEADER_SIZE, trailer = PgCopyBinaryEncoder::TRAILER_SIZE;
+    PGconn *conn = NULL;
+    bool session_ok = false;
+    std::vector<DbSpool::Record> records;
+    std::vector<PgCopyChunk> stream;
+    int failures = 0;
+    size_t one_by_one = 0;  // records of a rejected merged COPY still to be retried alone
+
+    while (!replayers_stop.load()) {
+        spool->peek(records, one_by_one > 0 ? 0 : max_bytes);
+        if (records.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+        if (!conn) {
+            conn = connect_to_timescale(host);
+            session_ok = conn && prepare_staging_tables(conn);
+        } else if (!session_ok || PQstatus(conn) == CONNECTION_BAD) {
+            PQreset(conn);
+            session_ok = PQstatus(conn) == CONNECTION_OK && prepare_staging_tables(conn);
+        }
+
+        // One stream: the first record's header, every record's rows, one trailer
+        bool ticks = records.front().kind == DbSpool::Ticks;
+        long long rows = 0;
+        stream.clear();
+        stream.push_back({records.front().data, header});
+        for (const auto& r : records) {
+            stream.push_back({r.data + header, r.size - header - trailer});
+            rows += r.rows;
+        }
+        stream.push_back({records.back().data + records.back().size - trailer, trailer});
+        if (session_ok && (ticks ? copy_ticks(conn, stream) : copy_bars(conn, stream))) {
+            spool->consume(records);
+            if (ticks) db_rows_written += rows;
+            if (one_by_one > 0) one_by_one--;
+            failures = 0;
+            continue;
+        }
+
+        db_write_errors++;
+        if (session_ok && pg_classify_failure(conn) == PgFailure::Data) {
+            if (records.size() > 1) {
+                one_by_one = records.size();
+                continue;
+            }
+            if (spool->quarantine(records.front())) {
+                std::cerr << "Spool " << spool->dir() << ": moved a record of " << rows << (ticks ? " ticks" : " bars")
+                          << " rejected by TimescaleDB (SQLSTATE " << pg_last_sqlstate() << ") to quarantine"
+                          << std::endl;
+                if (one_by_one > 0) one_by_one--;
+                failures = 0;
+                continue;
+            }
+        }
+        failures++;
+        if (conn && PQstatus(conn) == CONNECTION_BAD) session_ok = false;
+        long long backoff_ms = std::min(100LL << std::min(failures - 1, 6), 5000LL);
+        for (long long waited = 0; waited < backoff_ms && !replayers_stop.load(); waited += 20) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+
+    if (spool->pending_bytes() > 0) {
+        std::cout << "Spool " << spool->dir() << ": " << spool->pending_bytes()
+                  << " bytes left, replayed on the next start" << std::endl;
+    }
+    if (conn) PQfinish(conn);
+}
+
+// Tries a batch gets when the database rejects its data (pg_error.hpp).
+const int DATA_ERROR_ATTEMPTS = 3;
+
+// One per DbWriter. Batch size and flush time come from `controller` (see
+// batch_controller.hpp): the writer sleeps on its wakeup until enough rows for
+// the target batch are queued or the oldest row's linger runs out, instead
+// of polling. While idle it checks its connection every 5 s.
+//
+// Failed batches are kept and retried with exponential backoff (100 ms up to
+// 5 s) instead of being dropped, so the DB queue fills and the workers slow
+// down while TimescaleDB is unavailable. With --commit manual, offsets are
+// committed only after a batch's ticks and bars are both written. After
+// shutdown starts, a batch gets three attempts; if it still fails, it and
+// everything after it is dropped and no further offsets are committed, so a
+// restart replays from the last durable position.
+//
+// A batch the database rejects as invalid data (pg_error.hpp) would fail the
+// same way forever, so it gets DATA_ERROR_ATTEMPTS tries and is then dropped
+// and counted; its offsets are committed as if it had been written. Ticks
+// and bars are rejected separately, so bad ticks do not take their batch's
+// bars with them.
+//
+// With --db-spool a batch that failed for any reason but its data goes to
+// the spool instead, and so does every batch after it until the replayer has
+// caught up. Offsets covering spooled batches are committed once the spool
+// is synced.
+void batch_writer(DbWriter *dw, DbSinkMode sink, const std::string& topic, BatchController controller) {
+    LatencyHistogram *db_queue_hist = latency_registry.create("db_queue");
+    LatencyHistogram *db_write_hist = latency_registry.create("db_write");
+    LatencyHistogram *db_e2e_hist = latency_registry.create("db_e2e");
+
+    const size_t max_rows = controller.max_rows();
     std::vector<MessageBatch> local_batch;
-    local_batch.reserve(BATCH_SIZE);
+    local_batch.reserve(max_rows);
+    std::vector<CompletedBar> local_bars;
+    PgCopyBinaryEncoder encoder;
+    OffsetTracker offsets(topic, bar_floors.get());
+    const bool manual_commit = commit_mode == CommitMode::Manual;
+    PGconn *conn = dw->conn;
+    BoundedRingBuffer<MessageBatch>& rows_queue = *dw->rows;
+    BoundedRingBuffer<CompletedBar>& bar_queue = *dw->bars;
+    const long long health_interval_ns = 5000000000LL;
 
-    auto last_flush = std::chrono::steady_clock::now();
     long long total_written = 0;
+    long long bars_since_ns = 0;  // monotonic time the oldest pending bar was taken
+    bool rows_written = false;    // ticks are in, bars still failing
+    int failures = 0;
+    long long retry_at_ns = 0;
+    bool abandoned = false;
+    long long next_health_check_ns = monotonic_ns() + health_interval_ns;
+    auto queued = [&] { return rows_queue.size_approx() > 0 || bar_queue.size_approx() > 0; };
+    bool commit_waiting = false;  // noted offsets held back until the spool is synced
+    auto commit_offsets = [&](bool force) {
+        if (!commit_waiting || !spool_durable(*dw, force)) return;
+        rd_kafka_resp_err_t err = offsets.commit_pending(kafka_consumer);
+        commit_waiting = offsets.has_pending();
+        if (err == RD_KAFKA_RESP_ERR_NO_ERROR) kafka_commits++;
+        else if (err != RD_KAFKA_RESP_ERR__NO_OFFSET) kafka_commit_errors++;
+    };
+
+    while (true) {
+        bool stopping = writer_stop.load();
+
+        // A batch waiting to be retried is resent exactly as it was
+        if (failures == 0) {
+            size_t before = local_batch.size();
+            size_t taken = rows_queue.pop_bulk(local_batch, max_rows - before);
+            long long dequeued_at = monotonic_ns();
+            for (size_t i = before; i < local_batch.size(); i++) {
+                db_queue_hist->record(dequeued_at - local_batch[i].enqueue_ns);
+            }
+            controller.observe_arrivals(taken, dequeued_at);
+            if (bar_queue.pop_bulk(local_bars, max_rows - local_bars.size()) > 0 && bars_since_ns == 0) {
+                bars_since_ns = dequeued_at;
+            }
+        }
 
-    while (run) {
+        long long now_ns = monotonic_ns();
+        if (local_batch.empty() && local_bars.empty()) {
+            if (stopping && !queued()) break;
+            commit_offsets(true);
+            if (now_ns >= next_health_check_ns) {
+                if (dw->spooling) writing_directly(*dw);
+                else check_connection(*dw);
+                next_health_check_ns = monotonic_ns() + health_interval_ns;
+            }
+            dw->wakeup.wait(100000000LL, 1, [&] { return writer_stop.load() || queued(); });
+            continue;
+        }
 
-        {
-            std::lock_guard<std::mutex> lock(queue_mutex);
-            while (!batch_queue.empty() && local_batch.size() < BATCH_SIZE) {
-                local_batch.push_back(batch_queue.front());
-                batch_queue.pop();
+        size_t target = controller.target_rows();
+        if (failures > 0) {
+            if (now_ns < retry_at_ns) {
+                dw->wakeup.wait(retry_at_ns - now_ns, SIZE_MAX, [&] { return !stopping && writer_stop.load(); });
+                continue;
+            }
+        } else if (!stopping && local_batch.size() < target && local_bars.size() < max_rows) {
+            long long oldest = local_batch.empty() ? bars_since_ns : local_batch.front().enqueue_ns;
+            if (!local_bars.empty() && bars_since_ns < oldest) oldest = bars_since_ns;
+            long long deadline = oldest + controller.linger_ns(target);
+            if (now_ns < deadline) {
+                size_t need = target - local_batch.size();
+                dw->wakeup.wait(deadline - now_ns, need,
+                                [&] { return writer_stop.load() || rows_queue.size_approx() >= need; });
+                continue;
             }
         }
 
+        size_t rows = 0;
+        for (const auto& msg : local_batch) {
+            if (msg.symbol_id != SymbolTable::INVALID) rows++;
+        }
 
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_flush).count();
+        bool ok = !abandoned;
+        bool rejected = false;  // the database refused the data itself
+        bool fell_back = false;  // the failed write was counted and offered to the spool
+        if (ok && !writing_directly(*dw)) {
+            ok = spool_batch(*dw, local_batch, local_bars, rows_written);
+        } else if (ok) {
+            if (!rows_written) {
+                long long write_start = monotonic_ns();
+                ok = (sink == DbSinkMode::Copy)
+                    ? write_batch_copy(conn, encoder, local_batch)
+                    : write_batch_insert(conn, local_batch);
+                long long write_ns = monotonic_ns() - write_start;
+                db_write_hist->record(write_ns);
+                if (ok && rows > 0) {
+                    rows_written = true;
+                    controller.observe_write(rows, write_ns);
+                    db_last_batch_rows = rows;
+                    total_written += rows;
+                    db_rows_written += rows;
+                    db_batches_written++;
+                    long long committed_at = current_timestamp_ns() + clock_correction_ns();  // in the producer clock
+                    for (const auto& msg : local_batch) {
+                        if (msg.symbol_id != SymbolTable::INVALID) db_e2e_hist->record(committed_at - msg.timestamp_ns);
+                    }
+                }
+            }
+            if (ok && !local_bars.empty()) ok = write_bars_copy(conn, encoder, local_bars);
+            if (!ok) rejected = pg_classify_failure(conn) == PgFailure::Data;
+            // With a spool a batch the database could not take moves there instead of being retried
+            if (!ok && dw->spool && !rejected) {
+                db_write_errors++;
+                fell_back = true;
+                ok = spool_batch(*dw, local_batch, local_bars, rows_written);
+            }
+        }
 
-        bool should_flush = !local_batch.empty() &&
-                            (local_batch.size() >= BATCH_SIZE || elapsed >= FLUSH_INTERVAL_MS);
+        if (!ok && !abandoned) {
+            if (!fell_back) db_write_errors++;
+            failures++;
+            reconnect_if_broken(*dw);
+            if (rejected ? failures < DATA_ERROR_ATTEMPTS : (run || failures < 3)) {
+                long long backoff_ms = std::min(100LL << std::min(failures - 1, 6), 5000LL);
+                retry_at_ns = monotonic_ns() + backoff_ms * 1000000LL;
+                continue;
+            }
+            if (rejected && !rows_written) {
+                std::cerr << "Writer " << dw->id << ": dropping " << rows << " ticks rejected by TimescaleDB (SQLSTATE "
+                          << pg_last_sqlstate() << ")" << std::endl;
+                db_rows_rejected += rows;
+                rows_written = true;
+                if (!local_bars.empty()) {
+                    // The bars still get attempts of their own; failures stays
+                    // nonzero so the batch is not refilled in the meantime
+                    failures = 1;
+                    retry_at_ns = monotonic_ns();
+                    continue;
+                }
+                ok = true;
+            } else if (rejected) {
+                std::cerr << "Writer " << dw->id << ": dropping " << local_bars.size()
+                          << " bars rejected by TimescaleDB (SQLSTATE " << pg_last_sqlstate() << ")" << std::endl;
+                db_bars_rejected += local_bars.size();
+                ok = true;
+            } else {
+                abandoned = true;
+                failures = 0;
+                std::cerr << "Writer " << dw->id << ": giving up on TimescaleDB during shutdown; offsets after "
+                          << "this point are not committed for its partitions" << std::endl;
+            }
+        }
+
+        if (ok) {
+            release_bars(local_bars.data(), local_bars.size());
+            if (manual_commit) {
+                for (const auto& msg : local_batch) {
+                    if (msg.last_in_record) offsets.note(msg.partition, msg.offset + 1);
+                }
+                commit_waiting = true;
+                commit_offsets(false);
+            }
+            failures = 0;
+            next_health_check_ns = monotonic_ns() + health_interval_ns;
+        } else {
+            db_rows_dropped += rows_written ? 0 : rows;
+        }
 
-        if (should_flush) {
-            std::string query = "INSERT INTO market_updates (time, ticker, price, volume, latency_ms) VALUES ";
+        dw->target_rows = target;
+        dw->ingest_rate = controller.rows_per_second();
+        dw->write_overhead_ns = controller.overhead_ns();
+        dw->write_cost_ns = controller.cost_per_row_ns();
 
-            for (size_t i = 0; i < local_batch.size(); i++) {
-                const auto& msg = local_batch[i];
-                long long timestamp_ms = msg.timestamp_ns / 1000000;
+        rows_written = false;
+        local_batch.clear();
+        local_bars.clear();
+        bars_since_ns = 0;
+    }
 
-                char value_str[256];
-                snprintf(value_str, sizeof(value_str),
-                    "(to_timestamp(%lld / 1000.0), '%s', %f, %d, %f)",
-                    timestamp_ms, msg.ticker.c_str(), msg.price, msg.volume, msg.latency_ms);
-                query += value_str;
-                if (i < local_batch.size() - 1) query += ",";
-            }
+    if (manual_commit && !abandoned && kafka_consumer && spool_durable(*dw, true)) {
+        rd_kafka_resp_err_t err = offsets.commit_all_sync(kafka_consumer);
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR && err != RD_KAFKA_RESP_ERR__NO_OFFSET) {
+            std::cerr << "Final offset commit failed: " << rd_kafka_err2str(err) << std::endl;
+            kafka_commit_errors++;
+        }
+    }
+    std::cout << "Batch writer " << dw->id << ": Total written to DB: " << total_written << std::endl;
+    writers_running--;
+}
 
-            PGresult *res = PQexec(conn, query.c_str());
 
-            if (PQresultStatus(res) == PGRES_COMMAND_OK) {
-                total_written += local_batch.size();
+// Column arrays for the pipelined unnest() INSERTs, reused across batches.
+struct UnnestColumns {
+    PgArrayEncoder column[10];
+    const char *values[10];
+    int lengths[10];
+
+    void begin(const uint32_t *element_oids, int n) {
+        for (int i = 0; i < n; i++) column[i].begin(element_oids[i]);
+    }
+
+    void finish(int n, size_t elements) {
+        for (int i = 0; i < n; i++) {
+            column[i].finish(elements);
+            values[i] = column[i].data();
+            lengths[i] = static_cast<int>(column[i].size());
+        }
+    }
+};
+
+// Column order matches pipelined_updates_sql(). Compact batches must have
+// been through db_symbol_ids->resolve().
+bool send_rows_pipelined(PgPipeline& pipeline, UnnestColumns& c, const std::vector<MessageBatch>& batch) {
+    static const uint32_t rows_oids[8] = {pg_oid::TIMESTAMPTZ, pg_oid::TEXT, pg_oid::FLOAT8, pg_oid::INT4,
+                                          pg_oid::FLOAT8, pg_oid::INT4, pg_oid::INT8, pg_oid::INT4};
+    static const uint32_t compact_oids[7] = {pg_oid::TIMESTAMPTZ, pg_oid::INT4, pg_oid::FLOAT8, pg_oid::INT4,
+                                             pg_oid::INT4, pg_oid::INT8, pg_oid::INT4};
+    const bool compact = db_schema == DbSchema::Compact;
+    const int base = compact ? 4 : 5;
+    const int n = base + (db_idempotent ? 3 : 0);
+    c.begin(compact ? compact_oids : rows_oids, n);
+    size_t rows = 0;
+    for (const auto& msg : batch) {
+        if (msg.symbol_id == SymbolTable::INVALID) continue;  // offset marker
+        c.column[0].add_timestamptz_ns(msg.timestamp_ns);
+        if (compact) {
+            c.column[1].add_int4(db_symbol_ids->get(msg.symbol_id));
+        } else {
+            std::string_view ticker = symbols->name(msg.symbol_id);
+            c.column[1].add_text(ticker.data(), ticker.size());
+        }
+        c.column[2].add_float8(msg.price);
+        c.column[3].add_int4(msg.volume);
+        if (!compact) c.column[4].add_float8(msg.latency_ms);
+        if (db_idempotent) {
+            c.column[base].add_int4(msg.partition);
+            c.column[base + 1].add_int8(msg.offset);
+            c.column[base + 2].add_int4(msg.seq);
+        }
+        rows++;
+    }
+    c.finish(n, rows);
+    return pipeline.send("insert_updates", n, c.values, c.lengths);
+}
+
+bool send_bars_pipelined(PgPipeline& pipeline, UnnestColumns& c, const std::vector<CompletedBar>& bars) {
+    static const uint32_t oids[10] = {pg_oid::TIMESTAMPTZ, pg_oid::TEXT, pg_oid::INT4, pg_oid::FLOAT8,
+                                      pg_oid::FLOAT8, pg_oid::FLOAT8, pg_oid::FLOAT8, pg_oid::INT8,
+                                      pg_oid::FLOAT8, pg_oid::INT4};
+    c.begin(oids, 10);
+    for (const auto& bar : bars) {
+        c.column[0].add_timestamptz_ns(bar.start_ns);
+        std::string_view ticker = symbols->name(bar.symbol_id);
+        c.column[1].add_text(ticker.data(), ticker.size());
+        c.column[2].add_int4(bar.interval_s);
+        c.column[3].add_float8(bar.open);
+        c.column[4].add_float8(bar.high);
+        c.column[5].add_float8(bar.low);
+        c.column[6].add_float8(bar.close);
+        c.column[7].add_int8(bar.volume);
+        c.column[8].add_float8(bar.vwap);
+        c.column[9].add_int4(static_cast<int32_t>(bar.trades));
+    }
+    c.finish(10, bars.size());
+    return pipeline.send("insert_bars", 10, c.values, c.lengths);
+}
+
+// One DB batch under --db-sink pipeline: its ticks and bars travel as one
+// pipeline segment (one implicit transaction).
+struct PipelinedBatch {
+    enum State { InFlight, Done, Failed };
+    std::vector<MessageBatch> rows;
+    std::vector<CompletedBar> bars;
+    size_t row_count = 0;  // rows minus offset markers
+    State state = InFlight;
+    int attempts = 0;
+    long long sent_ns = 0;
+    long long retry_at_ns = 0;
+};
+
+// --db-sink pipeline variant of batch_writer. Up to `depth` batches are
+// outstanding at once: the next one is gathered and encoded while the server
+// is still writing the previous ones, so network and commit latency overlap
+// instead of adding up per batch.
+//
+// Segments may finish out of order with respect to their success (a failed
+// batch does not abort later ones), so offsets are committed strictly in
+// send order: a batch's offsets are noted only once it and every batch before
+// it are written. A failed batch is re-sent on its own after the usual
+// backoff; a lost connection fails everything in flight, since none of it
+// will report back. Retries, rejected data, shutdown and --db-spool follow
+// batch_writer.
+void pipelined_batch_writer(DbWriter *dw, const std::string& topic, BatchController controller, size_t depth) {
+    LatencyHistogram *db_queue_hist = latency_registry.create("db_queue");
+    LatencyHistogram *db_write_hist = latency_registry.create("db_write");
+    LatencyHistogram *db_e2e_hist = latency_registry.create("db_e2e");
+
+    const size_t max_rows = controller.max_rows();
+    OffsetTracker offsets(topic, bar_floors.get());
+    const bool manual_commit = commit_mode == CommitMode::Manual;
+    BoundedRingBuffer<MessageBatch>& rows_queue = *dw->rows;
+    BoundedRingBuffer<CompletedBar>& bar_queue = *dw->bars;
+    PgPipeline& pipeline = dw->pipeline;
+    UnnestColumns columns;
+    const long long health_interval_ns = 5000000000LL;
+
+    std::deque<std::unique_ptr<PipelinedBatch>> pending;  // sent or awaiting a retry, oldest first
+    std::deque<PipelinedBatch*> in_flight;                // in pipeline order
+    std::vector<std::unique_ptr<PipelinedBatch>> spare;
+    std::unique_ptr<PipelinedBatch> current(new PipelinedBatch);
+    current->rows.reserve(max_rows);
+
+    long long total_written = 0;
+    long long bars_since_ns = 0;
+    bool abandoned = false;
+    long long next_health_check_ns = monotonic_ns() + health_interval_ns;
+    auto queued = [&] { return rows_queue.size_approx() > 0 || bar_queue.size_approx() > 0; };
+
+    bool commit_waiting = false;  // noted offsets held back until the spool is synced
+    auto commit_offsets = [&](bool force) {
+        if (!commit_waiting || !spool_durable(*dw, force)) return;
+        rd_kafka_resp_err_t err = offsets.commit_pending(kafka_consumer);
+        commit_waiting = offsets.has_pending();
+        if (err == RD_KAFKA_RESP_ERR_NO_ERROR) kafka_commits++;
+        else if (err != RD_KAFKA_RESP_ERR__NO_OFFSET) kafka_commit_errors++;
+    };
+
+    // `data_error`: the database rejected this batch's own data, which a retry
+    // or the spool cannot fix; after DATA_ERROR_ATTEMPTS its ticks, then its
+    // bars, are dropped as in batch_writer
+    auto fail = [&](PipelinedBatch& b, long long now_ns, bool data_error) {
+        db_write_errors++;
+        // With a spool a batch the database could not take moves there instead of being retried
+        if (!data_error && dw->spool && spool_batch(*dw, b.rows, b.bars, b.row_count == 0)) {
+            b.state = PipelinedBatch::Done;
+            return;
+        }
+        b.state = PipelinedBatch::Failed;
+        b.attempts++;
+        if (data_error && b.attempts >= DATA_ERROR_ATTEMPTS) {
+            if (b.row_count > 0) {
+                std::cerr << "Writer " << dw->id << ": dropping " << b.row_count
+                          << " ticks rejected by TimescaleDB (SQLSTATE " << pg_last_sqlstate() << ")" << std::endl;
+                db_rows_rejected += b.row_count;
+                b.row_count = 0;  // from now on only the bars are sent
+                b.attempts = 0;
+                if (!b.bars.empty()) {
+                    b.retry_at_ns = now_ns;
+                    return;
+                }
             } else {
-                std::cerr << "Batch insert failed: " << PQerrorMessage(conn) << std::endl;
+                std::cerr << "Writer " << dw->id << ": dropping " << b.bars.size()
+                          << " bars rejected by TimescaleDB (SQLSTATE " << pg_last_sqlstate() << ")" << std::endl;
+                db_bars_rejected += b.bars.size();
             }
+            b.state = PipelinedBatch::Done;  // settled: its offsets are committed
+            return;
+        }
+        long long backoff_ms = std::min(100LL << std::min(b.attempts - 1, 6), 5000LL);
+        b.retry_at_ns = now_ns + backoff_ms * 1000000LL;
+        if (!run && b.attempts >= 3 && !abandoned) {
+            abandoned = true;
+            std::cerr << "Writer " << dw->id << ": giving up on TimescaleDB during shutdown; offsets after "
+                      << "this point are not committed for its partitions" << std::endl;
+        }
+    };
+    auto fail_in_flight = [&](long long now_ns) {
+        for (PipelinedBatch *b : in_flight) fail(*b, now_ns, false);
+        in_flight.clear();
+        dw->healthy = false;
+        pipeline.reset();
+    };
+    auto send = [&](PipelinedBatch& b) {
+        long long now_ns = monotonic_ns();
+        if (b.row_count == 0 && b.bars.empty()) {
+            b.state = PipelinedBatch::Done;  // offset markers only
+            return;
+        }
+        // Batches keep going to the spool until the replayer has caught up;
+        // the session is only reset once nothing is in flight on it
+        if (dw->spooling && (!in_flight.empty() || !writing_directly(*dw))) {
+            if (spool_batch(*dw, b.rows, b.bars, b.row_count == 0)) b.state = PipelinedBatch::Done;
+            else fail(b, now_ns, false);
+            return;
+        }
+        if (b.row_count > 0 && db_symbol_ids && !db_symbol_ids->resolve(b.rows)) {
+            // The symbols connection failed or a ticker was rejected; the pipeline itself is fine
+            fail(b, now_ns, pg_classify_failure(dw->conn) == PgFailure::Data);
+            return;
+        }
+        if (!dw->healthy || PQstatus(dw->conn) == CONNECTION_BAD) reconnect_if_broken(*dw);
+        bool ok = dw->healthy &&
+                  (b.row_count == 0 || send_rows_pipelined(pipeline, columns, b.rows)) &&
+                  (b.bars.empty() || send_bars_pipelined(pipeline, columns, b.bars)) &&
+                  pipeline.sync();
+        if (!ok) {
+            // A half-sent segment leaves the pipeline unusable: start over on a fresh session
+            std::cerr << "Pipelined batch send failed: " << pipeline.error() << std::endl;
+            fail_in_flight(now_ns);
+            fail(b, now_ns, false);
+            return;
+        }
+        b.state = PipelinedBatch::InFlight;
+        b.sent_ns = now_ns;
+        in_flight.push_back(&b);
+    };
+
+    while (true) {
+        bool stopping = writer_stop.load();
+
+        // Replies, oldest segment first
+        while (!in_flight.empty()) {
+            int result = pipeline.next_result(false);
+            if (result < 0) break;
+            PipelinedBatch& b = *in_flight.front();
+            in_flight.pop_front();
+            long long done_ns = monotonic_ns();
+            if (result == 1) {
+                long long write_ns = done_ns - b.sent_ns;
+                db_write_hist->record(write_ns);
+                b.state = PipelinedBatch::Done;
+                next_health_check_ns = done_ns + health_interval_ns;
+                if (b.row_count == 0) continue;
+                controller.observe_write(b.row_count, write_ns);
+                db_last_batch_rows = b.row_count;
+                total_written += b.row_count;
+                db_rows_written += b.row_count;
+                db_batches_written++;
+                long long committed_at = current_timestamp_ns() + clock_correction_ns();  // in the producer clock
+                for (const auto& msg : b.rows) {
+                    if (msg.symbol_id != SymbolTable::INVALID) db_e2e_hist->record(committed_at - msg.timestamp_ns);
+                }
+                continue;
+            }
+            std::cerr << "Pipelined batch failed: " << pipeline.error() << std::endl;
+            fail(b, done_ns, pg_classify_failure(dw->conn) == PgFailure::Data);
+            // The connection went away: the rest will never report back
+            if (pipeline.in_flight() != in_flight.size()) fail_in_flight(done_ns);
+        }
+
+        // Commit everything up to the oldest unfinished batch
+        bool noted = false;
+        while (!pending.empty()) {
+            PipelinedBatch& b = *pending.front();
+            if (b.state == PipelinedBatch::Done) {
+                release_bars(b.bars.data(), b.bars.size());
+                if (manual_commit && !abandoned) {
+                    for (const auto& msg : b.rows) {
+                        if (msg.last_in_record) offsets.note(msg.partition, msg.offset + 1);
+                    }
+                    noted = true;
+                }
+            } else if (abandoned && b.state == PipelinedBatch::Failed) {
+                db_rows_dropped += b.row_count;
+            } else {
+                break;
+            }
+            b.rows.clear();
+            b.bars.clear();
+            b.row_count = 0;
+            b.attempts = 0;
+            spare.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+        if (noted) commit_waiting = true;
+        commit_offsets(false);
+
+        // Failed batches go out again once their backoff has passed
+        long long now_ns = monotonic_ns();
+        long long next_retry_ns = LLONG_MAX;
+        if (!abandoned) {
+            for (auto& b : pending) {
+                if (b->state != PipelinedBatch::Failed) continue;
+                if (now_ns >= b->retry_at_ns) send(*b);
+                if (b->state == PipelinedBatch::Failed) next_retry_ns = std::min(next_retry_ns, b->retry_at_ns);
+            }
+        }
+
+        // Gather the next batch; it keeps growing while the pipeline is full
+        size_t before = current->rows.size();
+        size_t taken = rows_queue.pop_bulk(current->rows, max_rows - before);
+        long long dequeued_at = monotonic_ns();
+        for (size_t i = before; i < current->rows.size(); i++) {
+            db_queue_hist->record(dequeued_at - current->rows[i].enqueue_ns);
+        }
+        controller.observe_arrivals(taken, dequeued_at);
+        if (bar_queue.pop_bulk(current->bars, max_rows - current->bars.size()) > 0 && bars_since_ns == 0) {
+            bars_since_ns = dequeued_at;
+        }
+        if (abandoned) {
+            for (const auto& msg : current->rows) {
+                if (msg.symbol_id != SymbolTable::INVALID) db_rows_dropped++;
+            }
+            current->rows.clear();
+            current->bars.clear();
+            bars_since_ns = 0;
+        }
+
+        now_ns = monotonic_ns();
+        size_t target = controller.target_rows();
+        bool has_rows = !current->rows.empty() || !current->bars.empty();
+        long long deadline = LLONG_MAX;
+        if (has_rows) {
+            long long oldest = current->rows.empty() ? bars_since_ns : current->rows.front().enqueue_ns;
+            if (!current->bars.empty() && bars_since_ns < oldest) oldest = bars_since_ns;
+            deadline = oldest + controller.linger_ns(target);
+            bool due = stopping || current->rows.size() >= target || current->bars.size() >= max_rows ||
+                       now_ns >= deadline;
+            if (due && pending.size() < depth) {
+                PipelinedBatch *b = current.get();
+                for (const auto& msg : b->rows) {
+                    if (msg.symbol_id != SymbolTable::INVALID) b->row_count++;
+                }
+                pending.push_back(std::move(current));
+                if (spare.empty()) {
+                    current.reset(new PipelinedBatch);
+                    current->rows.reserve(max_rows);
+                } else {
+                    current = std::move(spare.back());
+                    spare.pop_back();
+                }
+                bars_since_ns = 0;
+                send(*b);
+
+                dw->target_rows = target;
+                dw->ingest_rate = controller.rows_per_second();
+                dw->write_overhead_ns = controller.overhead_ns();
+                dw->write_cost_ns = controller.cost_per_row_ns();
+                continue;
+            }
+        }
 
-            PQclear(res);
-            local_batch.clear();
-            last_flush = now;
+        if (stopping && pending.empty() && !has_rows && !queued()) break;
 
+        if (!has_rows) commit_offsets(true);
+        if (pending.empty() && !has_rows && now_ns >= next_health_check_ns) {
+            if (dw->spooling) writing_directly(*dw);
+            else check_connection(*dw);
+            next_health_check_ns = monotonic_ns() + health_interval_ns;
+        }
+
+        // Sleep until enough rows arrive, a reply comes in, a retry is due or
+        // the current batch's linger runs out
+        long long wake_at = std::min(now_ns + 100000000LL, next_retry_ns);
+        if (commit_waiting && dw->spool && dw->spool->dirty()) {
+            wake_at = std::min(wake_at, dw->spool_synced_ns + spool_sync_ns);
+        }
+        size_t wake_depth = 1;
+        if (has_rows && pending.size() < depth) {
+            wake_at = std::min(wake_at, deadline);
+            wake_depth = target > current->rows.size() ? target - current->rows.size() : 1;
+        } else if (has_rows) {
+            wake_depth = SIZE_MAX;  // pipeline full: only a reply frees a slot
+        }
+        dw->wakeup.wait(wake_at - now_ns, wake_depth,
+                        [&] { return (!stopping && writer_stop.load()) || rows_queue.size_approx() >= wake_depth; },
+                        in_flight.empty() ? -1 : pipeline.socket());
+    }
+
+    if (manual_commit && !abandoned && kafka_consumer && spool_durable(*dw, true)) {
+        rd_kafka_resp_err_t err = offsets.commit_all_sync(kafka_consumer);
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR && err != RD_KAFKA_RESP_ERR__NO_OFFSET) {
+            std::cerr << "Final offset commit failed: " << rd_kafka_err2str(err) << std::endl;
+            kafka_commit_errors++;
+        }
+    }
+    std::cout << "Batch writer " << dw->id << ": Total written to DB: " << total_written << std::endl;
+    writers_running--;
+}
+
+
+redisContext* connect_to_redis(const std::string& host) {
+    redisContext *redis = redisConnect(host.c_str(), 6379);
+    if (redis == NULL || redis->err) {
+        if (redis) {
+            std::cerr << "Redis Error: " << redis->errstr << std::endl;
+            redisFree(redis);
+        } else {
+            std::cerr << "Can't allocate Redis context" << std::endl;
+        }
+        return NULL;
+    }
+    return redis;
+}
+
+// Per-thread consumer state. Nothing in here is shared between workers: each
+// owns its Redis pipeline (sync mode) and protobuf scratch object, and in
+// sharded mode its own Kafka queue that the partitions it owns are forwarded to.
+struct ConsumerWorker {
+    int id = 0;
+    redisContext *redis = NULL;
+    rd_kafka_queue_t *queue = NULL;
+    marketdata::MarketUpdate update;  // scratch for --decoder protobuf
+    marketdata::MarketUpdateBatch batch_update;
+    MarketUpdateView view;
+    std::vector<MarketUpdateView> batch_views;  // ticks of the current MarketUpdateBatch record
+    MarketUpdateBatchScratch batch_scratch;
+    DecoderMode decoder = DecoderMode::Wire;
+    PayloadFormat format = PayloadFormat::Auto;
+    int redis_pipeline_count = 0;
+    long long msg_count = 0;
+    LatencyHistogram *kafka_hist = NULL;
+    LatencyHistogram *decode_hist = NULL;
+    LatencyHistogram *redis_flush_hist = NULL;
+    LatencyHistogram *redis_staleness_hist = NULL;  // sync mode with coalescing
+    long long next_coalesce_ns = 0;
+    std::vector<LastValue> coalesced;
+    RespWriter redis_args;
+    std::string redis_key;  // scratch for bar keys
+    bool store_ticks = true;
+    std::unique_ptr<BarEngine> bars;  // NULL when bar aggregation is disabled
+    std::vector<CompletedBar> completed_bars;
+    long long next_bar_check_ns = 0;
+    std::vector<rd_kafka_message_t*> burst;  // --poll-batch: slots for the messages after the first
+    bool busy_poll = false;
+    bool drained = false;        // busy-poll: idle work already ran since the last message
+    long long next_idle_ns = 0;
+};
+
+void flush_redis_pipeline(ConsumerWorker& w) {
+    long long start = monotonic_ns();
+    for (int i = 0; i < w.redis_pipeline_count; i++) {
+        redisReply *reply;
+        if (redisGetReply(w.redis, (void**)&reply) == REDIS_OK) {
+            freeReplyObject(reply);
+        }
+    }
+    redis_commands_total += w.redis_pipeline_count;
+    redis_flushes_total++;
+    w.redis_pipeline_count = 0;
+    w.redis_flush_hist->record(monotonic_ns() - start);
+}
+
+// Sync mode: writes the prices that changed since the last flush by any worker
+// (MSET, price hash, optional stream/pub-sub fan-out) as one pipeline.
+void flush_last_values(ConsumerWorker& w, long long now_ns) {
+    w.next_coalesce_ns = now_ns + redis_coalesce_ns;
+    w.coalesced.clear();
+    if (last_values->drain(w.coalesced) == 0) return;
+
+    const size_t chunk = 512;
+    for (size_t first = 0; first < w.coalesced.size(); first += chunk) {
+        size_t count = std::min(chunk, w.coalesced.size() - first);
+        build_price_commands(w.redis_args, w.coalesced, first, count, *symbols, price_outputs, [&w](RespWriter& args) {
+            std::string_view cmd = args.command();
+            redisAppendFormattedCommand(w.redis, cmd.data(), cmd.size());
+            w.redis_pipeline_count++;
+        });
+    }
+    for (const LastValue& v : w.coalesced) w.redis_staleness_hist->record(now_ns - v.dirty_since_ns);
+    flush_redis_pipeline(w);
+}
+
+// Sends finished bars to Redis (one hash per ticker and interval) and queues them for market_bars.
+void publish_bars(ConsumerWorker& w) {
+    for (const auto& bar : w.completed_bars) {
+        if (redis_sink) {
+            RedisOp op;
+            op.kind = RedisOp::PublishBar;
+            op.symbol_id = bar.symbol_id;
+            op.price = bar.close;
+            op.bar = bar;
+            // Bars are rare and not superseded by the next tick, so wait for room
+            while (run && !redis_sink->submit(op)) std::this_thread::yield();
         } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            build_bar_command(w.redis_args, w.redis_key, bar, symbols->name(bar.symbol_id));
+            std::string_view cmd = w.redis_args.command();
+            redisAppendFormattedCommand(w.redis, cmd.data(), cmd.size());
+            w.redis_pipeline_count++;
+        }
+        if (db_schema == DbSchema::Rows) queue_bar(bar);  // compact: continuous aggregates
+    }
+    bars_emitted += w.completed_bars.size();
+    w.completed_bars.clear();
+
+    if (w.redis_pipeline_count >= 100) {
+        flush_redis_pipeline(w);
+    }
+}
+
+// Closes bars of quiet tickers once their window has passed (checked at most every 100 ms).
+void expire_bars(ConsumerWorker& w, long long now_ns) {
+    if (!w.bars || now_ns < w.next_bar_check_ns) return;
+    w.next_bar_check_ns = now_ns + 100000000LL;
+    w.bars->flush_expired(now_ns, w.completed_bars);
+    if (!w.completed_bars.empty()) publish_bars(w);
+}
+
+// Decodes one payload into w.view and resolves its symbol ID. Counts and
+// returns false for anything that cannot be processed.
+bool decode_update(ConsumerWorker& w, const void *payload, size_t len, uint32_t& symbol_id) {
+    MarketUpdateView& update = w.view;
+    bool use_packed = w.format == PayloadFormat::Packed ||
+                      (w.format == PayloadFormat::Auto && packed::is_packed(payload, len));
+    if (use_packed) {
+        packed::Update p;
+        if (!packed::decode(payload, len, p)) {
+            decode_errors++;
+            return false;
+        }
+        // Only dictionary IDs are shared with the producer; later IDs are local
+        if (p.symbol_id >= dictionary_size) {
+            unknown_symbol_ids++;
+            return false;
         }
+        symbol_id = p.symbol_id;
+        update.ticker = symbols->name(symbol_id);
+        update.price = p.price;
+        update.volume = p.volume;
+        update.timestamp_ns = p.timestamp_ns;
+        return true;
     }
 
-    if (!local_batch.empty()) {
-        std::cout << "Flushing " << local_batch.size() << " remaining DB writes..." << std::endl;
+    bool decoded;
+    if (w.decoder == DecoderMode::Wire) {
+        decoded = decode_market_update(payload, len, update);
+    } else {
+        decoded = w.update.ParseFromArray(payload, static_cast<int>(len));
+        if (decoded) {
+            update.ticker = w.update.ticker();
+            update.price = w.update.price();
+            update.volume = w.update.volume();
+            update.timestamp_ns = w.update.timestamp_ns();
+        }
+    }
+    if (!decoded) {
+        decode_errors++;
+        return false;
+    }
+
+    symbol_id = symbols->intern(update.ticker);
+    if (symbol_id == SymbolTable::INVALID) {
+        symbol_overflows++;
+        return false;
+    }
+    return true;
+}
+
+// Decodes a MarketUpdateBatch record into w.batch_views in one pass. The
+// protobuf decoder expands the delta form the same way the wire reader does.
+bool decode_batch(ConsumerWorker& w, const void *payload, size_t len) {
+    if (w.decoder == DecoderMode::Wire) {
+        if (decode_market_update_batch(payload, len, w.batch_views, w.batch_scratch)) return true;
+        decode_errors++;
+        return false;
+    }
+
+    const marketdata::MarketUpdateBatch& b = w.batch_update;
+    if (!w.batch_update.ParseFromArray(payload, static_cast<int>(len)) ||
+        b.price_delta_size() != b.symbol_index_size() || b.timestamp_delta_ns_size() != b.symbol_index_size() ||
+        b.volume_size() != b.symbol_index_size()) {
+        decode_errors++;
+        return false;
+    }
+    w.batch_views.clear();
+    for (const auto& u : b.updates()) {
+        MarketUpdateView view;
+        view.ticker = u.ticker();
+        view.price = u.price();
+        view.volume = u.volume();
+        view.timestamp_ns = u.timestamp_ns();
+        w.batch_views.push_back(view);
+    }
+    w.batch_scratch.last_price.assign(b.symbols_size(), 0);
+    int64_t timestamp_ns = 0;
+    for (int i = 0; i < b.symbol_index_size(); i++) {
+        uint32_t index = b.symbol_index(i);
+        if (index >= static_cast<uint32_t>(b.symbols_size())) {
+            decode_errors++;
+            return false;
+        }
+        int64_t& price = w.batch_scratch.last_price[index];
+        price += b.price_delta(i);
+        timestamp_ns += b.timestamp_delta_ns(i);
+
+        MarketUpdateView view;
+        view.ticker = b.symbols(index);
+        view.price = price / 1e6;
+        view.volume = b.volume(i);
+        view.timestamp_ns = timestamp_ns;
+        w.batch_views.push_back(view);
+    }
+    return true;
+}
+
+// Everything after decode for one tick: Redis, bars and the DB queue. `seq`
+// is the tick's index in its record and `last` marks the record's final tick.
+// Returns true when a DB row was queued.
+bool handle_update(ConsumerWorker& w, const MarketUpdateView& update, uint32_t symbol_id,
+                   long long arrival_timestamp, long long decode_end,
+                   const rd_kafka_message_t *rkmessage, int32_t seq, bool last) {
+    // Calculate end-to-end latency. Below zero means the clocks disagree by
+    // more than the latency: counted, then clamped for the histogram.
+    long long latency_ns = arrival_timestamp - update.timestamp_ns + clock_correction_ns();
+    if (latency_ns < 0) {
+        negative_latencies++;
+        latency_ns = 0;
+    }
+    double latency_ms = latency_ns / 1e6;
+
+    w.kafka_hist->record(latency_ns);
+
+    if (last_values) {
+        last_values->set(symbol_id, update.price, update.timestamp_ns, decode_end);
+        if (!redis_sink && decode_end >= w.next_coalesce_ns) flush_last_values(w, decode_end);
+    } else if (redis_sink) {
+        // Never wait on Redis here: a dropped SET is superseded by the ticker's next price
+        RedisOp op;
+        op.kind = RedisOp::SetPrice;
+        op.symbol_id = symbol_id;
+        op.price = update.price;
+        if (!redis_sink->submit(op)) redis_dropped++;
+    } else {
+        w.redis_args.reset("SET");
+        w.redis_args.add(update.ticker);
+        w.redis_args.add(update.price);
+        std::string_view cmd = w.redis_args.command();
+        redisAppendFormattedCommand(w.redis, cmd.data(), cmd.size());
+        w.redis_pipeline_count++;
+
+        if (w.redis_pipeline_count >= 100) {
+            flush_redis_pipeline(w);
+        }
+    }
+
+    if (w.bars) {
+        w.bars->on_tick(symbol_id, update.price, update.volume, update.timestamp_ns, rkmessage->partition,
+                        rkmessage->offset, w.completed_bars);
+        if (!w.completed_bars.empty()) publish_bars(w);
+        expire_bars(w, arrival_timestamp);
+    }
+
+    if (!w.store_ticks) return false;
+
+    MessageBatch row;
+    row.symbol_id = symbol_id;
+    row.price = update.price;
+    row.volume = static_cast<int>(update.volume);
+    row.timestamp_ns = update.timestamp_ns;
+    row.latency_ms = latency_ms;
+    row.enqueue_ns = decode_end;
+    row.partition = rkmessage->partition;
+    row.seq = seq;
+    row.offset = rkmessage->offset;
+    row.last_in_record = last;
+
+    queue_row(row);
+    return true;
+}
+
+// --commit manual: stands in for a record that queued no row (decode error,
+// unknown symbol, --store-ticks off) so the writer still commits past it.
+void queue_offset_marker(const rd_kafka_message_t *rkmessage) {
+    MessageBatch marker = {};
+    marker.symbol_id = SymbolTable::INVALID;
+    marker.enqueue_ns = monotonic_ns();
+    marker.partition = rkmessage->partition;
+    marker.offset = rkmessage->offset;
+    marker.last_in_record = true;
+    queue_row(marker);
+}
+
+// Decodes one record and handles its ticks. True when the record's last
+// tick queued a DB row, which then carries the record's offset.
+bool process_payload(ConsumerWorker& w, const rd_kafka_message_t *rkmessage, long long arrival_timestamp) {
+    // DESERIALIZATION: straight from the Kafka payload, the ticker stays a view into it
+    long long decode_start = monotonic_ns();
+    bool packed_payload = w.format == PayloadFormat::Packed ||
+                          (w.format == PayloadFormat::Auto && packed::is_packed(rkmessage->payload, rkmessage->len));
+    if (!packed_payload && is_market_update_batch(rkmessage->payload, rkmessage->len)) {
+        if (!decode_batch(w, rkmessage->payload, rkmessage->len)) return false;
+        long long decode_end = monotonic_ns();
+        w.decode_hist->record(decode_end - decode_start);
+        batch_records++;
+        bool covered = false;
+        for (size_t i = 0; i < w.batch_views.size(); i++) {
+            const MarketUpdateView& update = w.batch_views[i];
+            uint32_t symbol_id = symbols->intern(update.ticker);
+            bool last = i + 1 == w.batch_views.size();
+            if (symbol_id == SymbolTable::INVALID) {
+                symbol_overflows++;
+                continue;
+            }
+            bool queued = handle_update(w, update, symbol_id, arrival_timestamp, decode_end,
+                                        rkmessage, static_cast<int32_t>(i), last);
+            if (last) covered = queued;
+        }
+        return covered;
+    }
+
+    uint32_t symbol_id;
+    if (!decode_update(w, rkmessage->payload, rkmessage->len, symbol_id)) return false;
+    long long decode_end = monotonic_ns();
+    w.decode_hist->record(decode_end - decode_start);
+    return handle_update(w, w.view, symbol_id, arrival_timestamp, decode_end, rkmessage, 0, true);
+}
+
+void process_message(ConsumerWorker& w, rd_kafka_message_t *rkmessage, long long arrival_timestamp) {
+    if (rkmessage->err) {
+        if (rkmessage->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+            std::cerr << "Consumer error: " << rd_kafka_message_errstr(rkmessage) << std::endl;
+            consumer_errors++;
+        }
+        return;
+    }
+
+    w.msg_count++;
+
+    bool covered = process_payload(w, rkmessage, arrival_timestamp);
+    if (!covered && commit_mode == CommitMode::Manual) queue_offset_marker(rkmessage);
+}
+
+// Handles `first`, just returned by a blocking poll of `queue`, together with
+// whatever else the queue already holds, up to --poll-batch messages. Never
+// waits for more, so batching adds no latency; all of them share one arrival
+// timestamp.
+void process_burst(ConsumerWorker& w, rd_kafka_queue_t *queue, rd_kafka_message_t *first) {
+    ssize_t more = 0;
+    if (!w.burst.empty()) {
+        more = rd_kafka_consume_batch_queue(queue, 0, w.burst.data(), w.burst.size());
+        if (more < 0) more = 0;
+    }
+    long long arrival_timestamp = current_timestamp_ns();
+    process_message(w, first, arrival_timestamp);
+    rd_kafka_message_destroy(first);
+    for (ssize_t i = 0; i < more; i++) {
+        process_message(w, w.burst[i], arrival_timestamp);
+        rd_kafka_message_destroy(w.burst[i]);
+    }
+}
+
+// Runs when the poll loop goes idle and once more on shutdown.
+void worker_idle(ConsumerWorker& w) {
+    expire_bars(w, current_timestamp_ns());
+    if (last_values && !redis_sink) flush_last_values(w, monotonic_ns());
+    if (w.redis_pipeline_count > 0) flush_redis_pipeline(w);
+}
+
+void worker_shutdown(ConsumerWorker& w) {
+    if (w.bars) {
+        w.bars->flush_all(w.completed_bars);
+        if (!w.completed_bars.empty()) publish_bars(w);
+    }
+    if (last_values && !redis_sink) flush_last_values(w, monotonic_ns());
+    if (w.redis_pipeline_count > 0) flush_redis_pipeline(w);
+}
+
+// A poll that came back empty. A blocking poll is only empty after its 100 ms
+// timeout, so each one runs the idle work. A busy-poll spin runs it once when
+// the queue drains, which flushes Redis without waiting out a timeout, and
+// then every 100 ms while it stays empty.
+void worker_empty_poll(ConsumerWorker& w) {
+    if (!w.busy_poll) {
+        worker_idle(w);
+        return;
+    }
+    cpu_relax();
+    if (w.drained && monotonic_ns() < w.next_idle_ns) return;
+    worker_idle(w);
+    w.drained = true;
+    w.next_idle_ns = monotonic_ns() + 100000000LL;
+}
+
+// Sharded mode: worker thread that only sees the partitions forwarded to its
+// queue, so every ticker (keyed to one partition) is handled by one thread in order.
+void consumer_worker(ConsumerWorker *w) {
+    const int timeout_ms = w->busy_poll ? 0 : 100;
+    while (run) {
+        rd_kafka_message_t *rkmessage = rd_kafka_consume_queue(w->queue, timeout_ms);
+        if (!rkmessage) {
+            // Flush any pending Redis commands during idle time
+            worker_empty_poll(*w);
+            continue;
+        }
+        process_burst(*w, w->queue, rkmessage);
+        w->drained = false;
+    }
+    worker_shutdown(*w);
+}
+
+struct PartitionRouter {
+    std::vector<rd_kafka_queue_t*> worker_queues;
+};
+
+// Routes each assigned partition's fetch queue to worker (partition % N). The
+// forwarding is set up before rd_kafka_assign() so no message of an assigned
+// partition can land on the shared consumer queue.
+static void rebalance_cb(rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                         rd_kafka_topic_partition_list_t *partitions, void *opaque) {
+    PartitionRouter *router = static_cast<PartitionRouter*>(opaque);
+    const size_t num_workers = router->worker_queues.size();
+
+    if (err == RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS) {
+        for (int i = 0; i < partitions->cnt; i++) {
+            const rd_kafka_topic_partition_t& tp = partitions->elems[i];
+            size_t owner = static_cast<size_t>(tp.partition) % num_workers;
+            rd_kafka_queue_t *pq = rd_kafka_queue_get_partition(rk, tp.topic, tp.partition);
+            if (!pq) continue;
+            rd_kafka_queue_forward(pq, router->worker_queues[owner]);
+            rd_kafka_queue_destroy(pq);
+            std::cout << "Partition " << tp.partition << " -> worker " << owner << std::endl;
+        }
+        rd_kafka_assign(rk, partitions);
+    } else {
+        for (int i = 0; i < partitions->cnt; i++) {
+            const rd_kafka_topic_partition_t& tp = partitions->elems[i];
+            rd_kafka_queue_t *pq = rd_kafka_queue_get_partition(rk, tp.topic, tp.partition);
+            if (!pq) continue;
+            rd_kafka_queue_forward(pq, NULL);
+            rd_kafka_queue_destroy(pq);
+        }
+        rd_kafka_assign(rk, NULL);
     }
-    std::cout << "Batch writer: Total written to DB: " << total_written << std::endl;
+}
+
+
+// Results of the writer's asynchronous commits, served from rd_kafka_consumer_poll.
+static void offset_commit_cb(rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                             rd_kafka_topic_partition_list_t *offsets, void *opaque) {
+    if (err == RD_KAFKA_RESP_ERR_NO_ERROR || err == RD_KAFKA_RESP_ERR__NO_OFFSET) return;
+    std::cerr << "Offset commit failed: " << rd_kafka_err2str(err) << std::endl;
+    kafka_commit_errors++;
+}
+
+static int kafka_stats_cb(rd_kafka_t *rk, char *json, size_t json_len, void *opaque) {
+    kafka_stats.store(json, json_len);
+    return 0;  // librdkafka frees the JSON buffer
+}
+
+std::string render_metrics() {
+    MetricsWriter m;
+    HistogramSnapshot kafka = latency_registry.snapshot("kafka");
+
+    m.counter("aggregator_messages_total", "Ticks decoded", kafka.count);
+    m.counter("aggregator_consumer_errors_total", "Kafka consumer errors", consumer_errors.load());
+    m.counter("aggregator_decode_errors_total", "Messages that failed to decode", decode_errors.load());
+    m.counter("aggregator_symbol_overflows_total", "Ticks dropped because the symbol table is full (--max-symbols) or their ticker is empty",
+              symbol_overflows.load());
+    m.counter("aggregator_unknown_symbol_ids_total", "Packed messages with an ID outside the --symbols dictionary",
+              unknown_symbol_ids.load());
+    m.counter("aggregator_batch_records_total", "Kafka records that carried a MarketUpdateBatch",
+              batch_records.load());
+    m.counter("aggregator_negative_latency_total", "Ticks stamped later than they arrived, after clock correction",
+              negative_latencies.load());
+    clock_sync::write_kernel_clock_metrics(m, "aggregator");
+    if (clock_probe) clock_probe->write_metrics(m);
+    m.gauge("aggregator_symbols", "Interned ticker symbols", symbols->size());
+    m.gauge("aggregator_db_queue_depth", "Rows waiting for the batch writers", db_queue_depth());
+    m.gauge("aggregator_db_queue_capacity", "DB queue slots over all writers", db_queue_capacity());
+    m.counter("aggregator_db_queue_full_stalls_total", "Times a producer waited on a full queue", queue_full_stalls.load());
+    m.counter("aggregator_db_rows_written_total", "Rows committed to TimescaleDB", db_rows_written.load());
+    m.counter("aggregator_db_batches_written_total", "Batches committed to TimescaleDB", db_batches_written.load());
+    m.counter("aggregator_db_write_errors_total", "Failed batch write attempts (each is retried)",
+              db_write_errors.load());
+    m.counter("aggregator_db_rows_dropped_total", "Rows abandoned after TimescaleDB failed during shutdown",
+              db_rows_dropped.load());
+    m.counter("aggregator_db_rows_rejected_total", "Ticks dropped after TimescaleDB rejected them as invalid data",
+              db_rows_rejected.load());
+    m.counter("aggregator_db_bars_rejected_total", "Bars dropped after TimescaleDB rejected them as invalid data",
+              db_bars_rejected.load());
+    m.counter("aggregator_db_rows_shed_total", "Rows not written to TimescaleDB under --overload redis-only",
+              db_rows_shed.load());
+    m.gauge("aggregator_paused_partitions", "Kafka partitions paused because a downstream queue is over budget",
+            partition_throttle.paused());
+    m.counter("aggregator_partition_pauses_total", "Times a partition was paused by flow control",
+              partition_throttle.pauses());
+    if (commit_mode == CommitMode::Manual) {
+        m.counter("aggregator_kafka_commits_total", "Offset commits issued after DB batches",
+                  kafka_commits.load());
+        m.counter("aggregator_kafka_commit_errors_total", "Offset commits that failed", kafka_commit_errors.load());
+    }
+    m.gauge("aggregator_db_last_batch_rows", "Rows in the most recent tick batch", db_last_batch_rows.load());
+    // One series per writer connection
+    auto per_writer = [&m](const char *name, const char *help, const char *type, double (*value)(const DbWriter&)) {
+        m.header(name, help, type);
+        for (const auto& dw : db_writers) m.sample(name, "writer=\"" + std::to_string(dw->id) + "\"", value(*dw));
+    };
+    per_writer("aggregator_db_writer_up", "1 while the writer's connection is healthy", "gauge",
+               [](const DbWriter& dw) { return dw.healthy.load() ? 1.0 : 0.0; });
+    per_writer("aggregator_db_reconnects_total", "Connection resets by the writer", "counter",
+               [](const DbWriter& dw) { return static_cast<double>(dw.reconnects.load()); });
+    per_writer("aggregator_db_writer_queue_depth", "Rows waiting for this writer", "gauge",
+               [](const DbWriter& dw) { return static_cast<double>(dw.rows->size_approx()); });
+    per_writer("aggregator_db_target_batch_rows", "Batch size chosen by the adaptive controller", "gauge",
+               [](const DbWriter& dw) { return static_cast<double>(dw.target_rows.load()); });
+    per_writer("aggregator_db_ingest_rows_per_second", "Row arrival rate seen by the writer", "gauge",
+               [](const DbWriter& dw) { return dw.ingest_rate.load(); });
+    per_writer("aggregator_db_write_overhead_seconds", "Fitted fixed cost of one batch write", "gauge",
+               [](const DbWriter& dw) { return dw.write_overhead_ns.load() / 1e9; });
+    per_writer("aggregator_db_write_cost_per_row_seconds", "Fitted per-row cost of a batch write", "gauge",
+               [](const DbWriter& dw) { return dw.write_cost_ns.load() / 1e9; });
+    if (!db_spools.empty()) {
+        auto per_spool = [&m](const char *name, const char *help, const char *type, double (*value)(const DbSpool&)) {
+            m.header(name, help, type);
+            for (size_t i = 0; i < db_spools.size(); i++) {
+                m.sample(name, "writer=\"" + std::to_string(i) + "\"", value(*db_spools[i]));
+            }
+        };
+        per_spool("aggregator_db_spool_bytes", "Spooled bytes not yet replayed into TimescaleDB", "gauge",
+                  [](const DbSpool& s) { return static_cast<double>(s.pending_bytes()); });
+        per_spool("aggregator_db_spooled_rows_total", "Tick and bar rows written to the spool", "counter",
+                  [](const DbSpool& s) { return static_cast<double>(s.spooled_rows()); });
+        per_spool("aggregator_db_spool_replayed_rows_total", "Spooled rows replayed into TimescaleDB", "counter",
+                  [](const DbSpool& s) { return static_cast<double>(s.replayed_rows()); });
+        per_spool("aggregator_db_spool_quarantined_rows_total", "Spooled rows TimescaleDB rejected, moved to quarantine",
+                  "counter", [](const DbSpool& s) { return static_cast<double>(s.quarantined_rows()); });
+    }
+    m.counter("aggregator_redis_commands_total", "Redis commands pipelined", redis_commands_total.load());
+    m.counter("aggregator_redis_flushes_total", "Redis pipeline flushes (commands/flushes = mean pipeline depth)",
+              redis_flushes_total.load());
+    if (redis_sink) {
+        m.counter("aggregator_redis_async_commands_total", "Commands sent on the async Redis connection",
+                  redis_sink->commands_sent());
+        m.counter("aggregator_redis_async_replies_total", "Replies received on the async Redis connection",
+                  redis_sink->replies());
+        m.counter("aggregator_redis_async_errors_total", "Failed or unanswered async Redis commands",
+                  redis_sink->errors());
+        m.counter("aggregator_redis_async_reconnects_total", "Async Redis reconnect attempts", redis_sink->reconnects());
+        m.gauge("aggregator_redis_async_inflight_bytes", "Bytes sent to Redis and not yet acknowledged",
+                redis_sink->inflight_bytes());
+        m.gauge("aggregator_redis_async_queue_depth", "Ops waiting for the Redis sink", redis_sink->queue_depth());
+        m.counter("aggregator_redis_dropped_total", "Price updates dropped because the Redis sink queue was full",
+                  redis_dropped.load());
+    }
+    if (last_values) {
+        m.counter("aggregator_redis_coalesced_flushes_total", "Coalesced MSET rounds that wrote at least one key",
+                  last_values->flushes());
+        m.counter("aggregator_redis_coalesced_keys_total", "Prices written by coalesced flushes (vs messages_total)",
+                  last_values->flushed_keys());
+    }
+    m.counter("aggregator_bars_emitted_total", "Finished OHLCV bars", bars_emitted.load());
+
+    m.header("aggregator_stage_latency_seconds", "Per-stage latency", "summary");
+    for (const auto& stage : latency_registry.stages()) {
+        HistogramSnapshot h = latency_registry.snapshot(stage);
+        m.latency_samples("aggregator_stage_latency_seconds", h, "stage=\"" + stage + "\"");
+    }
+
+    std::string stats = kafka_stats.load();
+    if (!stats.empty()) {
+        m.gauge("aggregator_kafka_replyq", "librdkafka ops waiting in the reply queue", kafka_stat(stats, "replyq"));
+        m.counter("aggregator_kafka_rx_messages_total", "Messages received from brokers", kafka_stat(stats, "rxmsgs"));
+        m.counter("aggregator_kafka_rx_bytes_total", "Bytes received from brokers", kafka_stat(stats, "rxmsg_bytes"));
+        m.gauge("aggregator_kafka_consumer_lag", "Sum of consumer lag over assigned partitions",
+                kafka_stat_sum(stats, "consumer_lag"));
+    }
+    return m.str();
 }
 
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <kafka_broker> <redis_host>" << std::endl;
-        std::cerr << "Example: " << argv[0] << " localhost:9092 localhost" << std::endl;
+    AggregatorOptions opts;
+    if (!parse_aggregator_options(argc, argv, opts)) {
+        print_aggregator_usage(argv[0]);
         return 1;
     }
 
-    std::string brokers = argv[1];
-    std::string redis_host = argv[2];
+    commit_mode = opts.commit;
+    db_sink = opts.db_sink;
+    db_schema = opts.db_schema;
+    db_idempotent = opts.db_idempotent;
+    overload = opts.overload;
+    pause_high_pct = opts.pause_high_pct;
+    pause_low_pct = opts.pause_low_pct;
+
+    symbols.reset(new SymbolTable(opts.max_symbols));
+    if (!opts.symbols_source.empty()) {
+        if (!load_symbols(opts.symbols_source, *symbols)) return 1;
+        std::cout << "Loaded " << symbols->size() << " symbols from " << opts.symbols_source << std::endl;
+    }
+    dictionary_size = symbols->size();
+    if (opts.format != PayloadFormat::Protobuf && dictionary_size == 0) {
+        std::cout << "No --symbols dictionary: packed payloads will be rejected" << std::endl;
+    }
+
+    std::string brokers = opts.brokers;
+    std::string redis_host = opts.redis_host;
     std::string timescale_host = redis_host;
     std::string topic = "market-updates";
     std::string group_id = "aggregator_group";
 
     char errstr[512];
 
-    // --- 1. SETUP REDIS CONNECTION ---
+    // --- 1. SETUP REDIS CONNECTIONS (one per worker) ---
+
+    const int num_workers = opts.workers;
+    std::vector<ConsumerWorker> workers(num_workers);
+    const ThreadPlacement& placement = opts.placement;
+    placement.log();
+    if (opts.busy_poll && !placement.has("consumer")) {
+        std::cout << "Warning: --busy-poll without --cpus consumer=...: spinning threads can migrate" << std::endl;
+    }
 
     std::cout << "Connecting to Redis at " << redis_host << ":6379..." << std::endl;
-    redisContext *redis = redisConnect(redis_host.c_str(), 6379);
-    if (redis == NULL || redis->err) {
-        if (redis) std::cerr << "Redis Error: " << redis->errstr << std::endl;
-        else std::cerr << "Can't allocate Redis context" << std::endl;
+    const bool redis_sync = opts.redis_mode == RedisMode::Sync;
+    if (opts.redis_coalesce_us > 0) {
+        // Written by every consumer; placed with the first
+        placement.near("consumer", 0, [&] { last_values.reset(new LastValueTable(opts.max_symbols)); });
+        redis_coalesce_ns = opts.redis_coalesce_us * 1000;
+        price_outputs.price_hash = opts.price_hash;
+        price_outputs.publish = opts.publish;
+        price_outputs.publish_prefix = opts.publish_prefix;
+        price_outputs.stream_maxlen = opts.stream_maxlen;
+    } else if (opts.publish != PublishMode::Off) {
+        std::cerr << "--publish needs coalescing (--redis-coalesce-us > 0)" << std::endl;
         return 1;
     }
+    if (commit_mode == CommitMode::Manual && db_schema == DbSchema::Rows && !opts.bar_intervals.empty()) {
+        bar_floors.reset(new BarFloors);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].id = i;
+        workers[i].kafka_hist = latency_registry.create("kafka");
+        workers[i].decode_hist = latency_registry.create("decode");
+        workers[i].redis_flush_hist = latency_registry.create("redis_flush");
+        if (last_values && redis_sync) workers[i].redis_staleness_hist = latency_registry.create("redis_staleness");
+        workers[i].store_ticks = opts.store_ticks;
+        workers[i].decoder = opts.decoder;
+        workers[i].format = opts.format;
+        workers[i].busy_poll = opts.busy_poll;
+        placement.near("consumer", i, [&] {
+            workers[i].burst.resize(opts.poll_batch - 1);
+            if (!opts.bar_intervals.empty()) {
+                workers[i].bars.reset(new BarEngine(opts.bar_intervals, bar_floors.get()));
+            }
+        });
+        if (!redis_sync) continue;
+        workers[i].redis = connect_to_redis(redis_host);
+        if (!workers[i].redis) {
+            for (int j = 0; j < i; j++) redisFree(workers[j].redis);
+            return 1;
+        }
+    }
 
-    // TEST REDIS CONNECTION
-    redisReply *ping_reply = (redisReply *)redisCommand(redis, "PING");
+    // TEST REDIS CONNECTION (async mode probes with a short-lived sync connection)
+    redisContext *probe = redis_sync ? workers[0].redis : connect_to_redis(redis_host);
+    if (!probe) return 1;
+    redisReply *ping_reply = (redisReply *)redisCommand(probe, "PING");
     if (ping_reply) {
         std::cout << "Redis PING: " << ping_reply->str << std::endl;
         freeReplyObject(ping_reply);
     }
-
-    PGconn *timescale = connect_to_timescale(timescale_host);
-    if (!timescale) {
-        redisFree(redis);
-        return 1;
+    if (!redis_sync) redisFree(probe);
+
+    if (!redis_sync) {
+        placement.near("redis", 0, [&] {
+            redis_sink.reset(new RedisAsyncSink(redis_host, 6379, *symbols, opts.redis_queue_capacity,
+                                                opts.redis_max_inflight_bytes));
+        });
+        if (last_values) {
+            redis_sink->set_coalescing(last_values.get(), opts.redis_coalesce_us, price_outputs,
+                                       latency_registry.create("redis_staleness"));
+        }
+        if (!redis_sink->start()) return 1;
+        placement.pin(redis_sink->native_handle(), "redis", 0);
     }
 
-    std::thread writer_thread(batch_writer, timescale);
-
-    std::cout << "Connected to Redis successfully." << std::endl;
+    // Every writer needs its connection before any row can be routed to it
+    const size_t writer_capacity = std::max<size_t>(opts.queue_capacity / opts.db_writers, 1024);
+    for (int i = 0; i < opts.db_writers; i++) {
+        std::unique_ptr<DbWriter> dw(new DbWriter);
+        dw->id = i;
+        dw->conn = connect_to_timescale(timescale_host);
+        bool ready = dw->conn && (i > 0 || setup_schema(dw->conn, opts)) && prepare_db_session(*dw);
+        if (!ready) {
+            if (dw->conn) PQfinish(dw->conn);
+            for (auto& other : db_writers) PQfinish(other->conn);
+            for (auto& w : workers) if (w.redis) redisFree(w.redis);
+            return 1;
+        }
+        // The writer drains its queues; they live on its node
+        placement.near("db", i, [&] {
+            dw->rows.reset(new BoundedRingBuffer<MessageBatch>(writer_capacity));
+            dw->bars.reset(new BoundedRingBuffer<CompletedBar>(1 << 14));
+        });
+        db_writers.push_back(std::move(dw));
+    }
+    std::cout << "Connected to TimescaleDB with " << opts.db_writers << " writer connection(s)." << std::endl;
+
+    // Compact schema: symbol IDs come from the database, on a connection of their own
+    if (db_schema == DbSchema::Compact) {
+        PGconn *ids_conn = connect_to_timescale(timescale_host);
+        if (ids_conn) db_symbol_ids.reset(new DbSymbolIds(ids_conn, *symbols));
+        if (!db_symbol_ids || !db_symbol_ids->preload()) {
+            for (auto& dw : db_writers) PQfinish(dw->conn);
+            for (auto& w : workers) if (w.redis) redisFree(w.redis);
+            return 1;
+        }
+    }
 
     // --- 2. SETUP KAFKA CONSUMER ---
+    // The configuration is built and checked before the writer and replayer
+    // threads start, so a bad setting can still return without joining them
     rd_kafka_conf_t *conf = rd_kafka_conf_new();
 
     // Set consumer group (Kafka tracks progress for this group)
@@ -246,18 +2064,117 @@ int main(int argc, char **argv) {
     // Set the bootstrap broker
     rd_kafka_conf_set(conf, "bootstrap.servers", brokers.c_str(), errstr, sizeof(errstr));
 
-    rd_kafka_conf_set(conf, "enable.auto.commit", "true", errstr, sizeof(errstr));
+    // Manual mode: batch_writer commits once the rows covering an offset are in TimescaleDB
+    rd_kafka_conf_set(conf, "enable.auto.commit", commit_mode == CommitMode::Auto ? "true" : "false",
+                      errstr, sizeof(errstr));
+    rd_kafka_conf_set_offset_commit_cb(conf, offset_commit_cb);
+
+    // Byte budget of the decode stage: what librdkafka may prefetch ahead of the workers
+    if (opts.fetch_buffer_kb > 0) {
+        std::string kbytes = std::to_string(opts.fetch_buffer_kb);
+        if (rd_kafka_conf_set(conf, "queued.max.messages.kbytes", kbytes.c_str(), errstr, sizeof(errstr)) !=
+            RD_KAFKA_CONF_OK) {
+            std::cerr << "Invalid --fetch-buffer-kb: " << errstr << std::endl;
+            rd_kafka_conf_destroy(conf);
+            for (auto& dw : db_writers) PQfinish(dw->conn);
+            for (auto& w : workers) if (w.redis) redisFree(w.redis);
+            return 1;
+        }
+    }
+
+    if (opts.metrics_port > 0) {
+        rd_kafka_conf_set(conf, "statistics.interval.ms", "5000", errstr, sizeof(errstr));
+        rd_kafka_conf_set_stats_cb(conf, kafka_stats_cb);
+    }
+
+    // Sharded mode: each worker gets its own queue that assigned partitions are forwarded to
+    PartitionRouter router;
+    if (num_workers > 1) {
+        rd_kafka_conf_set_opaque(conf, &router);
+        rd_kafka_conf_set_rebalance_cb(conf, rebalance_cb);
+    }
+
+    // --kafka-config goes last so it can override any built-in setting
+    if (!apply_kafka_properties(conf, opts.kafka_config)) {
+        rd_kafka_conf_destroy(conf);
+        for (auto& dw : db_writers) PQfinish(dw->conn);
+        for (auto& w : workers) if (w.redis) redisFree(w.redis);
+        return 1;
+    }
+
+    // Spools: writer-<i> for every writer, plus any left by a run with more
+    // writers, each drained by a replayer of its own
+    std::vector<std::thread> replayers;
+    if (!opts.db_spool_dir.empty()) {
+        spool_sync_ns = opts.db_spool_sync_ms * 1000000LL;
+        const uint32_t layout = (db_schema == DbSchema::Compact ? 1 : 0) | (db_idempotent ? 2 : 0);
+        int spools = opts.db_writers;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(opts.db_spool_dir, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind("writer-", 0) == 0) spools = std::max(spools, std::atoi(name.c_str() + 7) + 1);
+        }
+        for (int i = 0; i < spools; i++) {
+            std::unique_ptr<DbSpool> spool(new DbSpool(opts.db_spool_dir + "/writer-" + std::to_string(i),
+                                                       opts.db_spool_segment_mb << 20, layout));
+            if (!spool->open()) {
+                rd_kafka_conf_destroy(conf);
+                for (auto& dw : db_writers) PQfinish(dw->conn);
+                for (auto& w : workers) if (w.redis) redisFree(w.redis);
+                return 1;
+            }
+            if (i < opts.db_writers) db_writers[i]->spool = spool.get();
+            db_spools.push_back(std::move(spool));
+        }
+        for (auto& spool : db_spools) {
+            replayers.emplace_back(spool_replayer, spool.get(), timescale_host);
+            placement.pin(replayers.back().native_handle(), "db", opts.db_writers + replayers.size() - 1);
+        }
+        std::cout << "Spooling DB outages to " << opts.db_spool_dir << std::endl;
+    }
 
+    writers_running = opts.db_writers;
+    for (auto& dw : db_writers) {
+        BatchController controller(opts.db_target_latency_ms * 1e6, opts.db_max_batch);
+        if (opts.db_sink == DbSinkMode::Pipeline) {
+            dw->thread = std::thread(pipelined_batch_writer, dw.get(), topic, controller, opts.db_pipeline_depth);
+        } else {
+            dw->thread = std::thread(batch_writer, dw.get(), opts.db_sink, topic, controller);
+        }
+        placement.pin(dw->thread.native_handle(), "db", dw->id);
+    }
+
+    std::cout << "Connected to Redis successfully." << std::endl;
+
+    // Failures past this point must stop the DB threads before returning
+    auto stop_db_threads = [&] {
+        writer_stop = true;
+        for (auto& dw : db_writers) dw->wakeup.notify_now();
+        for (auto& dw : db_writers) {
+            if (dw->thread.joinable()) dw->thread.join();
+        }
+        replayers_stop = true;
+        for (auto& t : replayers) t.join();
+    };
 
     rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_CONSUMER, conf, errstr, sizeof(errstr));
     if (!rk) {
         std::cerr << "Failed to create consumer: " << errstr << std::endl;
+        stop_db_threads();
         return 1;
     }
+    kafka_consumer = rk;
 
     // Redirect logs/errors to standard output
     rd_kafka_poll_set_consumer(rk);
 
+    if (num_workers > 1) {
+        for (auto& w : workers) {
+            w.queue = rd_kafka_queue_new(rk);
+            router.worker_queues.push_back(w.queue);
+        }
+    }
+
     // Subscribe to the topic
     rd_kafka_topic_partition_list_t *topics = rd_kafka_topic_partition_list_new(1);
     rd_kafka_topic_partition_list_add(topics, topic.c_str(), RD_KAFKA_PARTITION_UA);
@@ -265,6 +2182,8 @@ int main(int argc, char **argv) {
         if (err) {
             std::cerr << "Failed to subscribe to topic: " << rd_kafka_err2str(err) << std::endl;
             rd_kafka_topic_partition_list_destroy(topics);
+            stop_db_threads();
+            rd_kafka_destroy(rk);
             return 1;
         }
     rd_kafka_topic_partition_list_destroy(topics);
@@ -273,104 +2192,110 @@ int main(int argc, char **argv) {
 
     std::cout << "Aggregator started with batching." << std::endl;
 
+    if (opts.clock_sync) {
+        clock_probe.reset(new ClockProbe(brokers));
+        if (!clock_probe->start()) clock_probe.reset();
+    }
+
     // Start stats reporter
     std::thread stats_thread(stats_reporter);
+    placement.pin(stats_thread.native_handle(), "other", 0);
+
+    // Prometheus exporter
+    HttpServer metrics_server(opts.metrics_port, [](const std::string& path, std::string& body, std::string&) {
+        if (path != "/metrics") return false;
+        body = render_metrics();
+        return true;
+    });
+    if (opts.metrics_port > 0 && metrics_server.start()) {
+        std::cout << "Metrics on http://0.0.0.0:" << opts.metrics_port << "/metrics" << std::endl;
+        placement.pin(metrics_server.native_handle(), "other", 0);
+    }
 
     // --- 3. MAIN PROCESSING LOOP ---
 
-    long long msg_count = 0;
-    int redis_pipeline_count = 0;
-    while (run) {
-
-        rd_kafka_message_t *rkmessage = rd_kafka_consumer_poll(rk, 100);
+    const bool flow_controlled = overload == OverloadPolicy::Block;
+    const int poll_timeout_ms = flow_controlled ? 10 : 100;  // a paused partition resumes within ~10 ms
+    long long next_flow_check_ns = 0;
 
-        if (!rkmessage) {
-            // Flush any pending Redis commands during idle time
-            if (redis_pipeline_count > 0) {
-                for (int i = 0; i < redis_pipeline_count; i++) {
-                    redisReply *reply;
-                    if (redisGetReply(redis, (void**)&reply) == REDIS_OK) {
-                        freeReplyObject(reply);
-                    }
-                }
-                redis_pipeline_count = 0;
-            }
-            continue;
+    std::vector<std::thread> worker_threads;
+    if (num_workers > 1) {
+        std::cout << "Starting " << num_workers << " partition-affine consumer workers..." << std::endl;
+        for (auto& w : workers) {
+            worker_threads.emplace_back(consumer_worker, &w);
+            placement.pin(worker_threads.back().native_handle(), "consumer", w.id);
         }
 
-        if (rkmessage->err) {
-            if (rkmessage->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
-                std::cerr << "Consumer error: " << rd_kafka_message_errstr(rkmessage) << std::endl;
+        // The main thread only serves rebalance callbacks and consumer errors
+        while (run) {
+            rd_kafka_message_t *rkmessage = rd_kafka_consumer_poll(rk, poll_timeout_ms);
+            if (flow_controlled) flow_control(rk, next_flow_check_ns);
+            if (!rkmessage) continue;
+            if (rkmessage->err) {
+                if (rkmessage->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+                    std::cerr << "Consumer error: " << rd_kafka_message_errstr(rkmessage) << std::endl;
+                    consumer_errors++;
+                }
+            } else {
+                std::cerr << "Unexpected message on shared consumer queue (partition "
+                          << rkmessage->partition << ")" << std::endl;
             }
             rd_kafka_message_destroy(rkmessage);
-            continue;
         }
 
-        msg_count++;
-
-        long long arrival_timestamp = current_timestamp_ns();
-
-        // DESERIALIZATION: Protobuf magic
-        marketdata::MarketUpdate update;
-        if (update.ParseFromArray(rkmessage->payload, rkmessage->len)) {
-
-            // Calculate end-to-end latency
-            long long latency_ns = arrival_timestamp - update.timestamp_ns();
-            if (latency_ns < 0) latency_ns = 0;
-            double latency_ms = latency_ns / 1e6;
-
-            update_latency_stats(latency_ns);
-
-            redisAppendCommand(redis, "SET %s %f", update.ticker().c_str(), update.price());
-            redis_pipeline_count++;
-
-            if (redis_pipeline_count >= 100) {
-                for (int i = 0; i < redis_pipeline_count; i++) {
-                    redisReply *reply;
-                    if (redisGetReply(redis, (void**)&reply) == REDIS_OK) {
-                        freeReplyObject(reply);
-                    }
-                }
-                redis_pipeline_count = 0;
-            }
-
-            {
-                std::lock_guard<std::mutex> lock(queue_mutex);
-                batch_queue.push({
-                    update.ticker(),
-                    update.price(),
-                    update.volume(),
-                    update.timestamp_ns(),
-                    latency_ms
-                });
+        for (auto& t : worker_threads) {
+            if (t.joinable()) t.join();
+        }
+    } else {
+        ConsumerWorker& w = workers[0];
+        w.queue = rd_kafka_queue_get_consumer(rk);  // for --poll-batch; released with the workers
+        // Pinned only now: threads started earlier would have inherited the mask
+        placement.pin(pthread_self(), "consumer", 0);
+        const int timeout_ms = opts.busy_poll ? 0 : poll_timeout_ms;
+        while (run) {
+            rd_kafka_message_t *rkmessage = rd_kafka_consumer_poll(rk, timeout_ms);
+            if (flow_controlled) flow_control(rk, next_flow_check_ns);
+
+            if (!rkmessage) {
+                // Flush any pending Redis commands during idle time
+                worker_empty_poll(w);
+                continue;
             }
 
-
+            process_burst(w, w.queue, rkmessage);
+            w.drained = false;
         }
 
-        rd_kafka_message_destroy(rkmessage);
+        worker_shutdown(w);
     }
 
-    if (redis_pipeline_count > 0) {
-        for (int i = 0; i < redis_pipeline_count; i++) {
-            redisReply *reply;
-            if (redisGetReply(redis, (void**)&reply) == REDIS_OK) {
-                freeReplyObject(reply);
-            }
-        }
-    }
+    long long msg_count = 0;
+    for (const auto& w : workers) msg_count += w.msg_count;
 
     // --- 4. CLEANUP ---
     std::cout << "\nShutting down aggregator..." << std::endl;
     std::cout << "Total messages consumed: " << msg_count << std::endl;
 
-    if (writer_thread.joinable()) writer_thread.join();
+    // Writers drain their queues and make the final offset commits before the consumer closes
+    writer_stop = true;
+    for (auto& dw : db_writers) dw->wakeup.notify_now();
+    if (redis_sink) redis_sink->stop();
+    for (auto& dw : db_writers) {
+        if (dw->thread.joinable()) dw->thread.join();
+    }
+    replayers_stop = true;
+    for (auto& t : replayers) t.join();
+    if (clock_probe) clock_probe->stop();
     if (stats_thread.joinable()) stats_thread.join();
+    metrics_server.stop();
 
     rd_kafka_consumer_close(rk);
+    for (auto& w : workers) {
+        if (w.queue) rd_kafka_queue_destroy(w.queue);
+        if (w.redis) redisFree(w.redis);
+    }
     rd_kafka_destroy(rk);
-    redisFree(redis);
-    PQfinish(timescale);
+    for (auto& dw : db_writers) PQfinish(dw->conn);
 
     return 0;
 }
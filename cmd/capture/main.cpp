@@ -0,0 +1,193 @@
+// Records market-updates (or converts a market_updates CSV export) into the
+// capture file format of common/tick_capture.hpp, for producer --replay.
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <librdkafka/rdkafka.h>
+#include "capture/options.hpp"
+#include "common/packed_format.hpp"
+#include "common/symbol_loader.hpp"
+#include "common/symbol_table.hpp"
+#include "common/tick_capture.hpp"
+#include "common/wire_format.hpp"
+
+static volatile sig_atomic_t run = 1;
+
+void stop(int sig) {
+    run = 0;
+}
+
+long long monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+struct CaptureStats {
+    long long records = 0;
+    long long decode_errors = 0;
+    long long unknown_symbol_ids = 0;  // packed IDs beyond the --symbols dictionary
+    long long skipped = 0;             // tickers too long for a capture name
+};
+
+// Adds every tick of one Kafka payload; the format is detected per record as
+// the aggregator's --format auto does.
+void capture_record(const rd_kafka_message_t *msg, const SymbolTable& dictionary, TickCaptureWriter& out,
+                    std::vector<MarketUpdateView>& views, MarketUpdateBatchScratch& scratch, CaptureStats& stats) {
+    stats.records++;
+    if (packed::is_packed(msg->payload, msg->len)) {
+        packed::Update p;
+        if (!packed::decode(msg->payload, msg->len, p)) {
+            stats.decode_errors++;
+        } else if (p.symbol_id >= dictionary.size()) {
+            stats.unknown_symbol_ids++;
+        } else if (!out.add(dictionary.name(p.symbol_id), p.price, static_cast<int32_t>(p.volume), p.timestamp_ns)) {
+            stats.skipped++;
+        }
+        return;
+    }
+
+    views.clear();
+    if (is_market_update_batch(msg->payload, msg->len)) {
+        if (!decode_market_update_batch(msg->payload, msg->len, views, scratch)) {
+            stats.decode_errors++;
+            return;
+        }
+    } else {
+        MarketUpdateView view;
+        if (!decode_market_update(msg->payload, msg->len, view)) {
+            stats.decode_errors++;
+            return;
+        }
+        views.push_back(view);
+    }
+    for (const MarketUpdateView& v : views) {
+        if (!out.add(v.ticker, v.price, v.volume, v.timestamp_ns)) stats.skipped++;
+    }
+}
+
+// Consumes until a limit, Ctrl-C, or (--from earliest) every assigned
+// partition has reported its end.
+bool capture_kafka(const CaptureOptions& opts, const SymbolTable& dictionary, TickCaptureWriter& out) {
+    char errstr[512];
+    const std::string topic = "market-updates";
+    const std::string group_id = opts.group_id.empty() ? "tick_capture-" + std::to_string(getpid()) : opts.group_id;
+
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    rd_kafka_conf_set(conf, "group.id", group_id.c_str(), errstr, sizeof(errstr));
+    rd_kafka_conf_set(conf, "auto.offset.reset", opts.from_earliest ? "earliest" : "latest", errstr, sizeof(errstr));
+    rd_kafka_conf_set(conf, "bootstrap.servers", opts.brokers.c_str(), errstr, sizeof(errstr));
+    rd_kafka_conf_set(conf, "enable.auto.commit", "false", errstr, sizeof(errstr));
+    rd_kafka_conf_set(conf, "enable.partition.eof", "true", errstr, sizeof(errstr));
+
+    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_CONSUMER, conf, errstr, sizeof(errstr));
+    if (!rk) {
+        std::cerr << "Failed to create consumer: " << errstr << std::endl;
+        return false;
+    }
+    rd_kafka_poll_set_consumer(rk);
+
+    rd_kafka_topic_partition_list_t *topics = rd_kafka_topic_partition_list_new(1);
+    rd_kafka_topic_partition_list_add(topics, topic.c_str(), RD_KAFKA_PARTITION_UA);
+    rd_kafka_resp_err_t err = rd_kafka_subscribe(rk, topics);
+    rd_kafka_topic_partition_list_destroy(topics);
+    if (err) {
+        std::cerr << "Failed to subscribe to topic: " << rd_kafka_err2str(err) << std::endl;
+        rd_kafka_destroy(rk);
+        return false;
+    }
+    std::cout << "Capturing " << topic << " from the " << (opts.from_earliest ? "earliest" : "latest")
+              << " offset as group " << group_id << std::endl;
+
+    CaptureStats stats;
+    std::vector<MarketUpdateView> views;
+    MarketUpdateBatchScratch scratch;
+    std::set<int32_t> at_end;  // partitions whose last poll was an EOF
+    const long long start_ns = monotonic_ns();
+    long long next_report_ns = start_ns + 5000000000LL;
+
+    while (run) {
+        long long now = monotonic_ns();
+        if (opts.duration_s > 0 && now - start_ns >= static_cast<long long>(opts.duration_s * 1e9)) break;
+        if (opts.max_ticks > 0 && static_cast<long long>(out.size()) >= opts.max_ticks) break;
+        if (now >= next_report_ns) {
+            std::cout << "Captured " << out.size() << " ticks from " << stats.records << " records" << std::endl;
+            next_report_ns = now + 5000000000LL;
+        }
+
+        rd_kafka_message_t *msg = rd_kafka_consumer_poll(rk, 100);
+        if (!msg) continue;
+        if (msg->err == RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+            at_end.insert(msg->partition);
+            rd_kafka_message_destroy(msg);
+            if (!opts.from_earliest) continue;
+            rd_kafka_topic_partition_list_t *assigned = NULL;
+            if (rd_kafka_assignment(rk, &assigned) == RD_KAFKA_RESP_ERR_NO_ERROR) {
+                bool all = assigned->cnt > 0;
+                for (int i = 0; i < assigned->cnt && all; i++) all = at_end.count(assigned->elems[i].partition) > 0;
+                rd_kafka_topic_partition_list_destroy(assigned);
+                if (all) break;
+            }
+            continue;
+        }
+        if (msg->err) {
+            std::cerr << "Consumer error: " << rd_kafka_message_errstr(msg) << std::endl;
+            rd_kafka_message_destroy(msg);
+            continue;
+        }
+        at_end.erase(msg->partition);
+        capture_record(msg, dictionary, out, views, scratch, stats);
+        rd_kafka_message_destroy(msg);
+    }
+
+    rd_kafka_consumer_close(rk);
+    rd_kafka_destroy(rk);
+    std::cout << "Consumed " << stats.records << " records: " << out.size() << " ticks, " << stats.decode_errors
+              << " decode errors, " << stats.unknown_symbol_ids << " unknown packed IDs, " << stats.skipped
+              << " skipped tickers" << std::endl;
+    if (stats.unknown_symbol_ids > 0 && dictionary.size() == 0) {
+        std::cerr << "Packed payloads need the producer's --symbols dictionary" << std::endl;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    CaptureOptions opts;
+    if (!parse_capture_options(argc, argv, opts)) {
+        print_capture_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    TickCaptureWriter out;
+    std::string error;
+    if (!opts.csv_path.empty()) {
+        TickCapture csv;
+        if (!csv.open(opts.csv_path, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < csv.size(); i++) {
+            const ReplayTick& t = csv.ticks()[i];
+            out.add(csv.symbols()[t.symbol], t.price, t.volume, t.timestamp_ns);
+        }
+    } else {
+        SymbolTable dictionary;
+        if (!opts.symbols_source.empty() && !load_symbols(opts.symbols_source, dictionary)) return 1;
+        if (!capture_kafka(opts, dictionary, out)) return 1;
+    }
+
+    if (!out.finish(opts.output, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << out.size() << " ticks of " << out.names().size() << " symbols to " << opts.output
+              << std::endl;
+    return 0;
+}
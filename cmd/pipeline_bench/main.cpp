@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "bench/child_process.hpp"
+#include "bench/metrics_client.hpp"
+#include "bench/options.hpp"
+
+static volatile sig_atomic_t run = 1;
+
+static void stop(int) {
+    run = 0;
+}
+
+double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void sleep_s(double s) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(s));
+}
+
+struct Scenario {
+    std::string format;
+    int workers;
+    int poll_batch;
+    int record_batch;
+    double rate;
+};
+
+struct ScenarioResult {
+    std::string error;  // empty when the run completed
+    double produced = NAN;   // ticks accepted by the producer's librdkafka, last scrape
+    double consumed = 0;     // ticks decoded by the aggregator during the run
+    double elapsed_s = 0;    // producer start -> last tick consumed
+    double throughput = 0;
+    double kafka_p50_ms = NAN, kafka_p99_ms = NAN, kafka_p999_ms = NAN;
+    double db_e2e_p50_ms = NAN, db_e2e_p99_ms = NAN;
+    double db_rows = NAN;
+    double full_stalls = NAN;
+    double aggregator_cpu_us_per_msg = NAN;
+    double producer_cpu_us_per_msg = NAN;
+    long long aggregator_max_rss = 0;
+};
+
+// Quantile of aggregator_stage_latency_seconds in milliseconds.
+double stage_ms(const std::string &body, const char *stage, const char *quantile) {
+    std::string series = std::string("aggregator_stage_latency_seconds{stage=\"") + stage +
+                         "\",quantile=\"" + quantile + "\"}";
+    return metric_value(body, series) * 1e3;
+}
+
+ScenarioResult run_scenario(const BenchOptions &opts, const Scenario &sc, const std::string &name,
+                            const std::string &group) {
+    ScenarioResult r;
+
+    // A fresh consumer group starting at the end of the topic sees only this scenario's ticks,
+    // and a fresh process keeps the latency summaries to this scenario
+    std::vector<std::string> agg = {opts.aggregator, opts.brokers, opts.redis_host,
+                                    "--workers", std::to_string(sc.workers),
+                                    "--poll-batch", std::to_string(sc.poll_batch),
+                                    "--metrics-port", std::to_string(opts.aggregator_metrics_port),
+                                    "--kafka-config", "group.id=" + group};
+    if (!opts.symbols.empty()) agg.insert(agg.end(), {"--symbols", opts.symbols});
+    agg.insert(agg.end(), opts.aggregator_args.begin(), opts.aggregator_args.end());
+
+    ChildProcess aggregator;
+    if (!aggregator.start(agg, opts.log_dir + "/" + name + ".aggregator.log")) {
+        r.error = "aggregator did not start";
+        return r;
+    }
+    std::string body;
+    double deadline = now_s() + 30;
+    while (run && aggregator.running() && !scrape_metrics(opts.aggregator_metrics_port, body)) {
+        if (now_s() > deadline) break;
+        sleep_s(0.2);
+    }
+    if (!aggregator.running() || body.empty()) {
+        r.error = "aggregator metrics not reachable";
+        return r;
+    }
+    sleep_s(opts.warmup_s);
+
+    ProcSample agg_start, agg_now, prod_now;
+    scrape_metrics(opts.aggregator_metrics_port, body);
+    double consumed_base = metric_value(body, "aggregator_messages_total");
+    read_proc_sample(aggregator.pid(), agg_start);
+
+    std::vector<std::string> prod = {opts.producer, opts.brokers,
+                                     "--rate", std::to_string(static_cast<long long>(sc.rate)),
+                                     "--duration", std::to_string(opts.duration_s),
+                                     "--threads", std::to_string(opts.producer_threads),
+                                     "--format", sc.format,
+                                     "--updates-per-record", std::to_string(sc.record_batch),
+                                     "--metrics-port", std::to_string(opts.producer_metrics_port)};
+    if (!opts.symbols.empty()) prod.insert(prod.end(), {"--symbols", opts.symbols});
+    prod.insert(prod.end(), opts.producer_args.begin(), opts.producer_args.end());
+
+    ChildProcess producer;
+    double start = now_s();
+    if (!producer.start(prod, opts.log_dir + "/" + name + ".producer.log")) {
+        r.error = "producer did not start";
+        return r;
+    }
+
+    // Sample both processes while the producer runs; its /metrics disappears when it exits
+    double consumed = consumed_base;
+    double last_change = start;
+    double producer_deadline = start + opts.duration_s + 30;
+    while (run && producer.running() && now_s() < producer_deadline) {
+        if (read_proc_sample(aggregator.pid(), agg_now)) r.aggregator_max_rss = std::max(r.aggregator_max_rss, agg_now.rss_bytes);
+        read_proc_sample(producer.pid(), prod_now);
+        std::string pbody;
+        if (scrape_metrics(opts.producer_metrics_port, pbody)) r.produced = metric_value(pbody, "producer_messages_total");
+        if (scrape_metrics(opts.aggregator_metrics_port, body)) {
+            double c = metric_value(body, "aggregator_messages_total");
+            if (c > consumed) {
+                consumed = c;
+                last_change = now_s();
+            }
+        }
+        sleep_s(0.25);
+    }
+    producer.stop(10);
+    if (!producer.exited_cleanly()) {
+        r.error = "producer failed, see its log";
+        return r;
+    }
+
+    // Drain: done once the aggregator has caught up with the producer and stays still,
+    // or after it has been still for 3 s (lost or shed ticks)
+    double drain_deadline = now_s() + 60;
+    while (run && now_s() < drain_deadline && aggregator.running()) {
+        if (scrape_metrics(opts.aggregator_metrics_port, body)) {
+            double c = metric_value(body, "aggregator_messages_total");
+            if (c > consumed) {
+                consumed = c;
+                last_change = now_s();
+            }
+        }
+        double still = now_s() - last_change;
+        bool caught_up = !std::isnan(r.produced) && consumed - consumed_base >= r.produced;
+        if ((caught_up && still >= 1) || still >= 3) break;
+        if (read_proc_sample(aggregator.pid(), agg_now)) r.aggregator_max_rss = std::max(r.aggregator_max_rss, agg_now.rss_bytes);
+        sleep_s(0.25);
+    }
+
+    if (!aggregator.running() || !scrape_metrics(opts.aggregator_metrics_port, body)) {
+        r.error = "aggregator exited during the run";
+        return r;
+    }
+    read_proc_sample(aggregator.pid(), agg_now);
+    aggregator.stop(60);
+
+    r.consumed = consumed - consumed_base;
+    r.elapsed_s = last_change - start;
+    r.throughput = r.elapsed_s > 0 ? r.consumed / r.elapsed_s : 0;
+    r.kafka_p50_ms = stage_ms(body, "kafka", "0.5");
+    r.kafka_p99_ms = stage_ms(body, "kafka", "0.99");
+    r.kafka_p999_ms = stage_ms(body, "kafka", "0.999");
+    r.db_e2e_p50_ms = stage_ms(body, "db_e2e", "0.5");
+    r.db_e2e_p99_ms = stage_ms(body, "db_e2e", "0.99");
+    r.db_rows = metric_value(body, "aggregator_db_rows_written_total");
+    r.full_stalls = metric_value(body, "aggregator_db_queue_full_stalls_total");
+    if (r.consumed > 0) {
+        r.aggregator_cpu_us_per_msg = (agg_now.cpu_s - agg_start.cpu_s) / r.consumed * 1e6;
+        if (!std::isnan(r.produced) && r.produced > 0) r.producer_cpu_us_per_msg = prod_now.cpu_s / r.produced * 1e6;
+    }
+    return r;
+}
+
+void json_number(std::string &out, const char *key, double value) {
+    char buf[64];
+    if (std::isnan(value)) snprintf(buf, sizeof(buf), ",\"%s\":null", key);
+    else snprintf(buf, sizeof(buf), ",\"%s\":%.10g", key, value);
+    out += buf;
+}
+
+std::string to_json(const Scenario &sc, const ScenarioResult &r, const std::string &name, double duration_s) {
+    std::string out = "{\"scenario\":\"" + name + "\",\"format\":\"" + sc.format + "\"";
+    json_number(out, "rate", sc.rate);
+    json_number(out, "workers", sc.workers);
+    json_number(out, "poll_batch", sc.poll_batch);
+    json_number(out, "updates_per_record", sc.record_batch);
+    json_number(out, "duration_s", duration_s);
+    out += r.error.empty() ? ",\"error\":null" : ",\"error\":\"" + r.error + "\"";
+    json_number(out, "produced", r.produced);
+    json_number(out, "consumed", r.consumed);
+    json_number(out, "elapsed_s", r.elapsed_s);
+    json_number(out, "throughput_msgs_per_s", r.throughput);
+    json_number(out, "kafka_p50_ms", r.kafka_p50_ms);
+    json_number(out, "kafka_p99_ms", r.kafka_p99_ms);
+    json_number(out, "kafka_p999_ms", r.kafka_p999_ms);
+    json_number(out, "db_e2e_p50_ms", r.db_e2e_p50_ms);
+    json_number(out, "db_e2e_p99_ms", r.db_e2e_p99_ms);
+    json_number(out, "db_rows_written", r.db_rows);
+    json_number(out, "db_queue_full_stalls", r.full_stalls);
+    json_number(out, "aggregator_cpu_us_per_msg", r.aggregator_cpu_us_per_msg);
+    json_number(out, "producer_cpu_us_per_msg", r.producer_cpu_us_per_msg);
+    json_number(out, "aggregator_max_rss_bytes", static_cast<double>(r.aggregator_max_rss));
+    out += "}";
+    return out;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    if (!parse_bench_options(argc, argv, opts)) {
+        print_bench_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGINT, stop);
+
+    if (mkdir(opts.log_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Cannot create " << opts.log_dir << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::ofstream out(opts.out, std::ios::app);
+    if (!out) {
+        std::cerr << "Cannot open " << opts.out << std::endl;
+        return 1;
+    }
+
+    // The producer rejects --updates-per-record above 1 with --format packed; leave those out
+    std::vector<Scenario> scenarios;
+    size_t skipped = 0;
+    for (const std::string &format : opts.formats)
+        for (int workers : opts.workers)
+            for (int poll_batch : opts.poll_batches)
+                for (int record_batch : opts.record_batches)
+                    for (double rate : opts.rates) {
+                        if (format == "packed" && record_batch > 1) {
+                            skipped++;
+                            continue;
+                        }
+                        scenarios.push_back({format, workers, poll_batch, record_batch, rate});
+                    }
+
+    const std::string run_id = std::to_string(static_cast<long long>(time(NULL)));
+    std::cout << "Running " << scenarios.size() << " scenario(s), results in " << opts.out << std::endl;
+    if (skipped > 0) std::cout << "Skipped " << skipped << " packed scenario(s) with --updates-per-record > 1" << std::endl;
+
+    int failures = 0;
+    for (size_t i = 0; i < scenarios.size() && run; i++) {
+        const Scenario &sc = scenarios[i];
+        std::string name = run_id + "-" + std::to_string(i) + "-" + sc.format + "-w" + std::to_string(sc.workers) +
+                           "-pb" + std::to_string(sc.poll_batch) + "-u" + std::to_string(sc.record_batch) + "-r" +
+                           std::to_string(static_cast<long long>(sc.rate));
+        std::cout << "[" << i + 1 << "/" << scenarios.size() << "] " << name << " ..." << std::flush;
+
+        ScenarioResult r = run_scenario(opts, sc, name, "pipeline_bench_" + run_id + "_" + std::to_string(i));
+        out << to_json(sc, r, name, opts.duration_s) << std::endl;
+
+        if (!r.error.empty()) {
+            failures++;
+            std::cout << " FAILED: " << r.error << std::endl;
+            continue;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), " %.0f msg/s, kafka p50/p99 %.2f/%.2f ms, %.2f us CPU/msg, RSS %lld MB",
+                 r.throughput, r.kafka_p50_ms, r.kafka_p99_ms, r.aggregator_cpu_us_per_msg,
+                 r.aggregator_max_rss >> 20);
+        std::cout << line << std::endl;
+    }
+    return failures > 0 ? 1 : 0;
+}
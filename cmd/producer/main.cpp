@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -6,8 +7,23 @@
 #include <thread>
 #include <csignal>
 #include <atomic>
+#include <functional>
+#include <string_view>
+#include <memory>
 #include <librdkafka/rdkafka.h>
 #include "market_data.pb.h"
+#include "common/clock_sync.hpp"
+#include "common/http_server.hpp"
+#include "common/latency_histogram.hpp"
+#include "common/metrics.hpp"
+#include "common/packed_format.hpp"
+#include "common/symbol_loader.hpp"
+#include "common/symbol_table.hpp"
+#include "common/tick_capture.hpp"
+#include "producer/load_profile.hpp"
+#include "producer/message_pool.hpp"
+#include "producer/options.hpp"
+#include "producer/update_batcher.hpp"
 
 long long current_timestamp_ns() {
     return std::chrono::duration_cast<std::chrono::nanoseconds>(
@@ -15,9 +31,31 @@ long long current_timestamp_ns() {
     ).count();
 }
 
+long long monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
 static volatile sig_atomic_t run = 1;
-std::atomic<long long> total_messages(0);
+const size_t QUEUE_MAX_MESSAGES = 100000;  // queue.buffering.max.messages
+std::atomic<long long> total_messages(0);  // ticks, whether sent alone or in batch records
+std::atomic<long long> total_records(0);
 std::atomic<long long> total_errors(0);
+std::atomic<long long> queue_full_errors(0);
+std::atomic<long long> delivery_errors(0);
+std::atomic<long long> pool_waits(0);
+std::vector<std::unique_ptr<MessagePool>> pools;  // one per producer thread, outlives rd_kafka_flush
+std::vector<std::unique_ptr<UpdateBatcher>> batchers;  // one per producer thread with --updates-per-record
+std::vector<int32_t> symbol_partitions;  // by symbol ID, for batch records
+KafkaStatsCache kafka_stats;
+
+// Paced mode (--rate). send_lag is actual send time minus scheduled send time
+// per message; sustained growth means the producer cannot hold the target.
+HistogramRegistry latency_registry;
+LoadProfile load_profile;
+std::atomic<double> target_rate(0);
+std::unique_ptr<ClockResponder> clock_responder;  // --clock-sync on
 
 void sigterm(int sig) {
     run = 0;
@@ -40,7 +78,13 @@ void status_reporter() {
 
         std::cout << "\n=== Stats (last 5s) ===" << std::endl;
         std::cout << "Messages sent: " << messages_sent << std::endl;
-        std::cout << "Throughput: " << static_cast<int>(throughput) << " msg/sec" << std::endl;
+        std::cout << "Throughput: " << static_cast<int>(throughput) << " msg/sec";
+        if (target_rate > 0) {
+            HistogramSnapshot lag = latency_registry.snapshot("send_lag");
+            std::cout << " (target " << static_cast<int>(target_rate.load()) << ", send lag p99 "
+                      << lag.percentile(0.99) / 1e6 << " ms, max " << lag.max / 1e6 << " ms)";
+        }
+        std::cout << std::endl;
         std::cout << "Total messages: " << current_count << std::endl;
         std::cout << "Total errors: " << errors << std::endl;
         std::cout << "=====================\n" << std::endl;
@@ -51,7 +95,55 @@ void status_reporter() {
 
 }
 
-rd_kafka_t* create_kafka_producer(const std::string& brokers) {
+// Returns the payload buffer to the pool it came from. Runs inside
+// rd_kafka_poll/rd_kafka_flush on whichever thread is polling.
+static void delivery_report_cb(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque) {
+    if (rkmessage->err) delivery_errors++;
+    if (rkmessage->_private) static_cast<MessagePool *>(rkmessage->_private)->release(rkmessage->payload);
+}
+
+static int kafka_stats_cb(rd_kafka_t *rk, char *json, size_t json_len, void *opaque) {
+    kafka_stats.store(json, json_len);
+    return 0;  // librdkafka frees the JSON buffer
+}
+
+std::string render_metrics() {
+    MetricsWriter m;
+    m.counter("producer_messages_total", "Ticks accepted by librdkafka", total_messages.load());
+    m.counter("producer_records_total", "Kafka records accepted by librdkafka (< messages with batch records)",
+              total_records.load());
+    m.counter("producer_errors_total", "Ticks rejected by librdkafka (other than QUEUE_FULL) or too large",
+              total_errors.load());
+    m.counter("producer_queue_full_total", "Times a batch hit QUEUE_FULL and was retried after polling",
+              queue_full_errors.load());
+    m.counter("producer_delivery_errors_total", "Messages that failed delivery to the broker", delivery_errors.load());
+    m.counter("producer_pool_waits_total", "Polls spent waiting for a free payload buffer", pool_waits.load());
+    size_t in_flight = 0;
+    for (const auto& pool : pools) in_flight += pool->in_flight();
+    m.gauge("producer_buffers_in_flight", "Payload buffers awaiting a delivery report", in_flight);
+    if (target_rate > 0) {
+        m.gauge("producer_target_rate", "Scheduled msg/s from --rate/--profile", target_rate.load());
+        m.latency_summary("producer_send_lag_seconds", "Actual minus scheduled send time",
+                          latency_registry.snapshot("send_lag"));
+    }
+
+    std::string stats = kafka_stats.load();
+    if (!stats.empty()) {
+        m.gauge("producer_kafka_queue_messages", "Messages in the librdkafka producer queue", kafka_stat(stats, "msg_cnt"));
+        m.gauge("producer_kafka_queue_bytes", "Bytes in the librdkafka producer queue", kafka_stat(stats, "msg_size"));
+        m.counter("producer_kafka_tx_messages_total", "Messages sent to brokers", kafka_stat(stats, "txmsgs"));
+        m.counter("producer_kafka_tx_bytes_total", "Message bytes sent to brokers", kafka_stat(stats, "txmsg_bytes"));
+        m.counter("producer_kafka_tx_requests_total", "Requests sent to brokers", kafka_stat(stats, "tx"));
+    }
+    clock_sync::write_kernel_clock_metrics(m, "producer");
+    if (clock_responder) {
+        m.counter("producer_clock_replies_total", "Clock probes answered on clock-sync-replies",
+                  clock_responder->replies());
+    }
+    return m.str();
+}
+
+rd_kafka_t* create_kafka_producer(const std::string& brokers, bool enable_stats) {
     char errstr[512];
     rd_kafka_conf_t *conf = rd_kafka_conf_new();
 
@@ -79,7 +171,8 @@ rd_kafka_t* create_kafka_producer(const std::string& brokers) {
     }
 
     // Important: Increase queue buffering
-    if (rd_kafka_conf_set(conf, "queue.buffering.max.messages", "100000", errstr, 512) != RD_KAFKA_CONF_OK) {
+    if (rd_kafka_conf_set(conf, "queue.buffering.max.messages", std::to_string(QUEUE_MAX_MESSAGES).c_str(), errstr,
+                          512) != RD_KAFKA_CONF_OK) {
         std::cerr << "Config error (queue.buffering.max.messages): " << errstr << std::endl;
         return NULL;
     }
@@ -89,6 +182,16 @@ rd_kafka_t* create_kafka_producer(const std::string& brokers) {
         return NULL;
     }
 
+    rd_kafka_conf_set_dr_msg_cb(conf, delivery_report_cb);
+
+    if (enable_stats) {
+        if (rd_kafka_conf_set(conf, "statistics.interval.ms", "5000", errstr, 512) != RD_KAFKA_CONF_OK) {
+            std::cerr << "Config error (statistics.interval.ms): " << errstr << std::endl;
+            return NULL;
+        }
+        rd_kafka_conf_set_stats_cb(conf, kafka_stats_cb);
+    }
+
     rd_kafka_t *producer = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, 512);
     if (!producer) {
         std::cerr << "Failed to create Kafka producer: " << errstr << std::endl;
@@ -102,7 +205,177 @@ rd_kafka_t* create_kafka_producer(const std::string& brokers) {
     return producer;
 }
 
-void produce_data(rd_kafka_t *producer, const std::string& topic, const std::vector<std::string>& tickers) {
+// Hands the pending batch to librdkafka without copying payloads. Messages
+// rejected with QUEUE_FULL stay in the batch and are retried after polling
+// for delivery reports, so a saturated producer slows down instead of
+// dropping; other rejections release their buffer and count as errors.
+// `updates` holds the tick count of each record, parallel to `batch`. Batch
+// records carry their partition, single messages are partitioned by key.
+//
+// rd_kafka_produce_batch carries on past a rejected message, so a later one
+// for the same partition could be queued ahead of it. The whole batch is only
+// handed over while the queue has room for all of it; near the limit messages
+// go one at a time, and the first rejection holds back everything after it.
+void submit_batch(rd_kafka_t *producer, rd_kafka_topic_t *rkt, MessagePool& pool,
+                  std::vector<rd_kafka_message_t>& batch, std::vector<uint32_t>& updates) {
+    const int msgflags = batchers.empty() ? 0 : RD_KAFKA_MSG_F_PARTITION;
+    size_t next = 0;  // first message not yet accepted or dropped
+    while (next < batch.size()) {
+        size_t n = batch.size() - next;
+        if (static_cast<size_t>(rd_kafka_outq_len(producer)) + n > QUEUE_MAX_MESSAGES) n = 1;
+        rd_kafka_produce_batch(rkt, RD_KAFKA_PARTITION_UA, msgflags, &batch[next], static_cast<int>(n));
+
+        size_t keep = next;
+        for (size_t i = next; i < next + n; i++) {
+            rd_kafka_message_t& msg = batch[i];
+            if (msg.err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+                total_records++;
+                total_messages += updates[i];
+            } else if (msg.err == RD_KAFKA_RESP_ERR__QUEUE_FULL && run) {
+                msg.err = RD_KAFKA_RESP_ERR_NO_ERROR;
+                updates[keep] = updates[i];
+                batch[keep++] = msg;
+            } else {
+                total_errors += updates[i];
+                pool.release(msg.payload);
+            }
+        }
+        if (keep == next) {
+            next += n;
+            continue;
+        }
+        batch.erase(batch.begin() + keep, batch.begin() + next + n);
+        updates.erase(updates.begin() + keep, updates.begin() + next + n);
+        queue_full_errors++;
+        rd_kafka_poll(producer, 10);
+    }
+    batch.clear();
+    updates.clear();
+}
+
+// Waits for a free payload buffer, submitting the pending batch so delivery
+// reports can hand slots back. NULL once the producer is stopping.
+char *acquire_buffer(rd_kafka_t *producer, rd_kafka_topic_t *rkt, MessagePool& pool,
+                     std::vector<rd_kafka_message_t>& batch, std::vector<uint32_t>& updates) {
+    char *buf = pool.acquire();
+    while (!buf && run) {
+        if (!batch.empty()) submit_batch(producer, rkt, pool, batch, updates);
+        pool_waits++;
+        rd_kafka_poll(producer, 1);
+        buf = pool.acquire();
+    }
+    return buf;
+}
+
+// Serializes one partition's batch record into a pooled buffer and queues it.
+void emit_record(rd_kafka_t *producer, rd_kafka_topic_t *rkt, MessagePool& pool, UpdateBatcher& batcher,
+                 int partition, std::vector<rd_kafka_message_t>& batch, std::vector<uint32_t>& updates) {
+    char *buf = acquire_buffer(producer, rkt, pool, batch, updates);
+    if (!buf) return;
+    uint32_t count;
+    size_t len = batcher.take(partition, buf, pool.slot_bytes(), count);
+    if (len == 0) {
+        total_errors += count;
+        pool.release(buf);
+        return;
+    }
+
+    rd_kafka_message_t msg = {};
+    msg.partition = partition;
+    msg.payload = buf;
+    msg.len = len;
+    msg._private = &pool;
+    batch.push_back(msg);
+    updates.push_back(count);
+}
+
+// Queues every record whose oldest tick has waited --record-linger-us, or all of them.
+void emit_records(rd_kafka_t *producer, rd_kafka_topic_t *rkt, MessagePool& pool, UpdateBatcher& batcher,
+                  long long now_ns, bool all, std::vector<rd_kafka_message_t>& batch, std::vector<uint32_t>& updates) {
+    for (int p = 0; p < batcher.partitions(); p++) {
+        if (!batcher.empty(p) && (all || batcher.expired(p, now_ns))) {
+            emit_record(producer, rkt, pool, batcher, p, batch, updates);
+        }
+    }
+}
+
+// Sleeps until `due` (monotonic), first handing librdkafka whatever is ready:
+// partly filled records must not outwait their linger while we sleep, and
+// finished messages are never held back, so batches only form when behind or
+// at high rate.
+void wait_for_send(rd_kafka_t *producer, rd_kafka_topic_t *rkt, MessagePool& pool, UpdateBatcher *batcher,
+                   long long due, std::vector<rd_kafka_message_t>& batch, std::vector<uint32_t>& updates) {
+    while (batcher && run && batcher->next_due_ns() <= due) {
+        if (!batch.empty() && batcher->next_due_ns() > monotonic_ns()) {
+            submit_batch(producer, rkt, pool, batch, updates);
+        }
+        wait_until_ns(batcher->next_due_ns(), monotonic_ns);
+        emit_records(producer, rkt, pool, *batcher, monotonic_ns(), false, batch, updates);
+    }
+    if (!batch.empty() && due > monotonic_ns()) submit_batch(producer, rkt, pool, batch, updates);
+    wait_until_ns(due, monotonic_ns);
+}
+
+// Adds one tick to the batcher, or serializes it into a pooled buffer and
+// queues it as its own message. False once the producer is stopping.
+bool queue_tick(rd_kafka_t *producer, rd_kafka_topic_t *rkt, MessagePool& pool, UpdateBatcher *batcher,
+                PayloadFormat format, marketdata::MarketUpdate& update, uint32_t symbol_id, std::string_view ticker,
+                double price, int volume, long long timestamp_ns, std::vector<rd_kafka_message_t>& batch,
+                std::vector<uint32_t>& updates) {
+    if (batcher) {
+        long long now = monotonic_ns();
+        int full = batcher->add(symbol_id, price, volume, timestamp_ns, now);
+        if (full >= 0) emit_record(producer, rkt, pool, *batcher, full, batch, updates);
+        if (batcher->linger_due(now)) emit_records(producer, rkt, pool, *batcher, now, false, batch, updates);
+        return true;
+    }
+
+    // Backpressure: every slot is waiting for a delivery report
+    char *buf = acquire_buffer(producer, rkt, pool, batch, updates);
+    if (!buf) return false;
+
+    // Serialize straight into the pooled buffer librdkafka will send from
+    size_t len;
+    if (format == PayloadFormat::Packed) {
+        packed::Update p;
+        p.symbol_id = symbol_id;
+        p.price = price;
+        p.volume = volume;
+        p.timestamp_ns = timestamp_ns;
+        packed::encode(p, buf);
+        len = packed::SIZE;
+    } else {
+        update.set_ticker(ticker.data(), ticker.size());
+        update.set_price(price);
+        update.set_volume(volume);
+        update.set_timestamp_ns(timestamp_ns);
+
+        len = update.ByteSizeLong();
+        if (len > pool.slot_bytes()) {
+            total_errors++;
+            pool.release(buf);
+            return true;
+        }
+        update.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(buf));
+    }
+
+    rd_kafka_message_t msg = {};
+    msg.payload = buf;
+    msg.len = len;
+    msg.key = const_cast<char *>(ticker.data());  // keys are always copied by librdkafka
+    msg.key_len = ticker.size();
+    msg._private = &pool;  // handed back to delivery_report_cb
+    batch.push_back(msg);
+    updates.push_back(1);
+    return true;
+}
+
+// `share` is this thread's fraction of --rate; `start_ns` (monotonic) and
+// `duration_ns` are common to all threads so their schedules line up.
+// `batcher` is NULL unless ticks are packed into batch records.
+void produce_data(rd_kafka_t *producer, const std::string& topic, const SymbolTable& symbols,
+                  MessagePool& pool, UpdateBatcher *batcher, size_t batch_size, PayloadFormat format,
+                  double share, long long start_ns, long long duration_ns) {
     rd_kafka_topic_t *rkt = rd_kafka_topic_new(producer, topic.c_str(), NULL);
     if (!rkt) {
         std::cerr << "Failed to create topic handle: " << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
@@ -111,92 +384,322 @@ void produce_data(rd_kafka_t *producer, const std::string& topic, const std::vec
 
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::uniform_int_distribution<> ticker_dist(0, tickers.size() - 1);
+    std::uniform_int_distribution<uint32_t> ticker_dist(0, symbols.size() - 1);
     std::uniform_real_distribution<> price_base_dist(95.0, 105.0);
     std::uniform_real_distribution<> price_change_dist(-0.5, 0.5);
     std::uniform_int_distribution<> volume_dist(100, 10000);
 
-    // long long msg_count = 0;
-    std::string serialized_data;
+    marketdata::MarketUpdate update;  // reused so set_ticker() keeps its buffer
+    std::vector<rd_kafka_message_t> batch;
+    std::vector<uint32_t> updates;  // ticks per queued record
+    batch.reserve(batch_size);
+    updates.reserve(batch_size);
+
+    const bool paced = target_rate > 0;
+    PacedSchedule schedule(load_profile, share, start_ns);
+    LatencyHistogram *send_lag = paced ? latency_registry.create("send_lag") : NULL;
+    // Maps monotonic schedule times onto the wall clock the aggregator compares against
+    const long long wall_offset_ns = current_timestamp_ns() - monotonic_ns();
 
     while (run) {
-        std::string current_ticker = tickers[ticker_dist(gen)];
+        long long produce_timestamp = 0;
+        if (paced) {
+            long long due = schedule.next();
+            if (duration_ns > 0 && due - start_ns >= duration_ns) break;
+            wait_for_send(producer, rkt, pool, batcher, due, batch, updates);
+            send_lag->record(monotonic_ns() - due);
+            produce_timestamp = due + wall_offset_ns;
+        }
+
+        uint32_t symbol_id = ticker_dist(gen);
+        std::string_view current_ticker = symbols.name(symbol_id);
         double current_price = price_base_dist(gen) + price_change_dist(gen);
         int current_volume = volume_dist(gen);
 
-        long long produce_timestamp = current_timestamp_ns();
-
-        marketdata::MarketUpdate update;
-        update.set_ticker(current_ticker);
-        update.set_price(current_price);
-        update.set_volume(current_volume);
-        update.set_timestamp_ns(produce_timestamp);
-
-        // Clear previous data before serializing
-        serialized_data.clear();
-        update.SerializeToString(&serialized_data);
-
-        rd_kafka_resp_err_t err;
-        err = (rd_kafka_resp_err_t)rd_kafka_produce(
-            rkt,
-            RD_KAFKA_PARTITION_UA,
-            RD_KAFKA_MSG_F_COPY,
-            (void *)serialized_data.c_str(),
-            serialized_data.length(),
-            current_ticker.c_str(),
-            current_ticker.length(),
-            NULL
-        );
-
-        if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
-            // std::cerr << "Produce failed: " << rd_kafka_err2str(err) << std::endl;
-            total_errors++;
+        if (!paced) produce_timestamp = current_timestamp_ns();
 
-            // If queue is full, poll and retry once
-            if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-                rd_kafka_poll(producer, 100);
-                continue;
-            }
-        } else {
-            total_messages++;
+        if (!queue_tick(producer, rkt, pool, batcher, format, update, symbol_id, current_ticker, current_price,
+                        current_volume, produce_timestamp, batch, updates)) {
+            break;
         }
 
+        if (batch.size() >= batch_size) submit_batch(producer, rkt, pool, batch, updates);
+
         rd_kafka_poll(producer, 0);
 
-        // Add small delay to avoid overwhelming the system
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        if (!paced) {
+            submit_batch(producer, rkt, pool, batch, updates);
+            // Add small delay to avoid overwhelming the system
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            if (duration_ns > 0 && monotonic_ns() - start_ns >= duration_ns) break;
+        }
     }
 
-    std::cout << "\nFlushing final messages..." << std::endl;
-    rd_kafka_flush(producer, 10000);
+    if (batcher) emit_records(producer, rkt, pool, *batcher, monotonic_ns(), true, batch, updates);
+    submit_batch(producer, rkt, pool, batch, updates);
+    rd_kafka_topic_destroy(rkt);
+}
+
+// --replay: streams the capture's ticks whose symbol index is `thread` modulo
+// `threads`, so each ticker stays on one thread and in recorded order. A tick
+// is due at start_ns + (its offset into the capture) / speed; every loop is
+// shifted by the capture's span plus one mean gap. Messages carry the
+// scheduled wall time, like --rate, so aggregator latency stays meaningful;
+// speed 0 sends as fast as librdkafka takes them. `capture_ids` maps capture
+// symbol indexes to SymbolTable IDs.
+void replay_data(rd_kafka_t *producer, const std::string& topic, const SymbolTable& symbols,
+                 const TickCapture& capture, const std::vector<uint32_t>& capture_ids, MessagePool& pool,
+                 UpdateBatcher *batcher, size_t batch_size, PayloadFormat format, uint32_t thread,
+                 uint32_t threads, double speed, long long loops, long long start_ns, long long duration_ns) {
+    rd_kafka_topic_t *rkt = rd_kafka_topic_new(producer, topic.c_str(), NULL);
+    if (!rkt) {
+        std::cerr << "Failed to create topic handle: " << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
+        return;
+    }
 
+    marketdata::MarketUpdate update;
+    std::vector<rd_kafka_message_t> batch;
+    std::vector<uint32_t> updates;
+    batch.reserve(batch_size);
+    updates.reserve(batch_size);
+
+    const bool paced = speed > 0;
+    LatencyHistogram *send_lag = paced ? latency_registry.create("send_lag") : NULL;
+    const long long wall_offset_ns = current_timestamp_ns() - monotonic_ns();
+    const ReplayTick *ticks = capture.ticks();
+    const size_t count = capture.size();
+    const int64_t first_ns = ticks[0].timestamp_ns;
+    const int64_t period_ns = capture.span_ns() + (count > 1 ? capture.span_ns() / static_cast<int64_t>(count - 1) : 0);
+
+    bool done = false;  // --duration elapsed
+    for (long long loop = 0; run && !done && (loops == 0 || loop < loops); loop++) {
+        for (size_t i = 0; i < count && run && !done; i++) {
+            const ReplayTick& t = ticks[i];
+            if (t.symbol % threads != thread) continue;
+
+            long long produce_timestamp;
+            if (paced) {
+                long long due = start_ns + static_cast<long long>(
+                    (static_cast<double>(t.timestamp_ns - first_ns) + static_cast<double>(loop) * period_ns) / speed);
+                done = duration_ns > 0 && due - start_ns >= duration_ns;
+                if (done) break;
+                wait_for_send(producer, rkt, pool, batcher, due, batch, updates);
+                send_lag->record(monotonic_ns() - due);
+                produce_timestamp = due + wall_offset_ns;
+            } else {
+                done = duration_ns > 0 && monotonic_ns() - start_ns >= duration_ns;
+                if (done) break;
+                produce_timestamp = current_timestamp_ns();
+            }
+
+            uint32_t symbol_id = capture_ids[t.symbol];
+            if (!queue_tick(producer, rkt, pool, batcher, format, update, symbol_id, symbols.name(symbol_id), t.price,
+                            t.volume, produce_timestamp, batch, updates)) {
+                break;
+            }
+            if (batch.size() >= batch_size) submit_batch(producer, rkt, pool, batch, updates);
+            rd_kafka_poll(producer, 0);
+        }
+    }
+
+    if (batcher) emit_records(producer, rkt, pool, *batcher, monotonic_ns(), true, batch, updates);
+    submit_batch(producer, rkt, pool, batch, updates);
     rd_kafka_topic_destroy(rkt);
 }
 
+// Maps every symbol to the partition librdkafka's default partitioner
+// (consistent_random) would pick for its ticker key, so batch records keep
+// each ticker on the partition it had as a single-message key.
+bool load_symbol_partitions(rd_kafka_t *producer, const std::string& topic, const SymbolTable& symbols,
+                            int& partition_count) {
+    rd_kafka_topic_t *rkt = rd_kafka_topic_new(producer, topic.c_str(), NULL);
+    if (!rkt) {
+        std::cerr << "Failed to create topic handle: " << rd_kafka_err2str(rd_kafka_last_error()) << std::endl;
+        return false;
+    }
+    const struct rd_kafka_metadata *metadata;
+    rd_kafka_resp_err_t err = rd_kafka_metadata(producer, 0, rkt, &metadata, 10000);
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR || metadata->topic_cnt != 1 || metadata->topics[0].partition_cnt <= 0) {
+        std::cerr << "Cannot read partition count of " << topic << ": "
+                  << rd_kafka_err2str(err ? err : metadata->topics[0].err) << std::endl;
+        if (err == RD_KAFKA_RESP_ERR_NO_ERROR) rd_kafka_metadata_destroy(metadata);
+        rd_kafka_topic_destroy(rkt);
+        return false;
+    }
+    partition_count = metadata->topics[0].partition_cnt;
+    rd_kafka_metadata_destroy(metadata);
+
+    symbol_partitions.resize(symbols.size());
+    for (uint32_t id = 0; id < symbols.size(); id++) {
+        std::string_view ticker = symbols.name(id);
+        symbol_partitions[id] = rd_kafka_msg_partitioner_consistent_random(
+            rkt, ticker.data(), ticker.size(), partition_count, NULL, NULL);
+    }
+    rd_kafka_topic_destroy(rkt);
+    return true;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <broker list (e.g., localhost:9092)>" << std::endl;
+    ProducerOptions opts;
+    if (!parse_producer_options(argc, argv, opts)) {
+        print_producer_usage(argv[0]);
         return 1;
     }
 
     signal(SIGINT, sigterm);
 
-    rd_kafka_t *producer = create_kafka_producer(argv[1]);
+    if (opts.rate > 0) {
+        std::string error;
+        if (!LoadProfile::parse(opts.profile, opts.rate, load_profile, error)) {
+            std::cerr << "--profile: " << error << std::endl;
+            return 1;
+        }
+        target_rate = opts.rate;
+    }
+
+    rd_kafka_t *producer = create_kafka_producer(opts.brokers, opts.metrics_port > 0);
     if (!producer) return 1;
 
+    if (opts.clock_sync) {
+        clock_responder.reset(new ClockResponder(opts.brokers));
+        if (clock_responder->start()) {
+            std::cout << "Answering clock probes as " << clock_responder->name() << std::endl;
+        } else {
+            clock_responder.reset();
+        }
+    }
+
+    // Prometheus exporter
+    HttpServer metrics_server(opts.metrics_port, [](const std::string& path, std::string& body, std::string&) {
+        if (path != "/metrics") return false;
+        body = render_metrics();
+        return true;
+    });
+    if (opts.metrics_port > 0 && metrics_server.start()) {
+        std::cout << "Metrics on http://0.0.0.0:" << opts.metrics_port << "/metrics" << std::endl;
+    }
+
     // Fixed: Removed space from topic name
     const std::string topic = "market-updates";
-    const std::vector<std::string> sample_tickers = {"AAPL", "GOOG", "MSFT", "AMZN", "TSLA", "NVDA", "JPM", "BAC"};
+    SymbolTable symbols(opts.max_symbols);
+    if (!opts.symbols_source.empty()) {
+        if (!load_symbols(opts.symbols_source, symbols)) return 1;
+    } else {
+        for (const char *ticker : {"AAPL", "GOOG", "MSFT", "AMZN", "TSLA", "NVDA", "JPM", "BAC"}) {
+            symbols.intern(ticker);
+        }
+    }
+    if (symbols.size() == 0) {
+        std::cerr << "Symbol source " << opts.symbols_source << " is empty" << std::endl;
+        return 1;
+    }
 
-    const int num_threads = 4;
+    // Capture symbols are appended after the dictionary, so its IDs are unchanged
+    TickCapture capture;
+    std::vector<uint32_t> capture_ids;  // by capture symbol index
+    if (!opts.replay_path.empty()) {
+        std::string error;
+        if (!capture.open(opts.replay_path, error)) {
+            std::cerr << "--replay: " << error << std::endl;
+            return 1;
+        }
+        if (capture.size() == 0) {
+            std::cerr << "--replay: " << opts.replay_path << " holds no ticks" << std::endl;
+            return 1;
+        }
+        const uint32_t dictionary_size = symbols.size();
+        for (const std::string& name : capture.symbols()) {
+            uint32_t id = symbols.intern(name);
+            if (id == SymbolTable::INVALID) {
+                std::cerr << "Cannot intern capture symbol '" << name << "' (raise --max-symbols)" << std::endl;
+                return 1;
+            }
+            capture_ids.push_back(id);
+        }
+        const double span_s = capture.span_ns() / 1e9;
+        std::cout << "Replaying " << capture.size() << " ticks of " << capture.symbols().size() << " symbols ("
+                  << span_s << " s recorded) from " << opts.replay_path << (capture.mapped() ? ", mapped" : ", CSV")
+                  << ", speed " << (opts.replay_speed > 0 ? std::to_string(opts.replay_speed) + "x" : "max")
+                  << ", " << (opts.replay_loops > 0 ? std::to_string(opts.replay_loops) : "unlimited") << " loop(s)"
+                  << std::endl;
+        if (opts.replay_speed > 0 && span_s > 0) target_rate = capture.size() / span_s * opts.replay_speed;
+        if (opts.format == PayloadFormat::Packed && symbols.size() > dictionary_size) {
+            std::cout << "Warning: " << symbols.size() - dictionary_size << " capture symbols are not in the "
+                      << "dictionary; the aggregator drops their packed ticks as unknown IDs" << std::endl;
+        }
+    }
+    std::cout << "Producing for " << symbols.size() << " symbols." << std::endl;
+    if (opts.format == PayloadFormat::Packed) {
+        std::cout << "Packed payloads carry symbol IDs: the aggregator needs the same --symbols dictionary"
+                  << (opts.symbols_source.empty() ? " (the built-in tickers match deploy/symbols.txt)" : "")
+                  << std::endl;
+    }
+
+    // A replay thread owns the capture symbols congruent to its index; past one
+    // thread per symbol the rest would own nothing
+    int num_threads = opts.threads;
+    if (capture.size() > 0 && static_cast<size_t>(num_threads) > capture.symbols().size()) {
+        num_threads = static_cast<int>(capture.symbols().size());
+        std::cout << "Capping --threads at " << num_threads << ", one per capture symbol" << std::endl;
+    }
     std::vector<std::thread> producer_threads;
 
+    if (opts.updates_per_record > 1) {
+        int partition_count;
+        if (!load_symbol_partitions(producer, topic, symbols, partition_count)) {
+            rd_kafka_destroy(producer);
+            return 1;
+        }
+        for (int i = 0; i < num_threads; ++i) {
+            opts.placement.near("producer", i, [&] {
+                batchers.emplace_back(new UpdateBatcher(symbols, symbol_partitions, partition_count,
+                                                        opts.updates_per_record, opts.record_linger_us * 1000,
+                                                        opts.record_delta));
+            });
+        }
+        std::cout << "Batch records: up to " << opts.updates_per_record << " ticks or " << opts.record_linger_us
+                  << " us per record, " << (opts.record_delta ? "delta" : "plain") << " encoding, "
+                  << partition_count << " partitions" << std::endl;
+    }
+
     std::cout << "Starting " << num_threads << " producer threads..." << std::endl;
 
+    if (opts.rate > 0) {
+        std::cout << "Open-loop pacing: " << opts.rate << " msg/s, profile " << opts.profile << std::endl;
+    }
+
+    const ThreadPlacement& placement = opts.placement;
+    placement.log();
     std::thread stats_thread(status_reporter);
+    placement.pin(stats_thread.native_handle(), "other", 0);
 
+    const long long start_ns = monotonic_ns() + 10000000;  // let every thread reach its first send
+    const long long duration_ns = static_cast<long long>(opts.duration_s * 1e9);
+    for (int i = 0; i < num_threads; ++i) {
+        // Slot storage is first written by the producer thread itself; the free list here
+        placement.near("producer", i, [&] {
+            if (batchers.empty()) {
+                pools.emplace_back(new MessagePool(opts.pool_slots, 64));  // MarketUpdate with a <=15-char ticker is <=48 bytes
+            } else {
+                // One slot per record; either encoding stays under 64 bytes per tick
+                size_t slots = std::max<size_t>(opts.pool_slots / opts.updates_per_record, 64);
+                pools.emplace_back(new MessagePool(slots, 64 * opts.updates_per_record));
+            }
+        });
+    }
     for (int i = 0; i < num_threads; ++i) {
-        producer_threads.emplace_back(produce_data, producer, topic, sample_tickers);
+        UpdateBatcher *batcher = batchers.empty() ? NULL : batchers[i].get();
+        if (capture.size() > 0) {
+            producer_threads.emplace_back(replay_data, producer, topic, std::cref(symbols), std::cref(capture),
+                                          std::cref(capture_ids), std::ref(*pools[i]), batcher, opts.batch_size,
+                                          opts.format, static_cast<uint32_t>(i), static_cast<uint32_t>(num_threads),
+                                          opts.replay_speed, opts.replay_loops, start_ns, duration_ns);
+        } else {
+            producer_threads.emplace_back(produce_data, producer, topic, std::cref(symbols), std::ref(*pools[i]),
+                                          batcher, opts.batch_size, opts.format, 1.0 / num_threads, start_ns,
+                                          duration_ns);
+        }
+        placement.pin(producer_threads.back().native_handle(), "producer", i);
     }
 
     for (auto& t : producer_threads) {
@@ -204,12 +707,23 @@ int main(int argc, char **argv) {
             t.join();
         }
     }
+    run = 0;  // --duration elapsed or the replay ended: stop the reporter too
 
     if (stats_thread.joinable()) {
         stats_thread.join();
     }
 
+    // Delivery reports for everything still queued return the pooled buffers
+    std::cout << "\nFlushing final messages..." << std::endl;
+    if (rd_kafka_flush(producer, 10000) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        std::cerr << "Flush timed out with " << rd_kafka_outq_len(producer) << " messages queued" << std::endl;
+    }
+
+    metrics_server.stop();
+    clock_responder.reset();
     rd_kafka_destroy(producer);
+    batchers.clear();
+    pools.clear();
     std::cout << "Producer shut down cleanly" << std::endl;
     return 0;
 }
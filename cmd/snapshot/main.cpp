@@ -2,38 +2,230 @@
 #include <hiredis/hiredis.h>
 #include <vector>
 #include <iomanip>
+#include <chrono>
+#include <csignal>
+#include <thread>
+#include <atomic>
+#include <string>
+#include "common/http_server.hpp"
+#include "common/metrics.hpp"
+#include "snapshot/options.hpp"
+#include "snapshot/price_cache.hpp"
 
-int main(int argc, char **argv) {
-    const char* host = (argc > 1) ? argv[1] : "127.0.0.1";
+// Long-running snapshot service. It walks the keyspace incrementally with
+// cursors (HSCAN over the aggregator's price hash, or SCAN + pipelined MGET)
+// so Redis never runs an O(N) command, keeps the result in memory and serves
+// it over HTTP. Point it at a Redis replica to keep all load off the
+// instance the aggregator writes to.
+
+static volatile sig_atomic_t run = 1;
+std::atomic<long long> redis_round_trips(0);
+std::atomic<long long> refresh_errors(0);
+std::atomic<long long> last_cycle_us(0);
+
+static void stop(int sig) {
+    run = 0;
+}
+
+long long unix_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
 
-    redisContext *c = redisConnect(host, 6379);
+redisContext* connect_to_redis(const SnapshotOptions& opts) {
+    redisContext *c = redisConnect(opts.redis_host.c_str(), opts.redis_port);
     if (c == nullptr || c->err) {
         std::cerr << "Connection error: " << (c ? c->errstr : "allocate context") << std::endl;
-        return 1;
+        if (c) redisFree(c);
+        return nullptr;
     }
+    return c;
+}
+
+// One full HSCAN pass over the price hash, COUNT entries per round trip.
+bool refresh_from_hash(redisContext *c, const SnapshotOptions& opts, PriceCache& cache) {
+    std::string cursor = "0";
+    do {
+        redisReply *reply = (redisReply *)redisCommand(c, "HSCAN %s %s COUNT %d",
+                                                       opts.hash_key.c_str(), cursor.c_str(), opts.scan_count);
+        redis_round_trips++;
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            std::cerr << "HSCAN failed: " << (reply && reply->type == REDIS_REPLY_ERROR ? reply->str : c->errstr)
+                      << std::endl;
+            if (reply) freeReplyObject(reply);
+            return false;
+        }
+        cursor = reply->element[0]->str;
+        const redisReply *items = reply->element[1];
+        for (size_t i = 0; i + 1 < items->elements; i += 2) {
+            cache.update(std::string_view(items->element[i]->str, items->element[i]->len),
+                         std::string_view(items->element[i + 1]->str, items->element[i + 1]->len));
+        }
+        freeReplyObject(reply);
+    } while (run && cursor != "0");
+    return true;
+}
+
+// One full SCAN pass over string keys. The MGET for each batch is pipelined
+// with the SCAN for the next one, so a pass costs one round trip per batch.
+bool refresh_from_keys(redisContext *c, const SnapshotOptions& opts, PriceCache& cache) {
+    std::string cursor = "0";
+    std::string count = std::to_string(opts.scan_count);
+    std::vector<std::string> keys;
+    bool first = true;
+
+    do {
+        bool have_mget = !keys.empty();
+        if (have_mget) {
+            std::vector<const char*> argv = {"MGET"};
+            std::vector<size_t> lens = {4};
+            for (const auto& k : keys) {
+                argv.push_back(k.data());
+                lens.push_back(k.size());
+            }
+            redisAppendCommandArgv(c, static_cast<int>(argv.size()), argv.data(), lens.data());
+        }
+        bool have_scan = first || cursor != "0";
+        if (have_scan) {
+            redisAppendCommand(c, "SCAN %s MATCH %s COUNT %s TYPE string",
+                               cursor.c_str(), opts.match.c_str(), count.c_str());
+        }
+        first = false;
+        redis_round_trips++;
+
+        redisReply *reply = nullptr;
+        if (have_mget) {
+            if (redisGetReply(c, (void**)&reply) != REDIS_OK || reply->type != REDIS_REPLY_ARRAY) {
+                std::cerr << "MGET failed: " << c->errstr << std::endl;
+                if (reply) freeReplyObject(reply);
+                return false;
+            }
+            for (size_t i = 0; i < reply->elements && i < keys.size(); i++) {
+                const redisReply *v = reply->element[i];
+                if (v->type == REDIS_REPLY_STRING) cache.update(keys[i], std::string_view(v->str, v->len));
+            }
+            freeReplyObject(reply);
+        }
+        keys.clear();
 
-    // 1. Get all keys (Tickers)
-    redisReply *reply = (redisReply *)redisCommand(c, "KEYS *");
-    if (reply->type != REDIS_REPLY_ARRAY) {
-        std::cerr << "Unexpected reply type" << std::endl;
+        if (have_scan) {
+            if (redisGetReply(c, (void**)&reply) != REDIS_OK || reply->type != REDIS_REPLY_ARRAY ||
+                reply->elements != 2) {
+                std::cerr << "SCAN failed: " << (reply && reply->type == REDIS_REPLY_ERROR ? reply->str : c->errstr)
+                          << std::endl;
+                if (reply) freeReplyObject(reply);
+                return false;
+            }
+            cursor = reply->element[0]->str;
+            const redisReply *batch = reply->element[1];
+            for (size_t i = 0; i < batch->elements; i++) {
+                keys.emplace_back(batch->element[i]->str, batch->element[i]->len);
+            }
+            freeReplyObject(reply);
+        }
+    } while (run && (!keys.empty() || cursor != "0"));
+    return true;
+}
+
+bool refresh(redisContext *c, const SnapshotOptions& opts, PriceCache& cache) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = opts.source == SnapshotSource::Hash ? refresh_from_hash(c, opts, cache)
+                                                  : refresh_from_keys(c, opts, cache);
+    if (!ok || !run) return ok;
+    cache.end_cycle(unix_ms());
+    last_cycle_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+bool handle_request(const PriceCache& cache, const std::string& target, std::string& body, std::string& content_type) {
+    std::string path = target.substr(0, target.find('?'));
+    const std::string price_prefix = "/price/";
+
+    if (path == "/snapshot") {
+        auto doc = cache.snapshot_json();
+        body = doc ? *doc : "{\"refreshed_ms\":0,\"count\":0,\"prices\":{}}\n";
+        content_type = "application/json";
+        return true;
+    }
+    if (path.compare(0, price_prefix.size(), price_prefix) == 0) {
+        std::string ticker = path.substr(price_prefix.size());
+        std::string price;
+        if (!cache.get(ticker, price)) return false;
+        body = "{\"ticker\":\"" + ticker + "\",\"price\":\"" + price + "\"}\n";
+        content_type = "application/json";
+        return true;
+    }
+    if (path == "/metrics") {
+        MetricsWriter m;
+        m.gauge("snapshot_entries", "Tickers held in memory", cache.size());
+        m.counter("snapshot_refresh_cycles_total", "Completed keyspace passes", cache.cycles());
+        m.counter("snapshot_refresh_errors_total", "Passes aborted by a Redis error", refresh_errors.load());
+        m.counter("snapshot_redis_round_trips_total", "Round trips to Redis", redis_round_trips.load());
+        m.gauge("snapshot_last_cycle_seconds", "Duration of the last complete pass", last_cycle_us.load() / 1e6);
+        body = m.str();
+        content_type = "text/plain; version=0.0.4";
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    SnapshotOptions opts;
+    if (!parse_snapshot_options(argc, argv, opts)) {
+        print_snapshot_usage(argv[0]);
         return 1;
     }
 
-    std::cout << std::setw(10) << "TICKER" << " | " << std::setw(10) << "PRICE" << std::endl;
-    std::cout << "---------------------------" << std::endl;
+    redisContext *c = connect_to_redis(opts);
+    if (!c) return 1;
 
-    // 2. For each key, get the value
-    for (size_t i = 0; i < reply->elements; i++) {
-        std::string ticker = reply->element[i]->str;
-        redisReply *valReply = (redisReply *)redisCommand(c, "GET %s", ticker.c_str());
+    PriceCache cache;
 
-        if (valReply->type == REDIS_REPLY_STRING) {
-            std::cout << std::setw(10) << ticker << " | " << std::setw(10) << valReply->str << std::endl;
+    if (opts.once) {
+        bool ok = refresh(c, opts, cache);
+        redisFree(c);
+        if (!ok) return 1;
+
+        std::cout << std::setw(10) << "TICKER" << " | " << std::setw(10) << "PRICE" << std::endl;
+        std::cout << "---------------------------" << std::endl;
+        for (const auto& row : cache.rows()) {
+            std::cout << std::setw(10) << row.first << " | " << std::setw(10) << row.second << std::endl;
+        }
+        return 0;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    HttpServer server(opts.http_port, [&cache](const std::string& path, std::string& body, std::string& content_type) {
+        return handle_request(cache, path, body, content_type);
+    });
+    if (!server.start()) {
+        redisFree(c);
+        return 1;
+    }
+    std::cout << "Snapshot service on port " << opts.http_port << " (/snapshot, /price/<ticker>, /metrics), reading "
+              << (opts.source == SnapshotSource::Hash ? "hash " + opts.hash_key : "keys " + opts.match)
+              << " from " << opts.redis_host << ":" << opts.redis_port << std::endl;
+
+    while (run) {
+        if (!c) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            c = connect_to_redis(opts);
+            continue;
+        }
+        if (!refresh(c, opts, cache)) {
+            refresh_errors++;
+            redisFree(c);  // reconnect; the last good snapshot keeps being served
+            c = nullptr;
+            continue;
         }
-        freeReplyObject(valReply);
+        std::this_thread::sleep_for(std::chrono::milliseconds(opts.refresh_ms));
     }
 
-    freeReplyObject(reply);
-    redisFree(c);
+    server.stop();
+    if (c) redisFree(c);
     return 0;
 }
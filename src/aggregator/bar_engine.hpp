@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A finished OHLCV bar, fixed-size so it can travel through a BoundedRingBuffer.
+struct CompletedBar {
+    uint32_t symbol_id;
+    int32_t interval_s;
+    long long start_ns;
+    double open;
+    double high;
+    double low;
+    double close;
+    long long volume;
+    double vwap;
+    uint32_t trades;
+    int32_t partition;       // Kafka partition of the ticker
+    long long first_offset;  // Kafka offset of the bar's first tick
+};
+
+// --commit manual with bars in market_bars: the Kafka offset of the first
+// tick of every bar that is not in TimescaleDB yet, per partition. A bar is
+// added when it opens in a worker's BarEngine and removed once a writer has
+// written, spooled or dropped it. Commits of a partition are held at its
+// floor, so a restart replays every such bar from its first tick instead of
+// rebuilding it from the middle (which --db-idempotent would then keep as the
+// bar's first write). The cost is a replay of up to one bar interval.
+class BarFloors {
+public:
+    void open(int32_t partition, long long offset) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_[partition][offset]++;
+    }
+
+    void release(int32_t partition, long long offset) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto p = open_.find(partition);
+        if (p == open_.end()) return;
+        auto it = p->second.find(offset);
+        if (it == p->second.end()) return;
+        if (--it->second == 0) p->second.erase(it);
+    }
+
+    // Highest offset `partition` may be committed at; LLONG_MAX with no bar pending.
+    long long floor(int32_t partition) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto p = open_.find(partition);
+        return p == open_.end() || p->second.empty() ? LLONG_MAX : p->second.begin()->first;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::map<int32_t, std::map<long long, int>> open_;  // first offset -> bars
+};
+
+// Rolling-window OHLCV/VWAP engine keyed by interned symbol ID (SymbolTable).
+// State for every (symbol, interval) pair lives in one flat vector indexed by
+// symbol_id * num_intervals + interval, so a tick touches one contiguous run
+// of bars and no hashing happens per tick. Bars are bucketed by event time
+// (the tick's timestamp) and emitted when a tick for a later bucket arrives
+// or, for quiet tickers, when flush_expired() sees that the window has ended.
+//
+// Not thread-safe: each consumer worker owns one engine, which is correct
+// because a ticker only ever arrives on one partition.
+class BarEngine {
+public:
+    // `floors`, if given, learns of every bar as it opens.
+    explicit BarEngine(const std::vector<int> &intervals_s, BarFloors *floors = NULL)
+        : intervals_s_(intervals_s), floors_(floors) {
+        for (int s : intervals_s_) interval_ns_.push_back(static_cast<long long>(s) * 1000000000LL);
+    }
+
+    size_t num_intervals() const { return intervals_s_.size(); }
+
+    // `partition` and `offset` locate the tick's Kafka record.
+    void on_tick(uint32_t symbol_id, double price, long long volume, long long ts_ns, int32_t partition,
+                 long long offset, std::vector<CompletedBar> &out) {
+        if (symbol_id >= tracked_) {
+            tracked_ = symbol_id + 1;
+            bars_.resize(static_cast<size_t>(tracked_) * interval_ns_.size());
+        }
+        uint32_t slot = symbol_id;
+        Bar *row = &bars_[slot * interval_ns_.size()];
+
+        for (size_t k = 0; k < interval_ns_.size(); k++) {
+            Bar &bar = row[k];
+            long long start = ts_ns - ts_ns % interval_ns_[k];
+
+            if (bar.trades > 0 && start > bar.start_ns) {
+                emit(slot, k, bar, out);
+                bar.trades = 0;
+            }
+
+            if (bar.trades == 0) {
+                bar.start_ns = start;
+                bar.open = bar.high = bar.low = price;
+                bar.volume = 0;
+                bar.notional = 0.0;
+                bar.partition = partition;
+                bar.first_offset = offset;
+                if (floors_) floors_->open(partition, offset);
+            } else {
+                // Late ticks for an already-open bucket are folded into the open bar
+                bar.high = std::max(bar.high, price);
+                bar.low = std::min(bar.low, price);
+            }
+            bar.close = price;
+            bar.volume += volume;
+            bar.notional += price * static_cast<double>(volume);
+            bar.trades++;
+        }
+    }
+
+    // Emits every open bar whose window ended before `now_ns`.
+    void flush_expired(long long now_ns, std::vector<CompletedBar> &out) {
+        const size_t n = interval_ns_.size();
+        for (uint32_t slot = 0; slot < tracked_; slot++) {
+            for (size_t k = 0; k < n; k++) {
+                Bar &bar = bars_[slot * n + k];
+                if (bar.trades > 0 && bar.start_ns + interval_ns_[k] <= now_ns) {
+                    emit(slot, k, bar, out);
+                    bar.trades = 0;
+                }
+            }
+        }
+    }
+
+    // Emits every open bar regardless of its window (used on shutdown).
+    void flush_all(std::vector<CompletedBar> &out) {
+        const size_t n = interval_ns_.size();
+        for (uint32_t slot = 0; slot < tracked_; slot++) {
+            for (size_t k = 0; k < n; k++) {
+                Bar &bar = bars_[slot * n + k];
+                if (bar.trades > 0) {
+                    emit(slot, k, bar, out);
+                    bar.trades = 0;
+                }
+            }
+        }
+    }
+
+private:
+    struct Bar {
+        long long start_ns = 0;
+        double open = 0, high = 0, low = 0, close = 0;
+        long long volume = 0;
+        double notional = 0;
+        uint32_t trades = 0;
+        int32_t partition = 0;
+        long long first_offset = 0;
+    };
+
+    void emit(uint32_t slot, size_t k, const Bar &bar, std::vector<CompletedBar> &out) const {
+        CompletedBar done;
+        done.symbol_id = slot;
+        done.interval_s = intervals_s_[k];
+        done.start_ns = bar.start_ns;
+        done.open = bar.open;
+        done.high = bar.high;
+        done.low = bar.low;
+        done.close = bar.close;
+        done.volume = bar.volume;
+        done.vwap = bar.volume > 0 ? bar.notional / static_cast<double>(bar.volume) : bar.close;
+        done.trades = bar.trades;
+        done.partition = bar.partition;
+        done.first_offset = bar.first_offset;
+        out.push_back(done);
+    }
+
+    std::vector<int> intervals_s_;
+    BarFloors *floors_;
+    std::vector<long long> interval_ns_;
+    uint32_t tracked_ = 0;  // symbol IDs [0, tracked_) have rows in bars_
+    std::vector<Bar> bars_;
+};
+
+// Short label used in Redis keys, e.g. 1 -> "1s", 60 -> "1m", 3600 -> "1h".
+inline std::string bar_interval_label(int interval_s) {
+    if (interval_s % 3600 == 0) return std::to_string(interval_s / 3600) + "h";
+    if (interval_s % 60 == 0) return std::to_string(interval_s / 60) + "m";
+    return std::to_string(interval_s) + "s";
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Picks the DB batch size and how long the oldest queued row may wait,
+// replacing the fixed 5000 rows / 100 ms. Writer-thread only.
+//
+// Write time is modelled as overhead + cost_per_row * rows, fitted by an
+// exponentially weighted least-squares line over recent successful writes.
+// The arrival rate is an EWMA over >= 50 ms windows. For a target latency L
+// (time in the batch plus write time) the largest batch that still meets it
+// is rate * (L - overhead) / (1 + rate * cost_per_row). The writer also has
+// to keep up: each batch must take no longer than it took to fill, which
+// needs at least rate * overhead / (1 - rate * cost_per_row) rows. When the
+// two conflict, throughput wins, otherwise the queue would grow unbounded.
+//
+// At low rates the target drops to a few rows and they go out almost at
+// once; under a burst the backlog already exceeds the target and is written
+// in batches of up to max_rows.
+class BatchController {
+public:
+    BatchController(double target_latency_ns, size_t max_rows)
+        : target_ns_(target_latency_ns), max_rows_(max_rows) {}
+
+    // Rows taken from the queue; `now_ns` is monotonic.
+    void observe_arrivals(size_t rows, long long now_ns) {
+        if (window_start_ns_ == 0) window_start_ns_ = now_ns;
+        window_rows_ += rows;
+        long long elapsed = now_ns - window_start_ns_;
+        if (elapsed < 50000000LL) return;
+        double rate = window_rows_ / static_cast<double>(elapsed);
+        rate_ = have_rate_ ? 0.7 * rate_ + 0.3 * rate : rate;
+        have_rate_ = true;
+        window_rows_ = 0;
+        window_start_ns_ = now_ns;
+    }
+
+    // One successful write of `rows` rows that took `ns`.
+    void observe_write(size_t rows, long long ns) {
+        const double decay = 0.9;
+        double x = static_cast<double>(rows), y = static_cast<double>(ns);
+        w_ = w_ * decay + 1;
+        sx_ = sx_ * decay + x;
+        sy_ = sy_ * decay + y;
+        sxx_ = sxx_ * decay + x * x;
+        sxy_ = sxy_ * decay + x * y;
+
+        double mx = sx_ / w_, my = sy_ / w_;
+        double var = sxx_ / w_ - mx * mx;
+        double cov = sxy_ / w_ - mx * my;
+        if (var > 0.01 * mx * mx && cov > 0) {
+            cost_ns_ = cov / var;
+            overhead_ns_ = std::max(0.0, my - cost_ns_ * mx);
+        } else {
+            // Batch sizes too similar to separate the terms: keep the overhead
+            // and refit the slope
+            cost_ns_ = std::max(0.0, (my - overhead_ns_) / std::max(mx, 1.0));
+        }
+    }
+
+    size_t target_rows() const {
+        if (!have_rate_ || rate_ <= 0) return 1;
+        double n_latency = rate_ * (target_ns_ - overhead_ns_) / (1 + rate_ * cost_ns_);
+        double load = rate_ * cost_ns_;
+        double n_keep_up = load < 1 ? 1.25 * rate_ * overhead_ns_ / (1 - load) : static_cast<double>(max_rows_);
+        double n = std::max(n_latency, n_keep_up);
+        return static_cast<size_t>(std::min(std::max(n, 1.0), static_cast<double>(max_rows_)));
+    }
+
+    // How long the oldest row of a `rows`-row batch may wait before flushing.
+    long long linger_ns(size_t rows) const {
+        return static_cast<long long>(std::max(0.0, target_ns_ - predicted_write_ns(rows)));
+    }
+
+    double predicted_write_ns(size_t rows) const { return overhead_ns_ + cost_ns_ * rows; }
+    double rows_per_second() const { return rate_ * 1e9; }
+    double overhead_ns() const { return overhead_ns_; }
+    double cost_per_row_ns() const { return cost_ns_; }
+    size_t max_rows() const { return max_rows_; }
+
+private:
+    double target_ns_;
+    size_t max_rows_;
+
+    double rate_ = 0;  // rows per ns
+    bool have_rate_ = false;
+    long long window_start_ns_ = 0;
+    size_t window_rows_ = 0;
+
+    double overhead_ns_ = 0;
+    double cost_ns_ = 0;
+    double w_ = 0, sx_ = 0, sy_ = 0, sxx_ = 0, sxy_ = 0;
+};
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local write-ahead spool for one DB writer (--db-spool DIR). While
+// TimescaleDB is unreachable the writer appends its batches here instead of
+// retrying them, commits their Kafka offsets once they are synced to disk and
+// keeps consuming; a replayer thread copies them into the database when it is
+// back. Payloads are binary COPY streams as the writer would have sent them.
+//
+// The spool is a directory of fixed-size segments, <seq>.seg, each
+// preallocated and mmap'd, so an append is a memcpy and running out of disk
+// fails the append (the writer then falls back to retrying) instead of
+// faulting later. Layout:
+//   segment: 64-byte header (magic, layout, capacity, replay position), records
+//   record:  magic, kind, rows, size, checksum, then `size` payload bytes,
+//            padded to 8
+// Appends are only flushed to disk by sync(), which the writer batches
+// (--db-spool-sync-ms); a process crash loses nothing that was appended, a
+// host crash loses what was not synced, and those offsets were not committed.
+// On open, every segment is scanned from its replay position; the first
+// record whose checksum does not match ends it.
+//
+// A record the database rejects as invalid data is moved to DIR/quarantine,
+// which holds the same record layout back to back, so one bad batch cannot
+// hold up everything spooled after it.
+//
+// One thread appends and syncs, one other thread replays. The appender only
+// writes the newest segment, the replayer only deletes older, sealed ones.
+class DbSpool {
+public:
+    enum Kind : uint32_t { Ticks = 1, Bars = 2 };
+
+    // One record as the replayer sees it; `data` points into the mapping.
+    struct Record {
+        uint32_t kind;
+        uint32_t rows;
+        const char *data;
+        size_t size;
+        size_t span;  // header + payload + padding
+    };
+
+    // `layout` identifies the tick payload format (schema and idempotency);
+    // a spool written with another one is refused by open().
+    DbSpool(std::string dir, size_t segment_bytes, uint32_t layout)
+        : dir_(std::move(dir)), segment_bytes_(std::max(segment_bytes, static_cast<size_t>(1) << 20)),
+          layout_(layout) {}
+
+    ~DbSpool() {
+        for (auto &s : segments_) unmap(*s);
+        if (quarantine_fd_ >= 0) close(quarantine_fd_);
+    }
+
+    DbSpool(const DbSpool &) = delete;
+    DbSpool &operator=(const DbSpool &) = delete;
+
+    // Creates the directory or recovers the segments left in it.
+    bool open() {
+        std::error_code ec;
+        std::filesystem::create_directories(dir_, ec);
+        if (ec) {
+            std::cerr << "Cannot create spool directory " << dir_ << ": " << ec.message() << std::endl;
+            return false;
+        }
+        std::vector<std::pair<uint64_t, std::string>> files;
+        for (const auto &entry : std::filesystem::directory_iterator(dir_, ec)) {
+            std::string name = entry.path().filename().string();
+            if (entry.path().extension() != ".seg") continue;
+            files.emplace_back(std::strtoull(name.c_str(), NULL, 10), entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+        for (const auto &f : files) {
+            std::unique_ptr<Segment> s(new Segment);
+            s->seq = f.first;
+            s->path = f.second;
+            if (!recover(*s)) return false;
+            next_seq_ = s->seq + 1;
+            if (s->read == s->end.load()) {
+                remove(*s);
+                continue;
+            }
+            pending_bytes_ += s->end.load() - s->read;
+            segments_.push_back(std::move(s));
+        }
+        if (!segments_.empty()) {
+            std::cout << "Spool " << dir_ << ": " << pending_bytes_.load() << " bytes in " << segments_.size()
+                      << " segment(s) to replay" << std::endl;
+        }
+        return true;
+    }
+
+    struct Entry {
+        Kind kind;
+        uint32_t rows;
+        const char *data;
+        size_t size;
+    };
+
+    // Appender: stores all `n` entries in one segment, or none of them if
+    // there is no room (disk full, I/O error) and returns false.
+    bool append(const Entry *entries, size_t n) {
+        size_t span = 0;
+        for (size_t i = 0; i < n; i++) span += RECORD_HEADER + pad(entries[i].size);
+        Segment *s = active_;
+        if (!s || s->capacity - s->end.load(std::memory_order_relaxed) < span) {
+            s = roll(span);
+            if (!s) return false;
+        }
+        size_t at = s->end.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            const Entry &e = entries[i];
+            char *p = s->base + at;
+            std::memcpy(p + RECORD_HEADER, e.data, e.size);
+            RecordHeader h = {RECORD_MAGIC, e.kind, e.rows, static_cast<uint32_t>(e.size), checksum(e.data, e.size)};
+            std::memcpy(p, &h, sizeof(h));
+            at += RECORD_HEADER + pad(e.size);
+            spooled_rows_ += e.rows;
+        }
+        s->end.store(at, std::memory_order_release);
+        pending_bytes_ += span;
+        return true;
+    }
+
+    // Appender: appended but not yet synced.
+    bool dirty() const { return active_ && active_->synced < active_->end.load(std::memory_order_relaxed); }
+
+    // Appender: flushes everything appended so far to disk.
+    bool sync() {
+        if (!dirty()) return true;
+        return sync_segment(*active_);
+    }
+
+    // Replayer: up to `max_bytes` of consecutive records of one kind (at least
+    // one), oldest first. Empty when everything appended has been replayed.
+    void peek(std::vector<Record> &out, size_t max_bytes) {
+        out.clear();
+        Segment *s = front();
+        if (!s) return;
+        size_t at = s->read, end = s->end.load(std::memory_order_acquire), bytes = 0;
+        while (at < end) {
+            RecordHeader h;
+            std::memcpy(&h, s->base + at, sizeof(h));
+            if (!out.empty() && (h.kind != out.front().kind || bytes + h.size > max_bytes)) break;
+            size_t span = RECORD_HEADER + pad(h.size);
+            out.push_back({h.kind, h.rows, s->base + at + RECORD_HEADER, h.size, span});
+            bytes += h.size;
+            at += span;
+        }
+    }
+
+    // Replayer: the records from the last peek() are in the database.
+    void consume(const std::vector<Record> &records) {
+        replayed_rows_ += advance(records.data(), records.size());
+    }
+
+    // Replayer: appends `r`, the oldest pending record, to DIR/quarantine,
+    // syncs it and consumes it. False if it could not be stored; the record
+    // then stays where it is.
+    bool quarantine(const Record &r) {
+        if (quarantine_fd_ < 0) {
+            std::string path = dir_ + "/quarantine";
+            quarantine_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (quarantine_fd_ < 0) {
+                std::cerr << "Cannot open " << path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        const char *p = r.data - RECORD_HEADER;
+        size_t done = 0;
+        while (done < r.span) {
+            ssize_t n = write(quarantine_fd_, p + done, r.span - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "Cannot write " << dir_ << "/quarantine: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        if (fdatasync(quarantine_fd_) != 0) {
+            std::cerr << "Cannot sync " << dir_ << "/quarantine: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        quarantined_rows_ += advance(&r, 1);
+        return true;
+    }
+
+    // Appended and not yet replayed; 0 once the replayer has caught up.
+    size_t pending_bytes() const { return pending_bytes_.load(); }
+    long long spooled_rows() const { return spooled_rows_.load(); }
+    long long replayed_rows() const { return replayed_rows_.load(); }
+    long long quarantined_rows() const { return quarantined_rows_.load(); }
+    const std::string &dir() const { return dir_; }
+
+private:
+    static constexpr char SEGMENT_MAGIC[8] = {'T', 'I', 'C', 'K', 'S', 'P', 'L', '1'};
+    static constexpr uint32_t RECORD_MAGIC = 0x52505354;  // "TSPR"
+    static constexpr size_t SEGMENT_HEADER = 64;
+    static constexpr size_t READ_OFFSET_AT = 24;
+    static constexpr size_t RECORD_HEADER = 24;
+
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t kind;
+        uint32_t rows;
+        uint32_t size;
+        uint64_t checksum;
+    };
+    static_assert(sizeof(RecordHeader) == RECORD_HEADER, "record header layout");
+
+    struct Segment {
+        uint64_t seq = 0;
+        std::string path;
+        int fd = -1;
+        char *base = NULL;
+        size_t capacity = 0;
+        size_t read = 0;                // replayer
+        size_t synced = SEGMENT_HEADER;  // appender
+        std::atomic<size_t> end{SEGMENT_HEADER};
+        std::atomic<bool> sealed{false};  // no more appends; may be deleted once read
+    };
+
+    static size_t pad(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+    // FNV-1a over 8-byte words: detects torn or stale tails, not tampering
+    static uint64_t checksum(const char *data, size_t size) {
+        uint64_t h = 14695981039346656037ULL;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t w;
+            std::memcpy(&w, data + i, 8);
+            h = (h ^ w) * 1099511628211ULL;
+        }
+        for (; i < size; i++) h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+        return h;
+    }
+
+    // Moves the replay position past `n` records from the front; their rows.
+    long long advance(const Record *records, size_t n) {
+        Segment *s = front();
+        if (!s) return 0;
+        size_t bytes = 0;
+        long long rows = 0;
+        for (size_t i = 0; i < n; i++) {
+            bytes += records[i].span;
+            rows += records[i].rows;
+        }
+        s->read += bytes;
+        std::memcpy(s->base + READ_OFFSET_AT, &s->read, sizeof(uint64_t));
+        pending_bytes_ -= bytes;
+        return rows;
+    }
+
+    // Oldest segment that may still hold unread records; finished, sealed
+    // segments are deleted on the way.
+    Segment *front() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!segments_.empty()) {
+            Segment &s = *segments_.front();
+            bool sealed = s.sealed.load(std::memory_order_acquire);
+            if (!sealed || s.read < s.end.load(std::memory_order_acquire)) return &s;
+            remove(s);
+            segments_.pop_front();
+        }
+        return NULL;
+    }
+
+    // Seals the active segment and starts one with room for `span` bytes.
+    Segment *roll(size_t span) {
+        if (active_) {
+            if (!sync_segment(*active_)) return NULL;
+            active_->sealed.store(true, std::memory_order_release);
+            active_ = NULL;
+        }
+        std::unique_ptr<Segment> s(new Segment);
+        s->seq = next_seq_++;
+        char name[32];
+        snprintf(name, sizeof(name), "%016llu.seg", static_cast<unsigned long long>(s->seq));
+        s->path = dir_ + "/" + name;
+        s->capacity = std::max(segment_bytes_, SEGMENT_HEADER + span);
+        s->fd = ::open(s->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        int err = s->fd < 0 ? errno : posix_fallocate(s->fd, 0, static_cast<off_t>(s->capacity));
+        if (err == 0 && !map(*s)) err = errno;
+        if (err != 0) {
+            std::cerr << "Cannot create spool segment " << s->path << ": " << std::strerror(err) << std::endl;
+            if (s->fd >= 0) {
+                close(s->fd);
+                unlink(s->path.c_str());
+            }
+            return NULL;
+        }
+        std::memcpy(s->base, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+        uint64_t capacity = s->capacity, read = SEGMENT_HEADER;
+        std::memcpy(s->base + 8, &layout_, sizeof(layout_));
+        std::memcpy(s->base + 16, &capacity, sizeof(capacity));
+        std::memcpy(s->base + READ_OFFSET_AT, &read, sizeof(read));
+        s->read = SEGMENT_HEADER;
+        s->synced = 0;  // the header goes out with the first sync
+        sync_dir();
+        Segment *raw = s.get();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            segments_.push_back(std::move(s));
+        }
+        active_ = raw;
+        return raw;
+    }
+
+    bool sync_segment(Segment &s) {
+        size_t end = s.end.load(std::memory_order_relaxed);
+        size_t from = s.synced & ~static_cast<size_t>(sysconf(_SC_PAGESIZE) - 1);
+        if (msync(s.base + from, end - from, MS_SYNC) != 0) {
+            std::cerr << "Spool sync failed for " << s.path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        s.synced = end;
+        return true;
+    }
+
+    bool map(Segment &s) {
+        void *p = mmap(NULL, s.capacity, PROT_READ | PROT_WRITE, MAP_SHARED, s.fd, 0);
+        if (p == MAP_FAILED) return false;
+        s.base = static_cast<char *>(p);
+        return true;
+    }
+
+    // Maps an existing segment and finds the end of its valid records.
+    bool recover(Segment &s) {
+        s.fd = ::open(s.path.c_str(), O_RDWR);
+        struct stat st;
+        if (s.fd < 0 || fstat(s.fd, &st) != 0 || static_cast<size_t>(st.st_size) < SEGMENT_HEADER) {
+            std::cerr << "Cannot open spool segment " << s.path << std::endl;
+            return false;
+        }
+        s.capacity = static_cast<size_t>(st.st_size);
+        if (!map(s)) {
+            std::cerr << "Cannot map spool segment " << s.path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        uint32_t layout;
+        uint64_t read;
+        std::memcpy(&layout, s.base + 8, sizeof(layout));
+        std::memcpy(&read, s.base + READ_OFFSET_AT, sizeof(read));
+        if (std::memcmp(s.base, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 || read < SEGMENT_HEADER ||
+            read > s.capacity) {
+            std::cerr << "Spool segment " << s.path << " is not a spool file" << std::endl;
+            return false;
+        }
+        if (layout != layout_) {
+            std::cerr << "Spool segment " << s.path << " was written with another --db-schema or "
+                      << "--db-idempotent setting; replay it with those or remove it" << std::endl;
+            return false;
+        }
+        size_t at = read;
+        while (at + RECORD_HEADER <= s.capacity) {
+            RecordHeader h;
+            std::memcpy(&h, s.base + at, sizeof(h));
+            size_t span = RECORD_HEADER + pad(h.size);
+            if (h.magic != RECORD_MAGIC || span > s.capacity - at ||
+                checksum(s.base + at + RECORD_HEADER, h.size) != h.checksum) {
+                break;
+            }
+            at += span;
+        }
+        s.read = read;
+        s.end.store(at);
+        s.synced = at;
+        s.sealed.store(true);
+        return true;
+    }
+
+    void unmap(Segment &s) {
+        if (s.base) munmap(s.base, s.capacity);
+        if (s.fd >= 0) close(s.fd);
+        s.base = NULL;
+        s.fd = -1;
+    }
+
+    void remove(Segment &s) {
+        unmap(s);
+        unlink(s.path.c_str());
+    }
+
+    // A new segment's directory entry has to survive a crash too
+    void sync_dir() {
+        int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return;
+        fsync(fd);
+        close(fd);
+    }
+
+    std::string dir_;
+    size_t segment_bytes_;
+    uint32_t layout_;
+    uint64_t next_seq_ = 0;
+    Segment *active_ = NULL;  // appender only
+    std::mutex mutex_;        // segments_ membership
+    std::deque<std::unique_ptr<Segment>> segments_;
+    std::atomic<size_t> pending_bytes_{0};
+    std::atomic<long long> spooled_rows_{0};
+    std::atomic<long long> replayed_rows_{0};
+    std::atomic<long long> quarantined_rows_{0};
+    int quarantine_fd_ = -1;  // replayer only
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <libpq-fe.h>
+#include "aggregator/pg_error.hpp"
+#include "common/symbol_table.hpp"
+
+// Maps this process's SymbolTable IDs to the symbols.id keys of
+// --db-schema compact. Those are assigned by the database, so they stay stable
+// across restarts and between aggregators, unlike local interning order.
+//
+// Lookups are one atomic load per row. Writers call resolve() on a batch
+// first; tickers seen for the first time are registered together with one
+// statement on a connection of its own, under a mutex, so the writer
+// connections (possibly in pipeline mode) never wait on it.
+class DbSymbolIds {
+public:
+    // Takes ownership of `conn`.
+    DbSymbolIds(PGconn *conn, const SymbolTable &symbols)
+        : conn_(conn), symbols_(symbols), ids_(new std::atomic<int32_t>[symbols.capacity()]) {
+        for (uint32_t i = 0; i < symbols.capacity(); i++) ids_[i].store(-1, std::memory_order_relaxed);
+    }
+    ~DbSymbolIds() { PQfinish(conn_); }
+
+    DbSymbolIds(const DbSymbolIds &) = delete;
+    DbSymbolIds &operator=(const DbSymbolIds &) = delete;
+
+    // Registers everything interned so far, e.g. a --symbols dictionary.
+    bool preload() {
+        std::vector<uint32_t> all;
+        for (uint32_t id = 0; id < symbols_.size(); id++) all.push_back(id);
+        return all.empty() || register_ids(all);
+    }
+
+    // Makes sure every row's symbol has a DB ID. `Rows` holds items with a
+    // symbol_id; SymbolTable::INVALID entries are skipped. False when the
+    // database could not be reached or rejected a ticker (see pg_error.hpp).
+    template <typename Rows>
+    bool resolve(const Rows &rows) {
+        std::vector<uint32_t> missing;  // empty, so no allocation, once the universe is known
+        for (const auto &row : rows) {
+            uint32_t id = row.symbol_id;
+            if (id == SymbolTable::INVALID || get(id) >= 0) continue;
+            if (std::find(missing.begin(), missing.end(), id) == missing.end()) missing.push_back(id);
+        }
+        return missing.empty() || register_ids(missing);
+    }
+
+    // -1 until resolve() has seen the symbol.
+    int32_t get(uint32_t local_id) const { return ids_[local_id].load(std::memory_order_acquire); }
+
+private:
+    bool register_ids(const std::vector<uint32_t> &local_ids) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Text array literal; tickers are quoted with " and \ escaped
+        std::string names = "{";
+        for (size_t i = 0; i < local_ids.size(); i++) {
+            if (i > 0) names += ',';
+            names += '"';
+            for (char c : symbols_.name(local_ids[i])) {
+                if (c == '"' || c == '\\') names += '\\';
+                names += c;
+            }
+            names += '"';
+        }
+        names += '}';
+
+        // New tickers come back from the INSERT, existing ones from the join
+        // (both see the same snapshot, so no row is reported twice)
+        static const char *sql =
+            "WITH input AS (SELECT DISTINCT unnest($1::text[]) AS ticker), "
+            "added AS (INSERT INTO symbols (ticker) SELECT ticker FROM input ON CONFLICT (ticker) DO NOTHING "
+            "RETURNING id, ticker) "
+            "SELECT id, ticker FROM added UNION ALL SELECT s.id, s.ticker FROM symbols s JOIN input USING (ticker)";
+        const char *values[1] = {names.c_str()};
+        PGresult *res = PQexecParams(conn_, sql, 1, NULL, values, NULL, NULL, 0);
+        bool ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+        if (!ok) {
+            std::cerr << "Registering symbols failed: " << PQerrorMessage(conn_) << std::endl;
+            pg_note_failure(res);
+        } else {
+            for (int r = 0; r < PQntuples(res); r++) {
+                uint32_t local = symbols_.find(PQgetvalue(res, r, 1));
+                if (local != SymbolTable::INVALID) {
+                    ids_[local].store(std::atoi(PQgetvalue(res, r, 0)), std::memory_order_release);
+                }
+            }
+        }
+        PQclear(res);
+        if (!ok && PQstatus(conn_) == CONNECTION_BAD) PQreset(conn_);
+
+        // A ticker inserted concurrently by another aggregator is in neither
+        // half of the result; the retry picks it up
+        for (uint32_t id : local_ids) {
+            if (get(id) >= 0) continue;
+            if (ok) pg_note_failure(NULL);
+            return false;
+        }
+        return ok;
+    }
+
+    PGconn *conn_;
+    const SymbolTable &symbols_;
+    std::unique_ptr<std::atomic<int32_t>[]> ids_;
+    std::mutex mutex_;
+};
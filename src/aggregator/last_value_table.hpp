@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "aggregator/bar_engine.hpp"
+#include "aggregator/options.hpp"
+#include "common/resp_writer.hpp"
+#include "common/symbol_table.hpp"
+
+// Latest value of one symbol, as handed to a flush.
+struct LastValue {
+    uint32_t symbol_id;
+    double price;
+    long long timestamp_ns;    // event time of the tick
+    long long dirty_since_ns;  // monotonic time of the first update since the previous flush
+};
+
+// Last-value coalescing table indexed by SymbolTable ID. Workers overwrite a
+// symbol's slot on every tick and set its bit in a dirty bitmap; a flusher
+// periodically swaps the bitmap words to zero and writes only symbols that
+// changed, so a ticker updated 2,500 times between flushes costs one key.
+//
+// Any number of writers and flushers may run concurrently. A flusher can see
+// a price newer than the bit it cleared; the symbol is then simply flushed
+// again next round with the same value. Price and timestamp are separate
+// words, so a reader may pair a price with its neighbour tick's timestamp.
+class LastValueTable {
+public:
+    explicit LastValueTable(uint32_t capacity)
+        : capacity_(capacity), words_((capacity + 63) / 64),
+          slots_(new Slot[capacity]), dirty_(new std::atomic<uint64_t>[words_]) {
+        for (size_t i = 0; i < words_; i++) dirty_[i].store(0, std::memory_order_relaxed);
+    }
+
+    LastValueTable(const LastValueTable &) = delete;
+    LastValueTable &operator=(const LastValueTable &) = delete;
+
+    void set(uint32_t id, double price, long long timestamp_ns, long long now_ns) {
+        Slot &slot = slots_[id];
+        slot.price.store(price, std::memory_order_relaxed);
+        slot.timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+
+        const uint64_t bit = 1ULL << (id & 63);
+        std::atomic<uint64_t> &word = dirty_[id >> 6];
+        // The first update of a cycle stamps dirty_since_ns before publishing
+        // the bit, so a flusher that clears it reads this cycle's time rather
+        // than the previous one's. If a flush clears the bit between the check
+        // and the RMW, the stamp follows the RMW instead.
+        const bool stamped = (word.load(std::memory_order_relaxed) & bit) == 0;
+        if (stamped) slot.dirty_since_ns.store(now_ns, std::memory_order_relaxed);
+        // Always RMW: the release orders the stores above before the bit, so a
+        // flusher that clears it cannot miss this tick's price
+        if ((word.fetch_or(bit, std::memory_order_release) & bit) == 0 && !stamped) {
+            slot.dirty_since_ns.store(now_ns, std::memory_order_relaxed);
+        }
+    }
+
+    // Appends every symbol updated since the previous drain and clears its bit.
+    size_t drain(std::vector<LastValue> &out) {
+        size_t before = out.size();
+        for (size_t w = 0; w < words_; w++) {
+            if (dirty_[w].load(std::memory_order_relaxed) == 0) continue;
+            uint64_t bits = dirty_[w].exchange(0, std::memory_order_acquire);
+            while (bits) {
+                uint32_t id = static_cast<uint32_t>(w * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+                const Slot &slot = slots_[id];
+                LastValue v;
+                v.symbol_id = id;
+                v.price = slot.price.load(std::memory_order_relaxed);
+                v.timestamp_ns = slot.timestamp_ns.load(std::memory_order_relaxed);
+                v.dirty_since_ns = slot.dirty_since_ns.load(std::memory_order_relaxed);
+                out.push_back(v);
+            }
+        }
+        size_t n = out.size() - before;
+        if (n > 0) {
+            flushes_.fetch_add(1, std::memory_order_relaxed);
+            flushed_keys_.fetch_add(n, std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    uint32_t capacity() const { return capacity_; }
+    long long flushes() const { return flushes_.load(std::memory_order_relaxed); }
+    long long flushed_keys() const { return flushed_keys_.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(32) Slot {
+        std::atomic<double> price{0.0};
+        std::atomic<long long> timestamp_ns{0};
+        std::atomic<long long> dirty_since_ns{0};
+    };
+
+    uint32_t capacity_;
+    size_t words_;
+    std::unique_ptr<Slot[]> slots_;
+    std::unique_ptr<std::atomic<uint64_t>[]> dirty_;
+    std::atomic<long long> flushes_{0};
+    std::atomic<long long> flushed_keys_{0};
+};
+
+// Where a coalesced flush goes besides the plain MSET.
+struct PriceOutputs {
+    std::string price_hash;  // HSET target for snapshot readers, empty = skip
+    PublishMode publish = PublishMode::Off;
+    std::string publish_prefix;
+    long long stream_maxlen = 0;
+};
+
+// Builds the commands for one coalesced flush of values[first, first + count)
+// and hands each to `send(RespWriter&)`; the caller pipelines them all:
+//   MSET ticker price [ticker price ...]             plain keys for GET
+//   HSET <price_hash> ticker price [...]             one hash for snapshot readers
+//   XADD <prefix>ticker MAXLEN ~ N * price P ts T    per ticker, --publish stream
+//   PUBLISH <prefix>ticker "P T"                     per ticker, --publish pubsub
+template <typename Send>
+void build_price_commands(RespWriter &args, const std::vector<LastValue> &values, size_t first, size_t count,
+                          const SymbolTable &symbols, const PriceOutputs &outputs, Send &&send) {
+    args.reset("MSET");
+    for (size_t i = first; i < first + count; i++) {
+        args.add(symbols.name(values[i].symbol_id));
+        args.add(values[i].price);
+    }
+    send(args);
+
+    if (!outputs.price_hash.empty()) {
+        args.reset("HSET");
+        args.add(outputs.price_hash);
+        for (size_t i = first; i < first + count; i++) {
+            args.add(symbols.name(values[i].symbol_id));
+            args.add(values[i].price);
+        }
+        send(args);
+    }
+
+    if (outputs.publish == PublishMode::Off) return;
+    std::string key = outputs.publish_prefix;
+    const size_t prefix_len = key.size();
+    char message[64];
+    for (size_t i = first; i < first + count; i++) {
+        const LastValue &v = values[i];
+        std::string_view ticker = symbols.name(v.symbol_id);
+        key.resize(prefix_len);
+        key.append(ticker.data(), ticker.size());
+
+        if (outputs.publish == PublishMode::Stream) {
+            args.reset("XADD");
+            args.add(key);
+            args.add("MAXLEN");
+            args.add("~");
+            args.add(outputs.stream_maxlen);
+            args.add("*");
+            args.add("price");
+            args.add(v.price);
+            args.add("ts");
+            args.add(v.timestamp_ns);
+        } else {
+            size_t n = format_double(v.price, message);
+            message[n++] = ' ';
+            n = static_cast<size_t>(std::to_chars(message + n, message + sizeof(message), v.timestamp_ns).ptr - message);
+            args.reset("PUBLISH");
+            args.add(key);
+            args.add(std::string_view(message, n));
+        }
+        send(args);
+    }
+}
+
+// One finished bar as HSET bar:<label>:<ticker> time .. open .. high .. low ..
+// close .. volume .. vwap .. trades ..; `key` is scratch for the key.
+inline void build_bar_command(RespWriter &args, std::string &key, const CompletedBar &bar, std::string_view ticker) {
+    key = "bar:";
+    key += bar_interval_label(bar.interval_s);
+    key += ':';
+    key.append(ticker.data(), ticker.size());
+    args.reset("HSET");
+    args.add(key);
+    args.add("time");
+    args.add(static_cast<long long>(bar.start_ns / 1000000));
+    args.add("open");
+    args.add(bar.open);
+    args.add("high");
+    args.add(bar.high);
+    args.add("low");
+    args.add(bar.low);
+    args.add("close");
+    args.add(bar.close);
+    args.add("volume");
+    args.add(static_cast<long long>(bar.volume));
+    args.add("vwap");
+    args.add(bar.vwap);
+    args.add("trades");
+    args.add(static_cast<long long>(bar.trades));
+}
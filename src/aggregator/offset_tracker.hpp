@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <librdkafka/rdkafka.h>
+#include "aggregator/bar_engine.hpp"
+
+// Kafka positions whose rows are durable in TimescaleDB, owned by the batch
+// writer in --commit manual mode. The writer notes the next offset to read
+// for every record whose last row went into a batch and, once the batch is
+// written, commits all of them with one request. Rows of one partition come
+// from one worker and are routed to one writer's queue in order, so the
+// highest noted offset per partition covers everything before it, and
+// writers never commit each other's partitions. With `floors`, a partition
+// is committed at most up to its oldest unwritten bar and stays pending
+// until that bar is in.
+class OffsetTracker {
+public:
+    OffsetTracker(std::string topic, const BarFloors *floors) : topic_(std::move(topic)), floors_(floors) {}
+
+    void note(int32_t partition, long long next_offset) {
+        long long &pending = pending_[partition];
+        if (next_offset > pending) pending = next_offset;
+    }
+
+    // Commits the partitions noted since the last call as one asynchronous
+    // request; the result arrives in the consumer's offset_commit_cb.
+    // RD_KAFKA_RESP_ERR__NO_OFFSET when nothing was noted.
+    rd_kafka_resp_err_t commit_pending(rd_kafka_t *rk) {
+        if (pending_.empty()) return RD_KAFKA_RESP_ERR__NO_OFFSET;
+        if (!floors_) {
+            for (const auto &kv : pending_) latest_[kv.first] = kv.second;
+            rd_kafka_resp_err_t err = commit(rk, pending_, true);
+            pending_.clear();
+            return err;
+        }
+        std::map<int32_t, long long> ready;
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            long long offset = std::min(it->second, floors_->floor(it->first));
+            auto latest = latest_.find(it->first);
+            if (latest == latest_.end() || offset > latest->second) ready[it->first] = offset;
+            it = offset == it->second ? pending_.erase(it) : std::next(it);
+        }
+        if (ready.empty()) return RD_KAFKA_RESP_ERR__NO_OFFSET;
+        for (const auto &kv : ready) latest_[kv.first] = kv.second;
+        return commit(rk, ready, true);
+    }
+
+    // Noted offsets not committed yet, e.g. held back by a bar.
+    bool has_pending() const { return !pending_.empty(); }
+
+    // Shutdown: commits every partition's latest position and waits for the
+    // broker, so a clean stop leaves nothing to replay.
+    rd_kafka_resp_err_t commit_all_sync(rd_kafka_t *rk) {
+        for (const auto &kv : pending_) {
+            long long offset = floors_ ? std::min(kv.second, floors_->floor(kv.first)) : kv.second;
+            if (latest_.find(kv.first) == latest_.end() || offset > latest_[kv.first]) latest_[kv.first] = offset;
+        }
+        pending_.clear();
+        if (latest_.empty()) return RD_KAFKA_RESP_ERR__NO_OFFSET;
+        return commit(rk, latest_, false);
+    }
+
+private:
+    rd_kafka_resp_err_t commit(rd_kafka_t *rk, const std::map<int32_t, long long> &offsets, bool async) {
+        rd_kafka_topic_partition_list_t *list = rd_kafka_topic_partition_list_new(static_cast<int>(offsets.size()));
+        for (const auto &kv : offsets) {
+            rd_kafka_topic_partition_list_add(list, topic_.c_str(), kv.first)->offset = kv.second;
+        }
+        rd_kafka_resp_err_t err = rd_kafka_commit(rk, list, async ? 1 : 0);
+        rd_kafka_topic_partition_list_destroy(list);
+        return err;
+    }
+
+    std::string topic_;
+    const BarFloors *floors_;
+    std::map<int32_t, long long> pending_;  // noted since the last commit
+    std::map<int32_t, long long> latest_;   // last committed per partition
+};
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "common/kafka_config.hpp"
+#include "common/parse_number.hpp"
+#include "common/thread_placement.hpp"
+
+enum class DbSinkMode {
+    Copy,    // COPY ... FROM STDIN (FORMAT binary)
+    Insert,  // multi-row text INSERT (legacy)
+    Pipeline,  // prepared unnest() INSERTs in libpq pipeline mode, several batches in flight
+};
+
+enum class DbSchema {
+    Rows,     // market_updates with TEXT ticker and latency_ms; bars written to market_bars
+    Compact,  // market_ticks keyed by symbols.id, compressed; bars are continuous aggregates
+};
+
+enum class OverloadPolicy {
+    Block,      // pause Kafka partitions whose downstream queues are over budget; nothing is lost
+    RedisOnly,  // keep consuming, drop DB rows that find their queue full
+};
+
+enum class DecoderMode {
+    Wire,      // hand-written reader over the Kafka payload
+    Protobuf,  // MarketUpdate::ParseFromArray
+};
+
+enum class PayloadFormat {
+    Auto,      // per message: packed if the first byte is 0x00, else protobuf
+    Protobuf,  // MarketUpdate, or MarketUpdateBatch told apart by its first tag
+    Packed,    // 32-byte fixed layout (common/packed_format.hpp)
+};
+
+enum class CommitMode {
+    Manual,  // commit offsets after the covering DB batch is written (at-least-once)
+    Auto,    // enable.auto.commit, whether or not rows reached the DB
+};
+
+enum class RedisMode {
+    Async,  // dedicated RedisAsyncSink thread fed from a queue
+    Sync,   // per-worker pipeline drained with redisGetReply every 100 commands
+};
+
+enum class PublishMode {
+    Off,
+    Stream,  // XADD <prefix><ticker> MAXLEN ~ N * price .. ts ..
+    PubSub,  // PUBLISH <prefix><ticker> "<price> <timestamp_ns>"
+};
+
+struct AggregatorOptions {
+    std::string brokers;
+    std::string redis_host;
+    DbSinkMode db_sink = DbSinkMode::Copy;
+    size_t queue_capacity = 1 << 18;
+    int workers = 1;
+    std::vector<int> bar_intervals = {1, 60, 300};
+    bool store_ticks = true;
+    int metrics_port = 9101;
+    DecoderMode decoder = DecoderMode::Wire;
+    PayloadFormat format = PayloadFormat::Auto;
+    std::string symbols_source;  // file path or redis://host[:port]/key
+    uint32_t max_symbols = 1 << 16;
+    RedisMode redis_mode = RedisMode::Async;
+    size_t redis_max_inflight_bytes = 1 << 20;
+    size_t redis_queue_capacity = 1 << 16;
+    long long redis_coalesce_us = 1000;  // 0 sends one SET per tick
+    std::string price_hash = "prices";   // coalesced prices are mirrored here, "" disables
+    PublishMode publish = PublishMode::Off;
+    std::string publish_prefix = "ticks:";
+    long long stream_maxlen = 10000;
+    CommitMode commit = CommitMode::Manual;
+    bool db_idempotent = false;  // staging table + ON CONFLICT DO NOTHING on Kafka coordinates
+    double db_target_latency_ms = 50;  // queue wait + write time the batch controller aims for
+    size_t db_max_batch = 20000;
+    int db_writers = 1;  // TimescaleDB connections, each owning the partitions p % N == i
+    size_t db_pipeline_depth = 4;  // --db-sink pipeline: batches sent and not yet acknowledged
+    DbSchema db_schema = DbSchema::Rows;
+    int db_retention_days = -1;  // raw ticks; -1 leaves the current policy alone, 0 removes it
+    std::string db_spool_dir;  // local write-ahead spool for DB outages, "" disables
+    size_t db_spool_segment_mb = 64;
+    long long db_spool_sync_ms = 10;  // longest a spooled batch's offsets wait for the fsync
+    OverloadPolicy overload = OverloadPolicy::Block;
+    int pause_high_pct = 80;  // queue fill that pauses a partition...
+    int pause_low_pct = 50;   // ...and the fill it has to drain below before resuming
+    int fetch_buffer_kb = 0;  // queued.max.messages.kbytes, 0 keeps the librdkafka default
+    size_t poll_batch = 1;  // messages taken from the consumer queue per wakeup
+    KafkaProperties kafka_config;  // --kafka-config KEY=VALUE, repeatable
+    bool busy_poll = false;  // consumers spin on zero-timeout polls instead of blocking
+    bool clock_sync = false;  // probe producer clocks over clock-sync and correct latencies
+    // --cpus ROLE=LIST, repeatable: consumer threads, DB writers then spool
+    // replayers, the async Redis sink, and stats/metrics
+    ThreadPlacement placement{{"consumer", "db", "redis", "other"}};
+};
+
+// Parses "1s,1m,5m" (s/m/h suffixes, bare numbers are seconds) or "none".
+inline bool parse_bar_intervals(const std::string &spec, std::vector<int> &out) {
+    out.clear();
+    if (spec == "none") return true;
+
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        if (item.empty()) return false;
+
+        int scale = 1;
+        char unit = item.back();
+        if (unit == 's' || unit == 'm' || unit == 'h') {
+            scale = (unit == 'h') ? 3600 : (unit == 'm') ? 60 : 1;
+            item.pop_back();
+        }
+        int count = 0;
+        if (!parse_number(item, count) || count <= 0 || count > INT_MAX / scale) return false;
+        out.push_back(count * scale);
+        pos = end + 1;
+    }
+    return true;
+}
+
+inline void print_aggregator_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " <kafka_broker> <redis_host> [options]" << std::endl;
+    std::cerr << "Example: " << prog << " localhost:9092 localhost" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --db-sink copy|insert|pipeline  TimescaleDB write path (default: copy)" << std::endl;
+    std::cerr << "  --db-pipeline-depth N   Batches in flight per connection with --db-sink pipeline (default: 4)" << std::endl;
+    std::cerr << "  --db-schema rows|compact  Tick table layout; compact stores symbol IDs in a compressed" << std::endl;
+    std::cerr << "                          hypertable and derives bars in the database (default: rows)" << std::endl;
+    std::cerr << "  --db-retention-days N|off  Drop raw ticks older than N days (default: keep the current policy)" << std::endl;
+    std::cerr << "  --workers N             Partition-affine consumer threads (default: 1)" << std::endl;
+    std::cerr << "  --bar-intervals LIST    OHLCV bar intervals, e.g. 1s,1m,5m or none (default: 1s,1m,5m)" << std::endl;
+    std::cerr << "  --store-ticks on|off    Also write every raw tick to market_updates (default: on)" << std::endl;
+    std::cerr << "  --metrics-port N        Prometheus /metrics port, 0 disables (default: 9101)" << std::endl;
+    std::cerr << "  --decoder wire|protobuf MarketUpdate decode path (default: wire)" << std::endl;
+    std::cerr << "  --format auto|protobuf|packed  Payload format; auto accepts both (default: auto)" << std::endl;
+    std::cerr << "  --symbols SRC           Preload symbol IDs from a file or redis://host[:port]/key" << std::endl;
+    std::cerr << "  --max-symbols N         Symbol table capacity (default: 65536)" << std::endl;
+    std::cerr << "  --commit manual|auto    Commit offsets after DB writes, or let librdkafka auto-commit (default: manual)" << std::endl;
+    std::cerr << "  --db-idempotent on|off  Skip rows already written, for replays (default: off)" << std::endl;
+    std::cerr << "  --db-target-latency-ms N  Row wait + write time the adaptive batcher aims for;" << std::endl;
+    std::cerr << "                          larger favours throughput (default: 50)" << std::endl;
+    std::cerr << "  --db-max-batch N        Upper bound on rows per DB batch (default: 20000)" << std::endl;
+    std::cerr << "  --db-writers N          Parallel TimescaleDB writer connections, rows routed by" << std::endl;
+    std::cerr << "                          Kafka partition (default: 1)" << std::endl;
+    std::cerr << "  --db-spool DIR          While TimescaleDB is down, append batches to an on-disk spool" << std::endl;
+    std::cerr << "                          and replay them when it is back (default: off)" << std::endl;
+    std::cerr << "  --db-spool-segment-mb N Size of one spool segment file (default: 64)" << std::endl;
+    std::cerr << "  --db-spool-sync-ms N    Fsync interval for spooled batches; their offsets are committed" << std::endl;
+    std::cerr << "                          after the sync (default: 10)" << std::endl;
+    std::cerr << "  --queue-capacity N      DB queue slots, split across writers and rounded up to a" << std::endl;
+    std::cerr << "                          power of two (default: 262144)" << std::endl;
+    std::cerr << "  --overload block|redis-only  When a DB or Redis queue is over budget, pause its Kafka" << std::endl;
+    std::cerr << "                          partitions, or keep consuming and drop DB rows (default: block)" << std::endl;
+    std::cerr << "  --pause-high-pct N      Queue fill that pauses consumption (default: 80)" << std::endl;
+    std::cerr << "  --pause-low-pct N       Queue fill below which paused partitions resume (default: 50)" << std::endl;
+    std::cerr << "  --fetch-buffer-kb N     librdkafka prefetch budget, queued.max.messages.kbytes" << std::endl;
+    std::cerr << "                          (default: librdkafka's)" << std::endl;
+    std::cerr << "  --poll-batch N          Take up to N already-fetched messages per wakeup and handle" << std::endl;
+    std::cerr << "                          them with one clock read (default: 1)" << std::endl;
+    std::cerr << "  --kafka-config KEY=VALUE  librdkafka consumer property, e.g. fetch.min.bytes=65536;" << std::endl;
+    std::cerr << "                          repeatable, applied last" << std::endl;
+    std::cerr << "  --clock-sync on|off     Measure the producer host's clock offset over the clock-sync topic" << std::endl;
+    std::cerr << "                          and correct cross-host latencies (default: off)" << std::endl;
+    std::cerr << "  --busy-poll on|off      Consumers poll with a zero timeout and spin instead of sleeping" << std::endl;
+    std::cerr << "                          in librdkafka; costs a core each, pin them with --cpus (default: off)" << std::endl;
+    std::cerr << "  --cpus ROLE=LIST        Pin a role's threads to cores, e.g. consumer=2-5; roles consumer," << std::endl;
+    std::cerr << "                          db, redis, other; their queues are allocated on those cores' NUMA" << std::endl;
+    std::cerr << "                          node; repeatable (default: no pinning)" << std::endl;
+    std::cerr << "  --redis-mode async|sync Redis write path (default: async)" << std::endl;
+    std::cerr << "  --redis-max-inflight-bytes N  Unacknowledged bytes allowed on the async connection (default: 1048576)" << std::endl;
+    std::cerr << "  --redis-queue-capacity N      Async sink queue slots (default: 65536)" << std::endl;
+    std::cerr << "  --redis-coalesce-us N   MSET only changed prices every N us, 0 = SET per tick (default: 1000)" << std::endl;
+    std::cerr << "  --price-hash KEY|off    Also HSET coalesced prices into this hash (default: prices)" << std::endl;
+    std::cerr << "  --publish off|stream|pubsub  Fan out coalesced updates per ticker (default: off)" << std::endl;
+    std::cerr << "  --publish-prefix P      Stream key / channel prefix (default: ticks:)" << std::endl;
+    std::cerr << "  --stream-maxlen N       Approximate per-ticker stream length cap (default: 10000)" << std::endl;
+}
+
+inline bool parse_aggregator_options(int argc, char **argv, AggregatorOptions &opts) {
+    if (argc < 3) return false;
+    opts.brokers = argv[1];
+    opts.redis_host = argv[2];
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--db-sink") {
+            if (value == "copy") opts.db_sink = DbSinkMode::Copy;
+            else if (value == "insert") opts.db_sink = DbSinkMode::Insert;
+            else if (value == "pipeline") opts.db_sink = DbSinkMode::Pipeline;
+            else {
+                std::cerr << "Unknown --db-sink mode: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--workers") {
+            if (!parse_number_option(arg, value, opts.workers)) return false;
+            if (opts.workers < 1) {
+                std::cerr << "--workers must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--bar-intervals") {
+            if (!parse_bar_intervals(value, opts.bar_intervals)) {
+                std::cerr << "Invalid --bar-intervals: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--store-ticks") {
+            if (value == "on") opts.store_ticks = true;
+            else if (value == "off") opts.store_ticks = false;
+            else {
+                std::cerr << "Unknown --store-ticks: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--metrics-port") {
+            if (!parse_number_option(arg, value, opts.metrics_port)) return false;
+        } else if (arg == "--decoder") {
+            if (value == "wire") opts.decoder = DecoderMode::Wire;
+            else if (value == "protobuf") opts.decoder = DecoderMode::Protobuf;
+            else {
+                std::cerr << "Unknown --decoder: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--format") {
+            if (value == "auto") opts.format = PayloadFormat::Auto;
+            else if (value == "protobuf") opts.format = PayloadFormat::Protobuf;
+            else if (value == "packed") opts.format = PayloadFormat::Packed;
+            else {
+                std::cerr << "Unknown --format: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--symbols") {
+            opts.symbols_source = value;
+        } else if (arg == "--max-symbols") {
+            if (!parse_number_option(arg, value, opts.max_symbols)) return false;
+            if (opts.max_symbols < 1) {
+                std::cerr << "--max-symbols must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--commit") {
+            if (value == "manual") opts.commit = CommitMode::Manual;
+            else if (value == "auto") opts.commit = CommitMode::Auto;
+            else {
+                std::cerr << "Unknown --commit mode: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-idempotent") {
+            if (value == "on") opts.db_idempotent = true;
+            else if (value == "off") opts.db_idempotent = false;
+            else {
+                std::cerr << "Unknown --db-idempotent: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-target-latency-ms") {
+            if (!parse_number_option(arg, value, opts.db_target_latency_ms)) return false;
+            if (opts.db_target_latency_ms <= 0) {
+                std::cerr << "--db-target-latency-ms must be > 0" << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-max-batch") {
+            if (!parse_number_option(arg, value, opts.db_max_batch)) return false;
+            if (opts.db_max_batch < 1) {
+                std::cerr << "--db-max-batch must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-writers") {
+            if (!parse_number_option(arg, value, opts.db_writers)) return false;
+            if (opts.db_writers < 1) {
+                std::cerr << "--db-writers must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-pipeline-depth") {
+            if (!parse_number_option(arg, value, opts.db_pipeline_depth)) return false;
+            if (opts.db_pipeline_depth < 1) {
+                std::cerr << "--db-pipeline-depth must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-schema") {
+            if (value == "rows") opts.db_schema = DbSchema::Rows;
+            else if (value == "compact") opts.db_schema = DbSchema::Compact;
+            else {
+                std::cerr << "Unknown --db-schema: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-retention-days") {
+            if (value == "off") opts.db_retention_days = 0;
+            else if (!parse_number_option(arg, value, opts.db_retention_days)) return false;
+            if (opts.db_retention_days < 0) {
+                std::cerr << "--db-retention-days must be >= 0 or off" << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-spool") {
+            opts.db_spool_dir = value;
+        } else if (arg == "--db-spool-segment-mb") {
+            if (!parse_number_option(arg, value, opts.db_spool_segment_mb)) return false;
+            if (opts.db_spool_segment_mb < 1) {
+                std::cerr << "--db-spool-segment-mb must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--db-spool-sync-ms") {
+            if (!parse_number_option(arg, value, opts.db_spool_sync_ms)) return false;
+            if (opts.db_spool_sync_ms < 0) {
+                std::cerr << "--db-spool-sync-ms must be >= 0" << std::endl;
+                return false;
+            }
+        } else if (arg == "--queue-capacity") {
+            if (!parse_number_option(arg, value, opts.queue_capacity)) return false;
+        } else if (arg == "--overload") {
+            if (value == "block") opts.overload = OverloadPolicy::Block;
+            else if (value == "redis-only") opts.overload = OverloadPolicy::RedisOnly;
+            else {
+                std::cerr << "Unknown --overload policy: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--pause-high-pct") {
+            if (!parse_number_option(arg, value, opts.pause_high_pct)) return false;
+        } else if (arg == "--pause-low-pct") {
+            if (!parse_number_option(arg, value, opts.pause_low_pct)) return false;
+        } else if (arg == "--fetch-buffer-kb") {
+            if (!parse_number_option(arg, value, opts.fetch_buffer_kb)) return false;
+            if (opts.fetch_buffer_kb < 0) {
+                std::cerr << "--fetch-buffer-kb must be >= 0" << std::endl;
+                return false;
+            }
+        } else if (arg == "--poll-batch") {
+            if (!parse_number_option(arg, value, opts.poll_batch)) return false;
+            if (opts.poll_batch < 1) {
+                std::cerr << "--poll-batch must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--kafka-config") {
+            if (!parse_kafka_property(value, opts.kafka_config)) {
+                std::cerr << "--kafka-config needs KEY=VALUE: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--clock-sync") {
+            if (value == "on") opts.clock_sync = true;
+            else if (value == "off") opts.clock_sync = false;
+            else {
+                std::cerr << "Unknown --clock-sync: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--busy-poll") {
+            if (value == "on") opts.busy_poll = true;
+            else if (value == "off") opts.busy_poll = false;
+            else {
+                std::cerr << "Unknown --busy-poll: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--cpus") {
+            std::string error;
+            if (!opts.placement.parse(value, error)) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+        } else if (arg == "--redis-mode") {
+            if (value == "async") opts.redis_mode = RedisMode::Async;
+            else if (value == "sync") opts.redis_mode = RedisMode::Sync;
+            else {
+                std::cerr << "Unknown --redis-mode: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--redis-max-inflight-bytes") {
+            if (!parse_number_option(arg, value, opts.redis_max_inflight_bytes)) return false;
+            if (opts.redis_max_inflight_bytes < 1) {
+                std::cerr << "--redis-max-inflight-bytes must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--redis-queue-capacity") {
+            if (!parse_number_option(arg, value, opts.redis_queue_capacity)) return false;
+            if (opts.redis_queue_capacity < 1) {
+                std::cerr << "--redis-queue-capacity must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--price-hash") {
+            opts.price_hash = (value == "off") ? "" : value;
+        } else if (arg == "--publish") {
+            if (value == "off") opts.publish = PublishMode::Off;
+            else if (value == "stream") opts.publish = PublishMode::Stream;
+            else if (value == "pubsub") opts.publish = PublishMode::PubSub;
+            else {
+                std::cerr << "Unknown --publish mode: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--publish-prefix") {
+            opts.publish_prefix = value;
+        } else if (arg == "--stream-maxlen") {
+            if (!parse_number_option(arg, value, opts.stream_maxlen)) return false;
+            if (opts.stream_maxlen < 1) {
+                std::cerr << "--stream-maxlen must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--redis-coalesce-us") {
+            if (!parse_number_option(arg, value, opts.redis_coalesce_us)) return false;
+            if (opts.redis_coalesce_us < 0) {
+                std::cerr << "--redis-coalesce-us must be >= 0" << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (opts.pause_low_pct < 0 || opts.pause_low_pct >= opts.pause_high_pct || opts.pause_high_pct > 100) {
+        std::cerr << "Need 0 <= --pause-low-pct < --pause-high-pct <= 100" << std::endl;
+        return false;
+    }
+    if (opts.db_schema == DbSchema::Compact) {
+        if (opts.db_sink == DbSinkMode::Insert) {
+            std::cerr << "--db-schema compact needs --db-sink copy or pipeline" << std::endl;
+            return false;
+        }
+        if (!opts.store_ticks) {
+            std::cerr << "--db-schema compact derives bars from stored ticks and needs --store-ticks on" << std::endl;
+            return false;
+        }
+        for (int interval_s : opts.bar_intervals) {
+            if (interval_s > 6 * 3600) {
+                std::cerr << "--db-schema compact supports bar intervals up to 6h" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
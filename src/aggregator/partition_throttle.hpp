@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <librdkafka/rdkafka.h>
+
+// Flow control for --overload block: pauses the assigned partitions whose
+// downstream queues are over budget, so a stalled sink leaves the backlog in
+// Kafka instead of in memory, and resumes them once the queues have drained.
+// While paused librdkafka fetches nothing for the partition and discards what
+// it had prefetched; consumption restarts at the last message handed out.
+//
+// update() runs on the thread that polls the consumer. It re-issues the pause
+// for every partition that should stay paused, since a rebalance silently
+// clears pause state, so nothing has to be tracked across assignments.
+class PartitionThrottle {
+public:
+    // `pressure(partition)` is 1 when a queue the partition feeds is above
+    // the high watermark, -1 when all are below the low one and 0 in
+    // between, where a partition keeps its current state.
+    template <typename Pressure>
+    void update(rd_kafka_t *rk, Pressure pressure) {
+        rd_kafka_topic_partition_list_t *assigned = NULL;
+        if (rd_kafka_assignment(rk, &assigned) != RD_KAFKA_RESP_ERR_NO_ERROR) return;
+
+        rd_kafka_topic_partition_list_t *pause = rd_kafka_topic_partition_list_new(assigned->cnt);
+        rd_kafka_topic_partition_list_t *resume = rd_kafka_topic_partition_list_new(assigned->cnt);
+        next_.clear();
+        for (int i = 0; i < assigned->cnt; i++) {
+            const rd_kafka_topic_partition_t &tp = assigned->elems[i];
+            bool was_paused = std::find(paused_.begin(), paused_.end(), tp.partition) != paused_.end();
+            int level = pressure(tp.partition);
+            if (level > 0 || (was_paused && level == 0)) {
+                rd_kafka_topic_partition_list_add(pause, tp.topic, tp.partition);
+                next_.push_back(tp.partition);
+                if (!was_paused) pauses_.fetch_add(1, std::memory_order_relaxed);
+            } else if (was_paused) {
+                rd_kafka_topic_partition_list_add(resume, tp.topic, tp.partition);
+            }
+        }
+        if (pause->cnt > 0) rd_kafka_pause_partitions(rk, pause);
+        if (resume->cnt > 0) rd_kafka_resume_partitions(rk, resume);
+        rd_kafka_topic_partition_list_destroy(pause);
+        rd_kafka_topic_partition_list_destroy(resume);
+        rd_kafka_topic_partition_list_destroy(assigned);
+
+        paused_.swap(next_);
+        paused_count_.store(paused_.size(), std::memory_order_relaxed);
+    }
+
+    // Read by /metrics
+    size_t paused() const { return paused_count_.load(std::memory_order_relaxed); }
+    long long pauses() const { return pauses_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<int32_t> paused_;
+    std::vector<int32_t> next_;
+    std::atomic<size_t> paused_count_{0};
+    std::atomic<long long> pauses_{0};
+};
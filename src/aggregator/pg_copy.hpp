@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <libpq-fe.h>
+#include "aggregator/pg_error.hpp"
+
+// Big-endian field encoding shared by binary COPY rows and binary array
+// parameters: each field is an int32 length followed by the value's bytes.
+// The buffer is reused between batches so steady-state encoding never allocates.
+class PgBinaryBuffer {
+public:
+    explicit PgBinaryBuffer(size_t reserve_bytes) {
+        buf_.reserve(reserve_bytes);
+    }
+
+    // Postgres stores timestamptz as microseconds since 2000-01-01 UTC, which
+    // is the finest precision it keeps; nanoseconds are truncated to that.
+    void add_timestamptz_ns(long long unix_ns) {
+        static const long long PG_EPOCH_OFFSET_US = 946684800LL * 1000000LL;
+        put_be32(8);
+        put_be64(static_cast<uint64_t>(unix_ns / 1000 - PG_EPOCH_OFFSET_US));
+    }
+
+    void add_float8(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put_be32(8);
+        put_be64(bits);
+    }
+
+    void add_int4(int32_t value) {
+        put_be32(4);
+        put_be32(static_cast<uint32_t>(value));
+    }
+
+    void add_int8(int64_t value) {
+        put_be32(8);
+        put_be64(static_cast<uint64_t>(value));
+    }
+
+    void add_text(const char *data, size_t len) {
+        put_be32(static_cast<uint32_t>(len));
+        buf_.append(data, len);
+    }
+
+    const char *data() const { return buf_.data(); }
+    size_t size() const { return buf_.size(); }
+
+protected:
+    void put_be16(uint16_t v) {
+        char b[2] = {static_cast<char>(v >> 8), static_cast<char>(v)};
+        buf_.append(b, 2);
+    }
+    void put_be32(uint32_t v) {
+        char b[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                     static_cast<char>(v >> 8), static_cast<char>(v)};
+        buf_.append(b, 4);
+    }
+    void put_be64(uint64_t v) {
+        put_be32(static_cast<uint32_t>(v >> 32));
+        put_be32(static_cast<uint32_t>(v));
+    }
+
+    std::string buf_;
+};
+
+// Encoder for PostgreSQL's binary COPY format (COPY ... FROM STDIN (FORMAT binary)).
+// Layout: 19-byte header, then per row an int16 field count followed by
+// (int32 length, big-endian bytes) per field, then an int16 -1 trailer.
+class PgCopyBinaryEncoder : public PgBinaryBuffer {
+public:
+    explicit PgCopyBinaryEncoder(size_t reserve_bytes = 1 << 20) : PgBinaryBuffer(reserve_bytes) {}
+
+    void begin() {
+        static const char signature[11] = {'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0'};
+        buf_.clear();
+        buf_.append(signature, sizeof(signature));
+        put_be32(0);  // flags
+        put_be32(0);  // header extension length
+    }
+
+    static constexpr size_t HEADER_SIZE = 19;
+    static constexpr size_t TRAILER_SIZE = 2;
+
+    void begin_row(int16_t fields) { put_be16(static_cast<uint16_t>(fields)); }
+
+    void finish() { put_be16(0xFFFF); }
+};
+
+// A COPY stream handed over in pieces, e.g. several finished streams merged
+// into one by sending the first header, each one's rows and one trailer.
+struct PgCopyChunk {
+    const char *data;
+    size_t size;
+};
+
+// Runs `copy_sql` (a COPY ... FROM STDIN (FORMAT binary) statement) and streams
+// the chunks in order. Returns false and fills `error` if any step fails.
+inline bool pg_copy_send(PGconn *conn, const char *copy_sql, const std::vector<PgCopyChunk> &chunks,
+                         std::string &error) {
+    PGresult *res = PQexec(conn, copy_sql);
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        error = PQerrorMessage(conn);
+        pg_note_failure(res);
+        PQclear(res);
+        return false;
+    }
+    PQclear(res);
+
+    bool ok = true;
+    for (const PgCopyChunk &c : chunks) {
+        if (PQputCopyData(conn, c.data, static_cast<int>(c.size)) != 1) {
+            ok = false;
+            break;
+        }
+    }
+    if (!ok) {
+        error = PQerrorMessage(conn);
+        pg_note_failure(NULL);
+        PQputCopyEnd(conn, "client failed to send COPY data");
+    } else if (PQputCopyEnd(conn, NULL) != 1) {
+        error = PQerrorMessage(conn);
+        pg_note_failure(NULL);
+        ok = false;
+    }
+
+    // Drain every result so the connection is ready for the next statement
+    while ((res = PQgetResult(conn)) != NULL) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && ok) {
+            error = PQresultErrorMessage(res);
+            pg_note_failure(res);
+            ok = false;
+        }
+        PQclear(res);
+    }
+    return ok;
+}
+
+inline bool pg_copy_send(PGconn *conn, const char *copy_sql, const PgCopyBinaryEncoder &encoder, std::string &error) {
+    return pg_copy_send(conn, copy_sql, {{encoder.data(), encoder.size()}}, error);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <libpq-fe.h>
+
+// Why a write failed, as far as retrying it is concerned.
+enum class PgFailure {
+    Unavailable,  // connection lost, or a server condition that passes (disk full, deadlock, shutdown)
+    Data,         // SQLSTATE class 22 (data exception) or 23 (integrity constraint): fails every time
+};
+
+// SQLSTATE of the last statement that failed on this thread, empty when the
+// failure produced no server result (lost connection, client-side error).
+// Every failure path of the write helpers records it, so a writer can
+// classify a failed batch after the helper has returned false.
+inline std::string &pg_last_sqlstate() {
+    thread_local std::string state;
+    return state;
+}
+
+// `res` is the failing result, or NULL if there is none.
+inline void pg_note_failure(const PGresult *res) {
+    const char *state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : NULL;
+    pg_last_sqlstate() = state ? state : "";
+}
+
+// Classifies the failure a write helper just reported for `conn`.
+inline PgFailure pg_classify_failure(PGconn *conn) {
+    if (!conn || PQstatus(conn) == CONNECTION_BAD) return PgFailure::Unavailable;
+    const std::string &state = pg_last_sqlstate();
+    if (state.compare(0, 2, "22") == 0 || state.compare(0, 2, "23") == 0) return PgFailure::Data;
+    return PgFailure::Unavailable;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <libpq-fe.h>
+#include "aggregator/pg_copy.hpp"
+
+// One-dimensional binary array parameter (array_recv format) without NULLs:
+// ndim, has-null flag, element type OID, then dimension and lower bound,
+// followed by the elements encoded exactly like COPY fields. A batch column
+// becomes one parameter of `INSERT ... SELECT * FROM unnest($1, $2, ...)`.
+class PgArrayEncoder : public PgBinaryBuffer {
+public:
+    explicit PgArrayEncoder(size_t reserve_bytes = 1 << 16) : PgBinaryBuffer(reserve_bytes) {}
+
+    void begin(uint32_t element_oid) {
+        buf_.clear();
+        put_be32(1);  // ndim
+        put_be32(0);  // no NULLs
+        put_be32(element_oid);
+        put_be32(0);  // element count, patched by finish()
+        put_be32(1);  // lower bound
+    }
+
+    void finish(size_t elements) {
+        uint32_t n = static_cast<uint32_t>(elements);
+        char b[4] = {static_cast<char>(n >> 24), static_cast<char>(n >> 16),
+                     static_cast<char>(n >> 8), static_cast<char>(n)};
+        buf_.replace(12, 4, b, 4);
+    }
+};
+
+// Element type OIDs from pg_type; array_recv rejects a mismatch.
+namespace pg_oid {
+constexpr uint32_t INT4 = 23, INT8 = 20, TEXT = 25, FLOAT8 = 701, TIMESTAMPTZ = 1184;
+}
+
+// A connection in libpq pipeline mode. Every segment is one or more prepared
+// statements closed by a sync, so it runs as one implicit transaction and
+// reports success or failure as a unit. Segments complete in the order they
+// were sent; the caller keeps its own FIFO of what each one carried.
+//
+// The connection stays in blocking mode: a segment's replies are a few bytes,
+// so the server can never stall on output while we are still sending, and
+// PQpipelineSync flushes each segment as soon as it is queued.
+class PgPipeline {
+public:
+    // After PQprepare of the statements, outside pipeline mode.
+    bool enter(PGconn *conn) {
+        conn_ = conn;
+        in_flight_ = 0;
+        segment_failed_ = false;
+        if (PQenterPipelineMode(conn) == 1) return true;
+        error_ = PQerrorMessage(conn);
+        return false;
+    }
+
+    // The connection was reset behind our back; everything in flight is gone.
+    void reset() { in_flight_ = 0; segment_failed_ = false; }
+
+    bool send(const char *statement, int params, const char *const *values, const int *lengths) {
+        static const int binary[16] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+        if (params > 16) return false;
+        if (PQsendQueryPrepared(conn_, statement, params, values, lengths, binary, 0) == 1) return true;
+        error_ = PQerrorMessage(conn_);
+        pg_note_failure(NULL);
+        return false;
+    }
+
+    // Closes the current segment.
+    bool sync() {
+        if (PQpipelineSync(conn_) != 1) {
+            error_ = PQerrorMessage(conn_);
+            pg_note_failure(NULL);
+            return false;
+        }
+        in_flight_++;
+        return true;
+    }
+
+    // Outcome of the oldest segment: 1 committed, 0 failed (see error()), -1
+    // not complete yet (only when `block` is false) or nothing in flight.
+    int next_result(bool block) {
+        bool after_null = false;
+        while (in_flight_ > 0) {
+            if (!block) {
+                if (!PQconsumeInput(conn_)) return broken();
+                if (PQisBusy(conn_)) return -1;
+            }
+            PGresult *res = PQgetResult(conn_);
+            if (!res) {
+                // NULL separates statements; two in a row means the stream is out of step
+                if (after_null || PQstatus(conn_) == CONNECTION_BAD) return broken();
+                after_null = true;
+                continue;
+            }
+            after_null = false;
+            ExecStatusType status = PQresultStatus(res);
+            if (status == PGRES_PIPELINE_SYNC) {
+                PQclear(res);
+                in_flight_--;
+                bool failed = segment_failed_;
+                segment_failed_ = false;
+                return failed ? 0 : 1;
+            }
+            if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK && !segment_failed_) {
+                // PGRES_PIPELINE_ABORTED follows the statement that failed; keep its message
+                segment_failed_ = true;
+                error_ = status == PGRES_PIPELINE_ABORTED ? "pipeline aborted" : PQresultErrorMessage(res);
+                pg_note_failure(res);
+            }
+            PQclear(res);
+        }
+        return -1;
+    }
+
+    // Health check while idle: an empty segment must come back as a sync.
+    bool ping() {
+        if (in_flight_ > 0) return true;  // results are still arriving, so the link is alive
+        return sync() && next_result(true) == 1;
+    }
+
+    size_t in_flight() const { return in_flight_; }
+    int socket() const { return PQsocket(conn_); }
+    const std::string &error() const { return error_; }
+
+private:
+    int broken() {
+        error_ = PQerrorMessage(conn_);
+        pg_note_failure(NULL);
+        in_flight_ = 0;
+        segment_failed_ = false;
+        return 0;
+    }
+
+    PGconn *conn_ = NULL;
+    size_t in_flight_ = 0;
+    bool segment_failed_ = false;
+    std::string error_;
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "aggregator/bar_engine.hpp"
+#include "aggregator/last_value_table.hpp"
+#include "common/latency_histogram.hpp"
+#include "common/ring_buffer.hpp"
+#include "common/symbol_table.hpp"
+
+// One unit of work for the Redis sink, fixed-size so it fits a ring slot.
+struct RedisOp {
+    enum Kind : uint8_t { SetPrice, PublishBar };
+    Kind kind;
+    uint32_t symbol_id;
+    double price;
+    CompletedBar bar;
+};
+
+// Dedicated Redis writer on the hiredis async API, driven by a small epoll
+// adapter on its own thread. Consumer workers only push RedisOps into a
+// bounded ring, so Redis round trips and latency spikes never block the
+// Kafka loop. Pipelining depth is limited by bytes in flight (sent but not
+// yet acknowledged) instead of a fixed command count.
+//
+// With coalescing enabled, prices bypass the queue: workers write them to a
+// LastValueTable and a timerfd wakes the sink every interval to MSET the
+// symbols that changed. While over the in-flight limit the flush is skipped
+// and updates keep coalescing in the table.
+class RedisAsyncSink {
+public:
+    RedisAsyncSink(const std::string &host, int port, const SymbolTable &symbols,
+                   size_t queue_capacity, size_t max_inflight_bytes)
+        : host_(host), port_(port), symbols_(symbols), queue_(queue_capacity),
+          max_inflight_bytes_(max_inflight_bytes) {}
+
+    ~RedisAsyncSink() { stop(); }
+
+    // Must be called before start(). `staleness` (written by the sink thread
+    // only) records first-update -> MSET delay per flushed key.
+    void set_coalescing(LastValueTable *table, long long interval_us, const PriceOutputs &outputs,
+                        LatencyHistogram *staleness) {
+        last_values_ = table;
+        coalesce_us_ = interval_us;
+        outputs_ = outputs;
+        staleness_hist_ = staleness;
+    }
+
+    bool start() {
+        epoll_fd_ = epoll_create1(0);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK);
+        if (epoll_fd_ < 0 || wake_fd_ < 0) {
+            std::cerr << "Redis async sink: epoll/eventfd setup failed" << std::endl;
+            return false;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+        if (last_values_) {
+            timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            itimerspec spec = {};
+            spec.it_interval.tv_sec = coalesce_us_ / 1000000;
+            spec.it_interval.tv_nsec = (coalesce_us_ % 1000000) * 1000;
+            spec.it_value = spec.it_interval;
+            if (timer_fd_ < 0 || timerfd_settime(timer_fd_, 0, &spec, NULL) != 0) {
+                std::cerr << "Redis async sink: timerfd setup failed" << std::endl;
+                return false;
+            }
+            ev.data.fd = timer_fd_;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev);
+        }
+
+        if (!connect()) return false;
+        running_ = true;
+        thread_ = std::thread(&RedisAsyncSink::loop, this);
+        return true;
+    }
+
+    // Sends what is still queued (bounded by a short grace period), then disconnects.
+    void stop() {
+        if (!thread_.joinable()) return;
+        running_ = false;
+        wake();
+        thread_.join();
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+        if (wake_fd_ >= 0) close(wake_fd_);
+        if (timer_fd_ >= 0) close(timer_fd_);
+        epoll_fd_ = wake_fd_ = timer_fd_ = -1;
+    }
+
+    // The sink thread, for pinning; valid after start().
+    std::thread::native_handle_type native_handle() { return thread_.native_handle(); }
+
+    // Non-blocking; false when the queue is full.
+    bool submit(const RedisOp &op) {
+        if (!queue_.try_push(op)) return false;
+        if (sleeping_.load(std::memory_order_seq_cst)) wake();
+        return true;
+    }
+
+    size_t queue_depth() const { return queue_.size_approx(); }
+    size_t queue_capacity() const { return queue_.capacity(); }
+    size_t inflight_bytes() const { return inflight_bytes_.load(std::memory_order_relaxed); }
+    long long commands_sent() const { return commands_sent_.load(std::memory_order_relaxed); }
+    long long replies() const { return replies_.load(std::memory_order_relaxed); }
+    long long errors() const { return errors_.load(std::memory_order_relaxed); }
+    long long reconnects() const { return reconnects_.load(std::memory_order_relaxed); }
+
+private:
+    // Encodes one op and hands it to hiredis; returns false if nothing was sent.
+    bool send_op(const RedisOp &op) {
+        std::string_view ticker = symbols_.name(op.symbol_id);
+        if (op.kind == RedisOp::SetPrice) {
+            args_.reset("SET");
+            args_.add(ticker);
+            args_.add(op.price);
+        } else {
+            build_bar_command(args_, key_, op.bar, ticker);
+        }
+        std::string_view cmd = args_.command();
+        return send_formatted(cmd.data(), cmd.size());
+    }
+
+    void flush_last_values() {
+        if (!can_send()) return;
+        pending_.clear();
+        if (last_values_->drain(pending_) == 0) return;
+
+        long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        for (size_t first = 0; first < pending_.size(); first += MSET_CHUNK) {
+            size_t count = std::min(MSET_CHUNK, pending_.size() - first);
+            build_price_commands(args_, pending_, first, count, symbols_, outputs_, [this](RespWriter &args) {
+                std::string_view cmd = args.command();
+                send_formatted(cmd.data(), cmd.size());
+            });
+        }
+        if (staleness_hist_) {
+            for (const LastValue &v : pending_) staleness_hist_->record(now - v.dirty_since_ns);
+        }
+    }
+
+    bool send_formatted(const char *cmd, size_t len) {
+        if (!ac_) return false;
+        if (redisAsyncFormattedCommand(ac_, on_reply, reinterpret_cast<void *>(len), cmd, len) != REDIS_OK) {
+            errors_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        inflight_bytes_.fetch_add(len, std::memory_order_relaxed);
+        commands_sent_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool connect() {
+        ac_ = redisAsyncConnect(host_.c_str(), port_);
+        if (!ac_ || ac_->err) {
+            std::cerr << "Redis async sink: connect failed: " << (ac_ ? ac_->errstr : "allocate context") << std::endl;
+            if (ac_) redisAsyncFree(ac_);
+            ac_ = NULL;
+            schedule_reconnect();
+            return false;
+        }
+        ac_->data = this;
+        ac_->ev.data = this;
+        ac_->ev.addRead = ev_add_read;
+        ac_->ev.delRead = ev_del_read;
+        ac_->ev.addWrite = ev_add_write;
+        ac_->ev.delWrite = ev_del_write;
+        ac_->ev.cleanup = ev_cleanup;
+        fd_ = ac_->c.fd;
+        events_ = 0;
+        registered_ = false;
+        // Registering the connect callback arms the first write event, so the
+        // adapter hooks above must already be in place.
+        redisAsyncSetConnectCallback(ac_, on_connect);
+        redisAsyncSetDisconnectCallback(ac_, on_disconnect);
+        return true;
+    }
+
+    void loop() {
+        epoll_event events[8];
+        auto shutdown_deadline = std::chrono::steady_clock::time_point::max();
+
+        for (;;) {
+            auto now = std::chrono::steady_clock::now();
+            if (!running_) {
+                if (shutdown_deadline == std::chrono::steady_clock::time_point::max()) {
+                    shutdown_deadline = now + std::chrono::seconds(2);
+                    if (last_values_) flush_last_values();  // workers have stopped by now
+                }
+                bool idle = queue_.size_approx() == 0 && inflight_bytes_.load() == 0;
+                if (idle || now >= shutdown_deadline || !ac_) break;
+            }
+
+            if (!ac_ && now >= next_reconnect_) {
+                reconnects_.fetch_add(1, std::memory_order_relaxed);
+                connect();
+            }
+
+            drain_queue();
+
+            // Sleep until Redis or a producer needs us; submit() writes the
+            // eventfd only while we advertise that we are sleeping.
+            sleeping_.store(true, std::memory_order_seq_cst);
+            int timeout_ms = (queue_.size_approx() > 0 && can_send()) ? 0 : 5;
+            int n = epoll_wait(epoll_fd_, events, 8, timeout_ms);
+            sleeping_.store(false, std::memory_order_seq_cst);
+
+            for (int i = 0; i < n; i++) {
+                if (events[i].data.fd == wake_fd_) {
+                    uint64_t v;
+                    ssize_t r = read(wake_fd_, &v, sizeof(v));
+                    (void)r;
+                    continue;
+                }
+                if (events[i].data.fd == timer_fd_) {
+                    uint64_t expirations;
+                    ssize_t r = read(timer_fd_, &expirations, sizeof(expirations));
+                    (void)r;
+                    flush_last_values();
+                    continue;
+                }
+                if (!ac_) continue;
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) redisAsyncHandleRead(ac_);
+                if (ac_ && (events[i].events & EPOLLOUT)) redisAsyncHandleWrite(ac_);
+            }
+        }
+
+        // Fails whatever is still unacknowledged through on_reply, then frees
+        if (ac_) redisAsyncFree(ac_);
+        ac_ = NULL;
+    }
+
+    // Called whenever the context is lost, however the connect or the
+    // connection failed; the delay doubles per failure up to 5 s and resets
+    // once a connect succeeds, so an unreachable Redis is retried a few times
+    // a minute rather than on every epoll timeout.
+    void schedule_reconnect() {
+        next_reconnect_ = std::chrono::steady_clock::now() + reconnect_delay_;
+        reconnect_delay_ = std::min(reconnect_delay_ * 2, std::chrono::milliseconds(5000));
+    }
+
+    bool can_send() const {
+        return ac_ && connected_ && inflight_bytes_.load(std::memory_order_relaxed) < max_inflight_bytes_;
+    }
+
+    void drain_queue() {
+        RedisOp op;
+        while (can_send() && queue_.try_pop(op)) {
+            send_op(op);
+        }
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t r = write(wake_fd_, &one, sizeof(one));
+        (void)r;
+    }
+
+    void update_events(uint32_t events) {
+        if (events == events_ && registered_) return;
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd_;
+        if (!registered_) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &ev);
+            registered_ = true;
+        } else {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd_, &ev);
+        }
+        events_ = events;
+    }
+
+    // --- hiredis event-library hooks ---
+    static void ev_add_read(void *p) { auto *s = static_cast<RedisAsyncSink *>(p); s->update_events(s->events_ | EPOLLIN); }
+    static void ev_del_read(void *p) { auto *s = static_cast<RedisAsyncSink *>(p); s->update_events(s->events_ & ~EPOLLIN); }
+    static void ev_add_write(void *p) { auto *s = static_cast<RedisAsyncSink *>(p); s->update_events(s->events_ | EPOLLOUT); }
+    static void ev_del_write(void *p) { auto *s = static_cast<RedisAsyncSink *>(p); s->update_events(s->events_ & ~EPOLLOUT); }
+    static void ev_cleanup(void *p) {
+        auto *s = static_cast<RedisAsyncSink *>(p);
+        if (s->registered_) epoll_ctl(s->epoll_fd_, EPOLL_CTL_DEL, s->fd_, NULL);
+        s->registered_ = false;
+        s->events_ = 0;
+    }
+
+    static void on_connect(const redisAsyncContext *ac, int status) {
+        auto *s = static_cast<RedisAsyncSink *>(ac->data);
+        if (status != REDIS_OK) {
+            std::cerr << "Redis async sink: connect error: " << ac->errstr << std::endl;
+            s->ac_ = NULL;  // hiredis frees the context after this callback
+            s->schedule_reconnect();
+            return;
+        }
+        s->connected_ = true;
+        s->reconnect_delay_ = std::chrono::milliseconds(100);
+        std::cout << "Redis async sink connected." << std::endl;
+    }
+
+    static void on_disconnect(const redisAsyncContext *ac, int status) {
+        auto *s = static_cast<RedisAsyncSink *>(ac->data);
+        if (status != REDIS_OK) {
+            std::cerr << "Redis async sink: disconnected: " << ac->errstr << std::endl;
+        }
+        s->connected_ = false;
+        s->ac_ = NULL;
+        s->schedule_reconnect();
+        // Replies for in-flight commands were failed by hiredis (on_reply with NULL)
+    }
+
+    static void on_reply(redisAsyncContext *ac, void *r, void *privdata) {
+        auto *s = static_cast<RedisAsyncSink *>(ac->data);
+        size_t len = reinterpret_cast<size_t>(privdata);
+        s->inflight_bytes_.fetch_sub(len, std::memory_order_relaxed);
+        redisReply *reply = static_cast<redisReply *>(r);
+        if (!reply || reply->type == REDIS_REPLY_ERROR) {
+            s->errors_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            s->replies_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::string host_;
+    int port_;
+    const SymbolTable &symbols_;
+    BoundedRingBuffer<RedisOp> queue_;
+    size_t max_inflight_bytes_;
+
+    redisAsyncContext *ac_ = NULL;
+    bool connected_ = false;
+    int fd_ = -1;
+    uint32_t events_ = 0;
+    bool registered_ = false;
+    std::chrono::steady_clock::time_point next_reconnect_{};
+    std::chrono::milliseconds reconnect_delay_{100};
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    int timer_fd_ = -1;
+
+    static constexpr size_t MSET_CHUNK = 512;  // keys per command
+    LastValueTable *last_values_ = NULL;
+    long long coalesce_us_ = 0;
+    PriceOutputs outputs_;
+    LatencyHistogram *staleness_hist_ = NULL;
+    std::vector<LastValue> pending_;
+    RespWriter args_;
+    std::string key_;
+
+    std::atomic<bool> running_{false};
+    std::atomic<bool> sleeping_{false};
+    std::atomic<size_t> inflight_bytes_{0};
+    std::atomic<long long> commands_sent_{0};
+    std::atomic<long long> replies_{0};
+    std::atomic<long long> errors_{0};
+    std::atomic<long long> reconnects_{0};
+    std::thread thread_;
+};
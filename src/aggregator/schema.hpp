@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <libpq-fe.h>
+#include "aggregator/bar_engine.hpp"
+#include "aggregator/pg_error.hpp"
+
+// Runs one statement that returns no rows (or rows that are ignored); logs
+// and returns false on failure.
+inline bool exec_command(PGconn *conn, const char *sql, const char *what) {
+    PGresult *res = PQexec(conn, sql);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK || PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (!ok) {
+        std::cerr << what << " failed: " << PQerrorMessage(conn) << std::endl;
+        pg_note_failure(res);
+    }
+    PQclear(res);
+    return ok;
+}
+
+// Versioned TimescaleDB schema. Applied versions are recorded in
+// schema_migrations, so a restart runs only what is new instead of the whole
+// DDL. Statements are idempotent (IF NOT EXISTS, if_not_exists => TRUE), so a
+// migration interrupted half-way is simply run again, and a database created
+// before versioning adopts versions 1 and 2 without changes. Append new
+// versions at the end; never edit one that has shipped.
+struct SchemaMigration {
+    int version;
+    const char *description;
+    std::vector<const char *> statements;
+};
+
+inline const std::vector<SchemaMigration> &schema_migrations() {
+    static const std::vector<SchemaMigration> migrations = {
+        {1, "market_updates and market_bars hypertables", {
+            R"(CREATE TABLE IF NOT EXISTS market_updates (
+                time TIMESTAMPTZ NOT NULL,
+                ticker TEXT NOT NULL,
+                price DOUBLE PRECISION NOT NULL,
+                volume INTEGER NOT NULL,
+                latency_ms DOUBLE PRECISION NOT NULL
+            ))",
+            "SELECT create_hypertable('market_updates', 'time', if_not_exists => TRUE)",
+            "CREATE INDEX IF NOT EXISTS idx_ticker_time ON market_updates (ticker, time DESC)",
+            R"(CREATE TABLE IF NOT EXISTS market_bars (
+                time TIMESTAMPTZ NOT NULL,
+                ticker TEXT NOT NULL,
+                interval_s INTEGER NOT NULL,
+                open DOUBLE PRECISION NOT NULL,
+                high DOUBLE PRECISION NOT NULL,
+                low DOUBLE PRECISION NOT NULL,
+                close DOUBLE PRECISION NOT NULL,
+                volume BIGINT NOT NULL,
+                vwap DOUBLE PRECISION NOT NULL,
+                trades INTEGER NOT NULL
+            ))",
+            "SELECT create_hypertable('market_bars', 'time', if_not_exists => TRUE)",
+            "CREATE INDEX IF NOT EXISTS idx_bars_ticker_interval_time ON market_bars (ticker, interval_s, time DESC)",
+        }},
+        {2, "Kafka coordinates on market_updates", {
+            R"(ALTER TABLE market_updates ADD COLUMN IF NOT EXISTS kafka_partition INTEGER,
+                                         ADD COLUMN IF NOT EXISTS kafka_offset BIGINT,
+                                         ADD COLUMN IF NOT EXISTS kafka_seq INTEGER)",
+        }},
+        // --db-schema compact. Rows are 28 bytes of payload plus the optional
+        // coordinates, and chunks older than a day are compressed per symbol.
+        // The unique-index columns of --db-idempotent are in the orderby so
+        // that index stays valid on compressed chunks.
+        {3, "symbols dictionary and compressed market_ticks hypertable", {
+            "CREATE TABLE IF NOT EXISTS symbols (id SERIAL PRIMARY KEY, ticker TEXT NOT NULL UNIQUE)",
+            R"(CREATE TABLE IF NOT EXISTS market_ticks (
+                time TIMESTAMPTZ NOT NULL,
+                symbol_id INTEGER NOT NULL,
+                price DOUBLE PRECISION NOT NULL,
+                volume INTEGER NOT NULL,
+                kafka_partition INTEGER,
+                kafka_offset BIGINT,
+                kafka_seq INTEGER
+            ))",
+            "SELECT create_hypertable('market_ticks', 'time', chunk_time_interval => INTERVAL '1 day', "
+            "if_not_exists => TRUE)",
+            "CREATE INDEX IF NOT EXISTS idx_ticks_symbol_time ON market_ticks (symbol_id, time DESC)",
+            "ALTER TABLE market_ticks SET (timescaledb.compress, timescaledb.compress_segmentby = 'symbol_id', "
+            "timescaledb.compress_orderby = 'time DESC, kafka_partition, kafka_offset, kafka_seq')",
+            "SELECT add_compression_policy('market_ticks', INTERVAL '1 day', if_not_exists => TRUE)",
+        }},
+    };
+    return migrations;
+}
+
+// Applies every migration newer than the recorded version. Several writers or
+// aggregators may start at once, so the check and the DDL run under a
+// session advisory lock.
+inline bool migrate_schema(PGconn *conn) {
+    if (!exec_command(conn, "SELECT pg_advisory_lock(7201934)", "Schema lock")) return false;
+    bool ok = exec_command(conn, R"(CREATE TABLE IF NOT EXISTS schema_migrations (
+                                        version INTEGER PRIMARY KEY,
+                                        description TEXT NOT NULL,
+                                        applied_at TIMESTAMPTZ NOT NULL DEFAULT now()
+                                    ))", "schema_migrations creation");
+    int current = 0;
+    if (ok) {
+        PGresult *res = PQexec(conn, "SELECT COALESCE(max(version), 0) FROM schema_migrations");
+        ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+        if (ok) current = std::atoi(PQgetvalue(res, 0, 0));
+        else std::cerr << "Reading schema version failed: " << PQerrorMessage(conn) << std::endl;
+        PQclear(res);
+    }
+
+    for (const SchemaMigration &m : schema_migrations()) {
+        if (!ok || m.version <= current) continue;
+        std::string what = "Schema migration " + std::to_string(m.version);
+        for (const char *sql : m.statements) {
+            ok = ok && exec_command(conn, sql, what.c_str());
+        }
+        std::string record = "INSERT INTO schema_migrations (version, description) VALUES (" +
+                             std::to_string(m.version) + ", '" + m.description + "')";
+        ok = ok && exec_command(conn, record.c_str(), what.c_str());
+        if (ok) std::cout << "Applied schema migration " << m.version << ": " << m.description << std::endl;
+    }
+    if (ok) {
+        int latest = schema_migrations().back().version;
+        std::cout << "TimescaleDB schema at version " << std::max(current, latest) << std::endl;
+    }
+
+    exec_command(conn, "SELECT pg_advisory_unlock(7201934)", "Schema unlock");
+    return ok;
+}
+
+// --db-schema compact: one continuous aggregate market_bars_<label> per bar
+// interval, refreshed every interval over the last three buckets (at least an
+// hour), so bars come from the stored ticks and the aggregator no longer
+// writes market_bars. The refresh window has to end before market_ticks
+// chunks are compressed after a day, hence the 6h interval limit in
+// options.hpp. Only intervals without a view are created, checked with
+// to_regclass rather than by re-running the DDL.
+inline bool ensure_bar_aggregates(PGconn *conn, const std::vector<int> &intervals) {
+    for (int interval_s : intervals) {
+        std::string view = "market_bars_" + bar_interval_label(interval_s);
+        std::string exists_sql = "SELECT to_regclass('" + view + "') IS NOT NULL";
+        PGresult *res = PQexec(conn, exists_sql.c_str());
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            std::cerr << "Checking " << view << " failed: " << PQerrorMessage(conn) << std::endl;
+            PQclear(res);
+            return false;
+        }
+        bool exists = PQgetvalue(res, 0, 0)[0] == 't';
+        PQclear(res);
+        if (exists) continue;
+
+        std::string bucket = "INTERVAL '" + std::to_string(interval_s) + " seconds'";
+        std::string start = "INTERVAL '" + std::to_string(std::max(3 * interval_s, 3600)) + " seconds'";
+        std::string create =
+            "CREATE MATERIALIZED VIEW " + view + " WITH (timescaledb.continuous) AS "
+            "SELECT time_bucket(" + bucket + ", time) AS time, symbol_id, "
+            "first(price, time) AS open, max(price) AS high, min(price) AS low, last(price, time) AS close, "
+            "sum(volume)::BIGINT AS volume, sum(price * volume) / NULLIF(sum(volume), 0) AS vwap, "
+            "count(*)::INTEGER AS trades "
+            "FROM market_ticks GROUP BY 1, symbol_id WITH NO DATA";
+        std::string policy =
+            "SELECT add_continuous_aggregate_policy('" + view + "', start_offset => " + start +
+            ", end_offset => " + bucket + ", schedule_interval => " + bucket + ", if_not_exists => TRUE)";
+        if (!exec_command(conn, create.c_str(), "Continuous aggregate creation") ||
+            !exec_command(conn, policy.c_str(), "Continuous aggregate policy")) {
+            return false;
+        }
+        std::cout << "Created continuous aggregate " << view << std::endl;
+    }
+    return true;
+}
+
+// Keeps the raw-tick retention policy of `table` at `days` (0 removes it).
+// The job table is read first, so an unchanged setting issues no DDL.
+inline bool apply_retention(PGconn *conn, const char *table, int days) {
+    std::string current_sql = std::string("SELECT config->>'drop_after' FROM timescaledb_information.jobs "
+                                          "WHERE proc_name = 'policy_retention' AND hypertable_name = '") +
+                              table + "'";
+    PGresult *res = PQexec(conn, current_sql.c_str());
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        std::cerr << "Reading retention policy failed: " << PQerrorMessage(conn) << std::endl;
+        PQclear(res);
+        return false;
+    }
+    std::string current = PQntuples(res) > 0 ? PQgetvalue(res, 0, 0) : "";
+    PQclear(res);
+
+    std::string wanted = days > 0 ? std::to_string(days) + (days == 1 ? " day" : " days") : "";
+    if (current == wanted) return true;
+
+    std::string remove = std::string("SELECT remove_retention_policy('") + table + "', if_exists => TRUE)";
+    if (!exec_command(conn, remove.c_str(), "Retention policy removal")) return false;
+    if (days > 0) {
+        std::string add = std::string("SELECT add_retention_policy('") + table + "', INTERVAL '" + wanted + "')";
+        if (!exec_command(conn, add.c_str(), "Retention policy")) return false;
+        std::cout << "Retention on " << table << ": " << wanted << std::endl;
+    } else {
+        std::cout << "Retention on " << table << " removed" << std::endl;
+    }
+    return true;
+}
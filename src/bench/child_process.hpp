@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// CPU time and resident memory of a running process, from /proc.
+struct ProcSample {
+    double cpu_s = 0;   // utime + stime
+    long long rss_bytes = 0;
+};
+
+inline bool read_proc_sample(pid_t pid, ProcSample &out) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) return false;
+    // comm may contain spaces; the fields after it start past the last ')'
+    size_t close = line.rfind(')');
+    if (close == std::string::npos) return false;
+    std::istringstream fields(line.substr(close + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) utime = std::stoull(field);
+        if (i == 15) stime = std::stoull(field);
+    }
+    out.cpu_s = static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            out.rss_bytes = std::atoll(line.c_str() + 6) * 1024;
+            break;
+        }
+    }
+    return true;
+}
+
+// One benchmarked binary, with stdout and stderr sent to a log file.
+class ChildProcess {
+public:
+    ~ChildProcess() { stop(5); }
+
+    bool start(const std::vector<std::string> &args, const std::string &log_path) {
+        std::vector<char *> argv;
+        for (const std::string &a : args) argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(NULL);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+        int err = posix_spawn(&pid_, argv[0], &actions, NULL, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (err != 0) {
+            std::cerr << "Cannot start " << args[0] << ": " << strerror(err) << std::endl;
+            pid_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    bool running() {
+        if (pid_ <= 0) return false;
+        int status;
+        if (waitpid(pid_, &status, WNOHANG) == pid_) {
+            exit_status_ = status;
+            pid_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // Waits up to `timeout_s` for the process to exit by itself.
+    bool wait(double timeout_s) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout_s);
+        while (running()) {
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return true;
+    }
+
+    // SIGINT, the clean shutdown both binaries handle, then SIGKILL after `timeout_s`.
+    void stop(double timeout_s) {
+        if (!running()) return;
+        kill(pid_, SIGINT);
+        if (wait(timeout_s)) return;
+        std::cerr << "pid " << pid_ << " ignored SIGINT, killing it" << std::endl;
+        kill(pid_, SIGKILL);
+        wait(5);
+    }
+
+    pid_t pid() const { return pid_; }
+    bool exited_cleanly() const { return WIFEXITED(exit_status_) && WEXITSTATUS(exit_status_) == 0; }
+
+private:
+    pid_t pid_ = -1;
+    int exit_status_ = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Fetches http://127.0.0.1:<port>/metrics from a HttpServer. False when
+// nothing is listening yet or the response is not a 200.
+inline bool scrape_metrics(int port, std::string &body) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    static const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(request) - 1)) {
+        close(fd);
+        return false;
+    }
+
+    std::string response;
+    char buf[16384];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) response.append(buf, static_cast<size_t>(n));
+    close(fd);
+
+    size_t header_end = response.find("\r\n\r\n");
+    if (header_end == std::string::npos || response.compare(0, 12, "HTTP/1.0 200") != 0) return false;
+    body = response.substr(header_end + 4);
+    return true;
+}
+
+// Value of one series in Prometheus text output, written exactly as
+// MetricsWriter emits it: `name` or `name{label="v",...}`. NaN when absent.
+inline double metric_value(const std::string &body, const std::string &series) {
+    size_t pos = 0;
+    while ((pos = body.find(series, pos)) != std::string::npos) {
+        bool line_start = pos == 0 || body[pos - 1] == '\n';
+        size_t after = pos + series.size();
+        if (line_start && after < body.size() && body[after] == ' ') {
+            return std::strtod(body.c_str() + after + 1, NULL);
+        }
+        pos = after;
+    }
+    return NAN;
+}
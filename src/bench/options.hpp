@@ -0,0 +1,151 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "common/parse_number.hpp"
+
+// pipeline_bench runs every combination of the sweep lists as one scenario:
+// a fresh aggregator, then the producer in --rate mode for --duration.
+struct BenchOptions {
+    std::string brokers = "localhost:9092";
+    std::string redis_host = "localhost";  // also the TimescaleDB host, as for the aggregator
+    std::string aggregator = "./aggregator";
+    std::string producer = "./producer";
+    std::string symbols = "deploy/symbols.txt";  // shared dictionary, required by --format packed
+    std::vector<double> rates = {10000, 50000, 100000};
+    std::vector<std::string> formats = {"protobuf"};
+    std::vector<int> workers = {1};
+    std::vector<int> record_batches = {1};  // producer --updates-per-record
+    std::vector<int> poll_batches = {1};    // aggregator --poll-batch
+    double duration_s = 30;
+    double warmup_s = 5;  // after the aggregator is up, for the consumer group to get its assignment
+    int producer_threads = 4;
+    int aggregator_metrics_port = 9101;
+    int producer_metrics_port = 9102;
+    std::vector<std::string> aggregator_args;  // appended verbatim
+    std::vector<std::string> producer_args;
+    std::string out = "bench_results.jsonl";
+    std::string log_dir = "bench_logs";
+};
+
+// Comma-separated list; false on an empty item or one `parse` rejects.
+template <typename T, typename Parse>
+bool parse_bench_list(const std::string &spec, std::vector<T> &out, Parse parse) {
+    out.clear();
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        if (item.empty()) return false;
+        T value{};
+        if (!parse(item, value)) return false;
+        out.push_back(value);
+        pos = end + 1;
+    }
+    return true;
+}
+
+// Whitespace-separated extra arguments.
+inline std::vector<std::string> split_bench_args(const std::string &spec) {
+    std::vector<std::string> out;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t start = spec.find_first_not_of(" \t", pos);
+        if (start == std::string::npos) break;
+        size_t end = spec.find_first_of(" \t", start);
+        if (end == std::string::npos) end = spec.size();
+        out.push_back(spec.substr(start, end - start));
+        pos = end;
+    }
+    return out;
+}
+
+inline void print_bench_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [options]" << std::endl;
+    std::cerr << "Runs the producer against the aggregator for every combination of the sweep lists and" << std::endl;
+    std::cerr << "appends one JSON object per scenario to --out. Needs Kafka, Redis and TimescaleDB" << std::endl;
+    std::cerr << "(docker compose up -d)." << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --brokers LIST          Kafka bootstrap servers (default: localhost:9092)" << std::endl;
+    std::cerr << "  --redis-host HOST       Redis and TimescaleDB host (default: localhost)" << std::endl;
+    std::cerr << "  --aggregator PATH       Aggregator binary (default: ./aggregator)" << std::endl;
+    std::cerr << "  --producer PATH         Producer binary (default: ./producer)" << std::endl;
+    std::cerr << "  --symbols SRC           Dictionary passed to both (default: deploy/symbols.txt)" << std::endl;
+    std::cerr << "  --rates LIST            Producer msg/s (default: 10000,50000,100000)" << std::endl;
+    std::cerr << "  --formats LIST          protobuf and/or packed (default: protobuf)" << std::endl;
+    std::cerr << "  --workers LIST          Aggregator --workers values (default: 1)" << std::endl;
+    std::cerr << "  --record-batches LIST   Producer --updates-per-record values (default: 1)" << std::endl;
+    std::cerr << "  --poll-batches LIST     Aggregator --poll-batch values (default: 1)" << std::endl;
+    std::cerr << "  --duration S            Producer run time per scenario (default: 30)" << std::endl;
+    std::cerr << "  --warmup S              Wait after the aggregator is up (default: 5)" << std::endl;
+    std::cerr << "  --producer-threads N    Producer --threads (default: 4)" << std::endl;
+    std::cerr << "  --aggregator-args \"..\"  Extra aggregator options for every scenario" << std::endl;
+    std::cerr << "  --producer-args \"..\"    Extra producer options for every scenario" << std::endl;
+    std::cerr << "  --out FILE              JSON Lines results, appended (default: bench_results.jsonl)" << std::endl;
+    std::cerr << "  --log-dir DIR           Per-scenario process output (default: bench_logs)" << std::endl;
+}
+
+inline bool parse_bench_options(int argc, char **argv, BenchOptions &opts) {
+    auto to_double = [](const std::string &s, double &v) { return parse_number(s, v); };
+    auto to_int = [](const std::string &s, int &v) { return parse_number(s, v); };
+    auto to_string = [](const std::string &s, std::string &v) {
+        v = s;
+        return true;
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        bool ok = true;
+        if (arg == "--brokers") opts.brokers = value;
+        else if (arg == "--redis-host") opts.redis_host = value;
+        else if (arg == "--aggregator") opts.aggregator = value;
+        else if (arg == "--producer") opts.producer = value;
+        else if (arg == "--symbols") opts.symbols = value;
+        else if (arg == "--rates") ok = parse_bench_list(value, opts.rates, to_double);
+        else if (arg == "--formats") ok = parse_bench_list(value, opts.formats, to_string);
+        else if (arg == "--workers") ok = parse_bench_list(value, opts.workers, to_int);
+        else if (arg == "--record-batches") ok = parse_bench_list(value, opts.record_batches, to_int);
+        else if (arg == "--poll-batches") ok = parse_bench_list(value, opts.poll_batches, to_int);
+        else if (arg == "--duration") ok = parse_number(value, opts.duration_s);
+        else if (arg == "--warmup") ok = parse_number(value, opts.warmup_s);
+        else if (arg == "--producer-threads") ok = parse_number(value, opts.producer_threads);
+        else if (arg == "--aggregator-args") opts.aggregator_args = split_bench_args(value);
+        else if (arg == "--producer-args") opts.producer_args = split_bench_args(value);
+        else if (arg == "--out") opts.out = value;
+        else if (arg == "--log-dir") opts.log_dir = value;
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+        if (!ok) {
+            std::cerr << "Invalid " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+
+    for (const std::string &f : opts.formats) {
+        if (f != "protobuf" && f != "packed") {
+            std::cerr << "Unknown format in --formats: " << f << std::endl;
+            return false;
+        }
+    }
+    for (double r : opts.rates) {
+        if (r <= 0) {
+            std::cerr << "--rates must be > 0" << std::endl;
+            return false;
+        }
+    }
+    if (opts.duration_s <= 0) {
+        std::cerr << "--duration must be > 0" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "common/parse_number.hpp"
+
+struct CaptureOptions {
+    std::string output;
+    std::string brokers;             // consume market-updates from these
+    std::string csv_path;            // or convert a market_updates CSV export
+    bool from_earliest = false;      // earliest: retained topic up to its end; latest: new ticks only
+    double duration_s = 0;           // 0 = no time limit
+    long long max_ticks = 0;         // 0 = no count limit
+    std::string symbols_source;      // dictionary for packed payloads
+    std::string group_id;            // default: a fresh tick_capture-<pid> group
+};
+
+inline void print_capture_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " <output file> (--kafka BROKERS | --csv FILE) [options]" << std::endl;
+    std::cerr << "Writes a capture file for producer --replay." << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --kafka BROKERS         Consume market-updates (all payload formats)" << std::endl;
+    std::cerr << "  --csv FILE              Convert a market_updates export (time,ticker,price,volume)" << std::endl;
+    std::cerr << "  --from earliest|latest  earliest copies the retained topic and stops at its end," << std::endl;
+    std::cerr << "                          latest records new ticks until a limit or Ctrl-C (default: latest)" << std::endl;
+    std::cerr << "  --duration S            Stop after S seconds, 0 = no limit (default: 0)" << std::endl;
+    std::cerr << "  --max-ticks N           Stop after N ticks, 0 = no limit (default: 0)" << std::endl;
+    std::cerr << "  --symbols SRC           Dictionary for packed payloads, as given to the producer" << std::endl;
+    std::cerr << "  --group ID              Consumer group (default: tick_capture-<pid>, so nothing is committed" << std::endl;
+    std::cerr << "                          for the aggregator's group)" << std::endl;
+}
+
+inline bool parse_capture_options(int argc, char **argv, CaptureOptions &opts) {
+    if (argc < 2 || argv[1][0] == '-') return false;
+    opts.output = argv[1];
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--kafka") {
+            opts.brokers = value;
+        } else if (arg == "--csv") {
+            opts.csv_path = value;
+        } else if (arg == "--from") {
+            if (value == "earliest") opts.from_earliest = true;
+            else if (value == "latest") opts.from_earliest = false;
+            else {
+                std::cerr << "Unknown --from: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--duration") {
+            if (!parse_number_option(arg, value, opts.duration_s)) return false;
+        } else if (arg == "--max-ticks") {
+            if (!parse_number_option(arg, value, opts.max_ticks)) return false;
+        } else if (arg == "--symbols") {
+            opts.symbols_source = value;
+        } else if (arg == "--group") {
+            opts.group_id = value;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (opts.brokers.empty() == opts.csv_path.empty()) {
+        std::cerr << "Give exactly one of --kafka and --csv" << std::endl;
+        return false;
+    }
+    return true;
+}
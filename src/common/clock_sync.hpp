@@ -0,0 +1,391 @@
+#pragma once
+
+#include <sys/timex.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <librdkafka/rdkafka.h>
+#include "common/metrics.hpp"
+
+// Cross-host clock offset for one-way latency. Ticks are stamped with the
+// producer host's system_clock and compared with the aggregator's, so every
+// cross-host stage is off by the difference between the two clocks.
+//
+// Two sources of truth, both exported as metrics:
+//  - The kernel's own NTP/PTP discipline state (ntp_adjtime): whether the
+//    clock is synchronized, the daemon's last measured offset, and the
+//    kernel's maximum error bound. This bounds the error without measuring it.
+//  - A ping-pong over Kafka. The aggregator's ClockProbe sends a request on
+//    clock-sync every second; each producer's ClockResponder stamps its
+//    receive and send times and replies on clock-sync-replies, keyed by its
+//    hostname. The NTP estimate
+//        offset = ((t2 - t1) + (t3 - t4)) / 2    (responder minus probe clock)
+//    is exact when both legs take equally long. Both legs are one produce and
+//    one fetch through the same broker, without linger, and the sample with
+//    the smallest round trip out of the last 16 is used (NTP's clock filter).
+//    The error is then at most half that round trip.
+
+namespace clock_sync {
+
+constexpr const char *REQUEST_TOPIC = "clock-sync";
+constexpr const char *REPLY_TOPIC = "clock-sync-replies";
+
+struct Request {
+    char magic[4];     // "CLKQ"
+    uint32_t reserved;
+    uint64_t probe;    // random per aggregator process, so probes ignore each other's replies
+    uint64_t seq;
+    int64_t t1;        // probe clock at send
+};
+
+struct Reply {
+    char magic[4];     // "CLKR"
+    uint32_t reserved;
+    uint64_t probe;
+    uint64_t seq;
+    int64_t t1;
+    int64_t t2;        // responder clock at receive
+    int64_t t3;        // responder clock at reply
+};
+
+inline long long wall_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline std::string hostname() {
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) return "unknown";
+    return name;
+}
+
+// The kernel's view of its own clock discipline (chronyd, ntpd or ptp4l/phc2sys).
+struct KernelClock {
+    bool synchronized = false;
+    double offset_s = 0;     // last offset measured by the daemon
+    double max_error_s = 0;  // kernel's bound on the error, grows while unsynchronized
+    double est_error_s = 0;
+};
+
+inline KernelClock read_kernel_clock() {
+    KernelClock c;
+    struct timex tx;
+    memset(&tx, 0, sizeof(tx));
+    int state = ntp_adjtime(&tx);
+    if (state < 0) return c;
+    c.synchronized = state != TIME_ERROR && !(tx.status & STA_UNSYNC);
+    c.offset_s = (tx.status & STA_NANO) ? tx.offset / 1e9 : tx.offset / 1e6;
+    c.max_error_s = tx.maxerror / 1e6;
+    c.est_error_s = tx.esterror / 1e6;
+    return c;
+}
+
+// `prefix` is "producer" or "aggregator".
+inline void write_kernel_clock_metrics(MetricsWriter &m, const std::string &prefix) {
+    KernelClock c = read_kernel_clock();
+    m.gauge((prefix + "_clock_synchronized").c_str(), "1 while the kernel reports the clock NTP/PTP-synchronized",
+            c.synchronized ? 1 : 0);
+    m.gauge((prefix + "_clock_ntp_offset_seconds").c_str(), "Last clock offset measured by the NTP/PTP daemon",
+            c.offset_s);
+    m.gauge((prefix + "_clock_max_error_seconds").c_str(), "Kernel bound on the clock error", c.max_error_s);
+    m.gauge((prefix + "_clock_est_error_seconds").c_str(), "Kernel estimate of the clock error", c.est_error_s);
+}
+
+// Producer and consumer handles for the control topics. Both legs must not
+// linger, or the reply's send time would not be when it left.
+inline rd_kafka_t *create_producer(const std::string &brokers) {
+    char errstr[512];
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    if (rd_kafka_conf_set(conf, "bootstrap.servers", brokers.c_str(), errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK ||
+        rd_kafka_conf_set(conf, "linger.ms", "0", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        std::cerr << "Clock sync producer config: " << errstr << std::endl;
+        rd_kafka_conf_destroy(conf);
+        return NULL;
+    }
+    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+    if (!rk) std::cerr << "Failed to create clock sync producer: " << errstr << std::endl;
+    return rk;
+}
+
+// A group of its own, reading only what is produced from now on.
+inline rd_kafka_t *create_consumer(const std::string &brokers, const std::string &group, const char *topic) {
+    char errstr[512];
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    if (rd_kafka_conf_set(conf, "bootstrap.servers", brokers.c_str(), errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK ||
+        rd_kafka_conf_set(conf, "group.id", group.c_str(), errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK ||
+        rd_kafka_conf_set(conf, "auto.offset.reset", "latest", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK ||
+        rd_kafka_conf_set(conf, "enable.auto.commit", "false", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+        std::cerr << "Clock sync consumer config: " << errstr << std::endl;
+        rd_kafka_conf_destroy(conf);
+        return NULL;
+    }
+    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_CONSUMER, conf, errstr, sizeof(errstr));
+    if (!rk) {
+        std::cerr << "Failed to create clock sync consumer: " << errstr << std::endl;
+        return NULL;
+    }
+    rd_kafka_poll_set_consumer(rk);
+    rd_kafka_topic_partition_list_t *topics = rd_kafka_topic_partition_list_new(1);
+    rd_kafka_topic_partition_list_add(topics, topic, RD_KAFKA_PARTITION_UA);
+    rd_kafka_resp_err_t err = rd_kafka_subscribe(rk, topics);
+    rd_kafka_topic_partition_list_destroy(topics);
+    if (err) {
+        std::cerr << "Failed to subscribe to " << topic << ": " << rd_kafka_err2str(err) << std::endl;
+        rd_kafka_destroy(rk);
+        return NULL;
+    }
+    return rk;
+}
+
+}  // namespace clock_sync
+
+// Producer side: answers every probe's requests, stamped with this host's clock.
+class ClockResponder {
+public:
+    explicit ClockResponder(const std::string &brokers) : brokers_(brokers), name_(clock_sync::hostname()) {}
+    ~ClockResponder() { stop(); }
+
+    bool start() {
+        producer_ = clock_sync::create_producer(brokers_);
+        // One group per process: every responder must see every request
+        std::string group = "clock_responder-" + name_ + "-" + std::to_string(getpid());
+        consumer_ = producer_ ? clock_sync::create_consumer(brokers_, group, clock_sync::REQUEST_TOPIC) : NULL;
+        if (!consumer_) return false;
+        running_ = true;
+        thread_ = std::thread(&ClockResponder::loop, this);
+        return true;
+    }
+
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        if (consumer_) {
+            rd_kafka_consumer_close(consumer_);
+            rd_kafka_destroy(consumer_);
+            consumer_ = NULL;
+        }
+        if (producer_) {
+            rd_kafka_flush(producer_, 1000);
+            rd_kafka_destroy(producer_);
+            producer_ = NULL;
+        }
+    }
+
+    long long replies() const { return replies_.load(); }
+    const std::string &name() const { return name_; }
+
+private:
+    void loop() {
+        rd_kafka_topic_t *rkt = rd_kafka_topic_new(producer_, clock_sync::REPLY_TOPIC, NULL);
+        while (running_) {
+            rd_kafka_poll(producer_, 0);
+            rd_kafka_message_t *msg = rd_kafka_consumer_poll(consumer_, 100);
+            if (!msg) continue;
+            const long long t2 = clock_sync::wall_ns();
+            clock_sync::Request req;
+            if (!msg->err && msg->len == sizeof(req)) {
+                memcpy(&req, msg->payload, sizeof(req));
+                if (memcmp(req.magic, "CLKQ", 4) == 0) {
+                    clock_sync::Reply reply = {{'C', 'L', 'K', 'R'}, 0, req.probe, req.seq, req.t1, t2, 0};
+                    reply.t3 = clock_sync::wall_ns();
+                    if (rd_kafka_produce(rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY, &reply, sizeof(reply),
+                                         name_.data(), name_.size(), NULL) == 0) {
+                        replies_++;
+                    }
+                }
+            }
+            rd_kafka_message_destroy(msg);
+        }
+        rd_kafka_topic_destroy(rkt);
+    }
+
+    std::string brokers_;
+    std::string name_;
+    rd_kafka_t *producer_ = NULL;
+    rd_kafka_t *consumer_ = NULL;
+    std::atomic<bool> running_{false};
+    std::atomic<long long> replies_{0};
+    std::thread thread_;
+};
+
+// Aggregator side: probes once a second and keeps a filtered offset per
+// responder. correction_ns() is what to add to (local time - remote stamp):
+// the responder's clock minus ours, taken from the only responder heard in
+// the last 10 s. With several producer hosts a tick cannot be attributed to
+// one, so no correction is applied and their offsets are only reported.
+class ClockProbe {
+public:
+    struct Source {
+        std::string name;
+        long long offset_ns;  // responder minus local clock
+        long long rtt_ns;     // of the sample the offset came from; error <= rtt/2
+        long long samples;
+        long long last_seen_ns;
+    };
+
+    explicit ClockProbe(const std::string &brokers) : brokers_(brokers) {
+        std::random_device rd;
+        probe_id_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+    ~ClockProbe() { stop(); }
+
+    bool start() {
+        producer_ = clock_sync::create_producer(brokers_);
+        std::string group = "clock_probe-" + clock_sync::hostname() + "-" + std::to_string(getpid());
+        consumer_ = producer_ ? clock_sync::create_consumer(brokers_, group, clock_sync::REPLY_TOPIC) : NULL;
+        if (!consumer_) return false;
+        running_ = true;
+        thread_ = std::thread(&ClockProbe::loop, this);
+        return true;
+    }
+
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        if (consumer_) {
+            rd_kafka_consumer_close(consumer_);
+            rd_kafka_destroy(consumer_);
+            consumer_ = NULL;
+        }
+        if (producer_) {
+            rd_kafka_destroy(producer_);
+            producer_ = NULL;
+        }
+    }
+
+    // Read on the hot path: one relaxed load.
+    long long correction_ns() const { return correction_ns_.load(std::memory_order_relaxed); }
+    bool correcting() const { return correcting_.load(std::memory_order_relaxed); }
+
+    std::vector<Source> sources() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Source> out;
+        for (const auto &kv : filters_) out.push_back(kv.second.estimate(kv.first));
+        return out;
+    }
+
+    void write_metrics(MetricsWriter &m) const {
+        std::vector<Source> all = sources();
+        m.gauge("aggregator_clock_correction_seconds",
+                "Offset added to cross-host latencies (producer clock minus aggregator clock)",
+                correction_ns() / 1e9);
+        m.gauge("aggregator_clock_corrected", "1 while latencies are corrected by a single responder's offset",
+                correcting() ? 1 : 0);
+        m.header("aggregator_clock_offset_seconds", "Responder clock minus aggregator clock, min-RTT filtered",
+                 "gauge");
+        for (const auto &s : all) m.sample("aggregator_clock_offset_seconds", "source=\"" + s.name + "\"",
+                                           s.offset_ns / 1e9);
+        m.header("aggregator_clock_rtt_seconds", "Round trip of the sample behind the offset; error <= rtt/2",
+                 "gauge");
+        for (const auto &s : all) m.sample("aggregator_clock_rtt_seconds", "source=\"" + s.name + "\"",
+                                           s.rtt_ns / 1e9);
+    }
+
+private:
+    static constexpr size_t WINDOW = 16;
+    static constexpr long long STALE_NS = 10000000000LL;
+
+    struct Filter {
+        std::deque<std::pair<long long, long long>> samples;  // (rtt, offset)
+        long long count = 0;
+        long long last_seen_ns = 0;
+
+        void add(long long rtt, long long offset, long long now) {
+            samples.emplace_back(rtt, offset);
+            if (samples.size() > WINDOW) samples.pop_front();
+            count++;
+            last_seen_ns = now;
+        }
+
+        Source estimate(const std::string &name) const {
+            auto best = std::min_element(samples.begin(), samples.end());
+            return Source{name, best->second, best->first, count, last_seen_ns};
+        }
+    };
+
+    void loop() {
+        rd_kafka_topic_t *rkt = rd_kafka_topic_new(producer_, clock_sync::REQUEST_TOPIC, NULL);
+        uint64_t seq = 0;
+        long long next_probe_ns = 0;
+        std::string last_state;
+        while (running_) {
+            long long now = clock_sync::wall_ns();
+            if (now >= next_probe_ns) {
+                clock_sync::Request req = {{'C', 'L', 'K', 'Q'}, 0, probe_id_, ++seq, clock_sync::wall_ns()};
+                rd_kafka_produce(rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY, &req, sizeof(req), NULL, 0, NULL);
+                next_probe_ns = now + 1000000000LL;
+                update_correction(now, last_state);
+            }
+            rd_kafka_poll(producer_, 0);
+
+            rd_kafka_message_t *msg = rd_kafka_consumer_poll(consumer_, 50);
+            if (!msg) continue;
+            const long long t4 = clock_sync::wall_ns();
+            clock_sync::Reply r;
+            if (!msg->err && msg->len == sizeof(r)) {
+                memcpy(&r, msg->payload, sizeof(r));
+                if (memcmp(r.magic, "CLKR", 4) == 0 && r.probe == probe_id_) {
+                    long long rtt = (t4 - r.t1) - (r.t3 - r.t2);
+                    long long offset = ((r.t2 - r.t1) + (r.t3 - t4)) / 2;
+                    std::string name(static_cast<const char *>(msg->key), msg->key_len);
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    filters_[name].add(std::max(rtt, 0LL), offset, t4);
+                }
+            }
+            rd_kafka_message_destroy(msg);
+        }
+        rd_kafka_topic_destroy(rkt);
+    }
+
+    // Logs when the correction starts, stops or changes source.
+    void update_correction(long long now, std::string &last_state) {
+        std::vector<Source> live;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto &kv : filters_) {
+                if (now - kv.second.last_seen_ns < STALE_NS) live.push_back(kv.second.estimate(kv.first));
+            }
+        }
+        std::string state;
+        if (live.size() == 1) {
+            correction_ns_.store(live[0].offset_ns, std::memory_order_relaxed);
+            correcting_ = true;
+            state = "Clock sync: correcting latencies by " + std::to_string(live[0].offset_ns / 1e6) + " ms (" +
+                    live[0].name + ")";
+        } else {
+            correction_ns_.store(0, std::memory_order_relaxed);
+            correcting_ = false;
+            state = live.empty() ? "Clock sync: no responder, latencies are uncorrected"
+                                 : "Clock sync: " + std::to_string(live.size()) +
+                                       " responders, latencies are uncorrected (offsets in /metrics)";
+        }
+        // Only the source and corrected/uncorrected transitions are logged, not every new offset
+        std::string key = live.size() == 1 ? live[0].name : std::to_string(live.size());
+        if (key != last_state) {
+            std::cout << state << std::endl;
+            last_state = key;
+        }
+    }
+
+    std::string brokers_;
+    uint64_t probe_id_;
+    rd_kafka_t *producer_ = NULL;
+    rd_kafka_t *consumer_ = NULL;
+    std::atomic<bool> running_{false};
+    std::atomic<long long> correction_ns_{0};
+    std::atomic<bool> correcting_{false};
+    mutable std::mutex mutex_;
+    std::map<std::string, Filter> filters_;
+    std::thread thread_;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Minimal single-threaded HTTP/1.0 server for metrics and small JSON APIs.
+// Requests are served one at a time on a dedicated thread, which is plenty
+// for scrapers and keeps the hot threads free of any I/O.
+class HttpServer {
+public:
+    // Fills `body` and `content_type` for `path` (query string included).
+    // Returning false answers 404.
+    using Handler = std::function<bool(const std::string &path, std::string &body, std::string &content_type)>;
+
+    HttpServer(int port, Handler handler) : port_(port), handler_(std::move(handler)) {}
+    ~HttpServer() { stop(); }
+
+    HttpServer(const HttpServer &) = delete;
+    HttpServer &operator=(const HttpServer &) = delete;
+
+    bool start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd_ < 0) {
+            std::cerr << "HTTP server: socket() failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        int yes = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<uint16_t>(port_));
+        if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd_, 16) != 0) {
+            std::cerr << "HTTP server: cannot listen on port " << port_ << ": " << strerror(errno) << std::endl;
+            close(listen_fd_);
+            listen_fd_ = -1;
+            return false;
+        }
+
+        running_ = true;
+        thread_ = std::thread(&HttpServer::serve, this);
+        return true;
+    }
+
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        if (listen_fd_ >= 0) {
+            close(listen_fd_);
+            listen_fd_ = -1;
+        }
+    }
+
+    int port() const { return port_; }
+
+    // The serving thread, for pinning; valid after start().
+    std::thread::native_handle_type native_handle() { return thread_.native_handle(); }
+
+private:
+    void serve() {
+        while (running_) {
+            pollfd pfd = {listen_fd_, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0) continue;
+
+            int client = accept(listen_fd_, NULL, NULL);
+            if (client < 0) continue;
+
+            timeval tv = {1, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            handle(client);
+            close(client);
+        }
+    }
+
+    void handle(int client) {
+        char buf[4096];
+        ssize_t n = recv(client, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) return;
+        buf[n] = '\0';
+
+        // Request line: "GET /path HTTP/1.1"
+        std::string request(buf, static_cast<size_t>(n));
+        size_t sp1 = request.find(' ');
+        size_t sp2 = sp1 == std::string::npos ? std::string::npos : request.find(' ', sp1 + 1);
+        if (sp2 == std::string::npos || request.compare(0, sp1, "GET") != 0) {
+            respond(client, "405 Method Not Allowed", "text/plain", "method not allowed\n");
+            return;
+        }
+        std::string path = request.substr(sp1 + 1, sp2 - sp1 - 1);
+
+        std::string body;
+        std::string content_type = "text/plain; version=0.0.4";
+        if (handler_(path, body, content_type)) {
+            respond(client, "200 OK", content_type, body);
+        } else {
+            respond(client, "404 Not Found", "text/plain", "not found\n");
+        }
+    }
+
+    static void respond(int client, const char *status, const std::string &content_type, const std::string &body) {
+        std::string out = std::string("HTTP/1.0 ") + status + "\r\n"
+                        + "Content-Type: " + content_type + "\r\n"
+                        + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        + "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < out.size()) {
+            ssize_t n = send(client, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    int port_;
+    Handler handler_;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <librdkafka/rdkafka.h>
+
+// librdkafka properties passed through from the command line as KEY=VALUE,
+// e.g. fetch.min.bytes or fetch.wait.max.ms, for tuning without a rebuild.
+using KafkaProperties = std::vector<std::pair<std::string, std::string>>;
+
+inline bool parse_kafka_property(const std::string &spec, KafkaProperties &out) {
+    size_t eq = spec.find('=');
+    if (eq == 0 || eq == std::string::npos) return false;
+    out.emplace_back(spec.substr(0, eq), spec.substr(eq + 1));
+    return true;
+}
+
+// Applied after the built-in settings, so these win. Unknown keys and bad
+// values are reported with librdkafka's message.
+inline bool apply_kafka_properties(rd_kafka_conf_t *conf, const KafkaProperties &props) {
+    char errstr[512];
+    for (const auto &kv : props) {
+        if (rd_kafka_conf_set(conf, kv.first.c_str(), kv.second.c_str(), errstr, sizeof(errstr)) !=
+            RD_KAFKA_CONF_OK) {
+            std::cerr << "Invalid Kafka setting " << kv.first << ": " << errstr << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
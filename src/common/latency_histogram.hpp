@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// HDR-style log-linear histogram of nanosecond values. Values below 2^SUB_BITS
+// get exact buckets; above that each power of two is split into 2^(SUB_BITS-1)
+// linear sub-buckets, so every recorded value is within 1/128 (< 0.8%) of its
+// bucket's reported value. Covers 0 .. 2^MAX_BITS ns (~18 minutes); larger
+// values are clamped into the last bucket.
+//
+// One thread records, any thread may snapshot. Counters are relaxed atomics
+// updated with plain load/store (no locked RMW), so recording costs a few
+// cycles and nothing is shared between recording threads.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 8;
+    static constexpr int MAX_BITS = 40;
+    static constexpr uint64_t SUB_COUNT = 1ULL << SUB_BITS;
+    static constexpr uint64_t HALF_COUNT = SUB_COUNT / 2;
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS) * HALF_COUNT + SUB_COUNT;
+
+    LatencyHistogram() : counts_(new std::atomic<uint64_t>[BUCKETS]) {
+        for (size_t i = 0; i < BUCKETS; i++) counts_[i].store(0, std::memory_order_relaxed);
+    }
+
+    static size_t bucket_index(uint64_t v) {
+        if (v < SUB_COUNT) return static_cast<size_t>(v);
+        int magnitude = 63 - __builtin_clzll(v);
+        if (magnitude >= MAX_BITS) return BUCKETS - 1;
+        int shift = magnitude - SUB_BITS + 1;
+        return static_cast<size_t>(shift) * HALF_COUNT + static_cast<size_t>(v >> shift);
+    }
+
+    // Highest value that maps to bucket `idx`.
+    static uint64_t bucket_upper(size_t idx) {
+        if (idx < SUB_COUNT) return idx;
+        uint64_t shift = idx / HALF_COUNT - 1;
+        uint64_t sub = idx - shift * HALF_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void record(long long value_ns) {
+        uint64_t v = value_ns > 0 ? static_cast<uint64_t>(value_ns) : 0;
+        bump(counts_[bucket_index(v)], 1);
+        bump(total_count_, 1);
+        bump(total_sum_, v);
+        if (v > max_.load(std::memory_order_relaxed)) max_.store(v, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total_count_.load(std::memory_order_relaxed); }
+
+private:
+    friend struct HistogramSnapshot;
+
+    static void bump(std::atomic<uint64_t> &c, uint64_t by) {
+        c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> total_count_{0};
+    std::atomic<uint64_t> total_sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// Plain copy of one or more histograms, used for merging and percentiles.
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(LatencyHistogram::BUCKETS, 0);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void add(const LatencyHistogram &h) {
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            counts[i] += h.counts_[i].load(std::memory_order_relaxed);
+        }
+        count += h.total_count_.load(std::memory_order_relaxed);
+        sum += h.total_sum_.load(std::memory_order_relaxed);
+        max = std::max(max, h.max_.load(std::memory_order_relaxed));
+    }
+
+    // Values recorded since `earlier` (a previous snapshot of the same histograms).
+    // The exact max is not recoverable for an interval, so it is taken from
+    // the highest non-empty bucket.
+    HistogramSnapshot since(const HistogramSnapshot &earlier) const {
+        HistogramSnapshot delta;
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            delta.counts[i] = counts[i] - earlier.counts[i];
+            if (delta.counts[i] > 0) delta.max = LatencyHistogram::bucket_upper(i);
+        }
+        delta.count = count - earlier.count;
+        delta.sum = sum - earlier.sum;
+        delta.max = std::min(delta.max, max);
+        return delta;
+    }
+
+    // Value at quantile q in [0, 1], reported as the bucket's highest value.
+    uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        uint64_t target = static_cast<uint64_t>(q * static_cast<double>(count) + 0.5);
+        if (target < 1) target = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= target) return std::min(LatencyHistogram::bucket_upper(i), max);
+        }
+        return max;
+    }
+
+    double mean() const { return count ? static_cast<double>(sum) / static_cast<double>(count) : 0.0; }
+};
+
+// Owns every thread's histograms, grouped by stage name. Threads call
+// create() once at startup and record into the result without locking; the
+// reporter merges all histograms of a stage with snapshot().
+class HistogramRegistry {
+public:
+    LatencyHistogram *create(const std::string &stage) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.push_back({stage, std::unique_ptr<LatencyHistogram>(new LatencyHistogram())});
+        if (std::find(stages_.begin(), stages_.end(), stage) == stages_.end()) stages_.push_back(stage);
+        return entries_.back().histogram.get();
+    }
+
+    // Stage names in first-registration order.
+    std::vector<std::string> stages() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stages_;
+    }
+
+    HistogramSnapshot snapshot(const std::string &stage) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HistogramSnapshot snap;
+        for (const auto &e : entries_) {
+            if (e.stage == stage) snap.add(*e.histogram);
+        }
+        return snap;
+    }
+
+private:
+    struct Entry {
+        std::string stage;
+        std::unique_ptr<LatencyHistogram> histogram;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<Entry> entries_;
+    std::vector<std::string> stages_;
+};
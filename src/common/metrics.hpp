@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include "common/latency_histogram.hpp"
+
+// Builds a Prometheus text-format (version 0.0.4) exposition body.
+class MetricsWriter {
+public:
+    void counter(const char *name, const char *help, double value, const std::string &labels = "") {
+        header(name, help, "counter");
+        sample(name, labels, value);
+    }
+
+    void gauge(const char *name, const char *help, double value, const std::string &labels = "") {
+        header(name, help, "gauge");
+        sample(name, labels, value);
+    }
+
+    // Emits a summary with p50/p90/p99/p99.9 quantiles in seconds, plus _sum and _count.
+    void latency_summary(const char *name, const char *help, const HistogramSnapshot &h,
+                         const std::string &labels = "") {
+        header(name, help, "summary");
+        latency_samples(name, h, labels);
+    }
+
+    // Summary samples only, for families with several labelled series.
+    void latency_samples(const std::string &name, const HistogramSnapshot &h, const std::string &labels) {
+        static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        for (double q : quantiles) {
+            char qlabel[32];
+            snprintf(qlabel, sizeof(qlabel), "quantile=\"%g\"", q);
+            sample(name, join(labels, qlabel), h.percentile(q) / 1e9);
+        }
+        sample(name + "_sum", labels, h.sum / 1e9);
+        sample(name + "_count", labels, static_cast<double>(h.count));
+    }
+
+    // Continues the previous metric family with another labelled sample.
+    void sample(const std::string &name, const std::string &labels, double value) {
+        char num[64];
+        snprintf(num, sizeof(num), "%.10g", value);
+        out_ += name;
+        if (!labels.empty()) out_ += "{" + labels + "}";
+        out_ += " ";
+        out_ += num;
+        out_ += "\n";
+    }
+
+    void header(const char *name, const char *help, const char *type) {
+        out_ += "# HELP ";
+        out_ += name;
+        out_ += " ";
+        out_ += help;
+        out_ += "\n# TYPE ";
+        out_ += name;
+        out_ += " ";
+        out_ += type;
+        out_ += "\n";
+    }
+
+    std::string &str() { return out_; }
+
+private:
+    static std::string join(const std::string &a, const std::string &b) {
+        return a.empty() ? b : a + "," + b;
+    }
+
+    std::string out_;
+};
+
+// Latest librdkafka statistics JSON (statistics.interval.ms), stored by the
+// stats callback and read by the metrics endpoint.
+class KafkaStatsCache {
+public:
+    void store(const char *json, size_t len) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        json_.assign(json, len);
+    }
+
+    std::string load() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return json_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::string json_;
+};
+
+// First numeric value of `"key":` in a librdkafka stats document. Top-level
+// fields are emitted before the nested broker/topic objects, so for top-level
+// keys the first match is the right one.
+inline double kafka_stat(const std::string &json, const char *key) {
+    std::string needle = std::string("\"") + key + "\":";
+    size_t pos = json.find(needle);
+    if (pos == std::string::npos) return 0.0;
+    return std::strtod(json.c_str() + pos + needle.size(), NULL);
+}
+
+// Sum of every non-negative `"key":` value, e.g. per-partition consumer_lag
+// (librdkafka reports -1 for partitions it is not consuming).
+inline double kafka_stat_sum(const std::string &json, const char *key) {
+    std::string needle = std::string("\"") + key + "\":";
+    double total = 0.0;
+    for (size_t pos = json.find(needle); pos != std::string::npos; pos = json.find(needle, pos + 1)) {
+        double v = std::strtod(json.c_str() + pos + needle.size(), NULL);
+        if (v > 0) total += v;
+    }
+    return total;
+}
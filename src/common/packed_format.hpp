@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "packed wire format is little-endian");
+
+// Fixed-layout alternative to the protobuf MarketUpdate, 32 bytes,
+// little-endian, decoded with plain loads:
+//
+//   offset  size  field
+//        0     1  magic (0x00)
+//        1     1  version (1)
+//        2     2  flags (reserved, 0)
+//        4     4  symbol_id (shared dictionary, see symbol_loader.hpp)
+//        8     8  price (IEEE-754 double)
+//       16     8  volume (int64)
+//       24     8  timestamp_ns (int64, producer wall clock)
+//
+// A protobuf message can never start with 0x00 (field number 0 is invalid),
+// so a consumer can tell the two formats apart from the first payload byte
+// and both can share a topic during a rolling upgrade.
+namespace packed {
+
+constexpr uint8_t MAGIC = 0x00;
+constexpr uint8_t VERSION = 1;
+constexpr size_t SIZE = 32;
+
+struct Update {
+    uint32_t symbol_id;
+    double price;
+    int64_t volume;
+    int64_t timestamp_ns;
+};
+
+inline bool is_packed(const void *data, size_t len) {
+    return len > 0 && static_cast<const uint8_t *>(data)[0] == MAGIC;
+}
+
+// `out` must have room for SIZE bytes.
+inline void encode(const Update &u, void *out) {
+    uint8_t *p = static_cast<uint8_t *>(out);
+    p[0] = MAGIC;
+    p[1] = VERSION;
+    p[2] = 0;
+    p[3] = 0;
+    std::memcpy(p + 4, &u.symbol_id, 4);
+    std::memcpy(p + 8, &u.price, 8);
+    std::memcpy(p + 16, &u.volume, 8);
+    std::memcpy(p + 24, &u.timestamp_ns, 8);
+}
+
+// Rejects wrong sizes and unknown versions; longer payloads are not accepted
+// so a future version must bump VERSION rather than append silently.
+inline bool decode(const void *data, size_t len, Update &out) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    if (len != SIZE || p[0] != MAGIC || p[1] != VERSION) return false;
+    std::memcpy(&out.symbol_id, p + 4, 4);
+    std::memcpy(&out.price, p + 8, 8);
+    std::memcpy(&out.volume, p + 16, 8);
+    std::memcpy(&out.timestamp_ns, p + 24, 8);
+    return true;
+}
+
+}  // namespace packed
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+// Parses all of `text` as a T: no sign on unsigned types, no surrounding
+// spaces or trailing characters, and a value that fits T (finite, for
+// floating point). `out` is only written on success.
+template <typename T>
+inline bool parse_number(const std::string &text, T &out) {
+    static_assert(std::is_arithmetic<T>::value, "parse_number needs a numeric type");
+    T value{};
+    const char *first = text.data();
+    const char *last = first + text.size();
+    std::from_chars_result res = std::from_chars(first, last, value);
+    if (res.ec != std::errc() || res.ptr != last) return false;
+    if constexpr (std::is_floating_point<T>::value) {
+        if (!std::isfinite(value)) return false;
+    }
+    out = value;
+    return true;
+}
+
+// Command-line form: reports "Invalid --flag: value" so the caller can just
+// return false and let main print the usage.
+template <typename T>
+inline bool parse_number_option(const std::string &flag, const std::string &value, T &out) {
+    if (parse_number(value, out)) return true;
+    std::cerr << "Invalid " << flag << ": " << value << std::endl;
+    return false;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Shortest text that reads back as exactly `value` ("187.34", not the
+// "187.340000" of %f, which also rounds away digits past the sixth).
+// `out` needs room for 32 bytes; returns the length written.
+inline size_t format_double(double value, char *out) {
+    return static_cast<size_t>(std::to_chars(out, out + 32, value).ptr - out);
+}
+
+// Builds one Redis command as a RESP frame, ready for
+// redisAppendFormattedCommand / redisAsyncFormattedCommand, in a buffer that
+// is reused between commands: no format string is parsed and nothing is
+// allocated once the buffer has grown. The argument count is only known at
+// the end, so the "*<argc>" header is written into room kept free at the
+// front when the command is taken.
+class RespWriter {
+public:
+    void reset(std::string_view command) {
+        buf_.resize(HEADER_ROOM);
+        argc_ = 0;
+        add(command);
+    }
+
+    void add(std::string_view arg) {
+        char len[24];
+        len[0] = '$';
+        char *end = std::to_chars(len + 1, len + sizeof(len) - 2, arg.size()).ptr;
+        *end++ = '\r';
+        *end++ = '\n';
+        buf_.append(len, static_cast<size_t>(end - len));
+        buf_.append(arg.data(), arg.size());
+        buf_.append("\r\n", 2);
+        argc_++;
+    }
+
+    void add(double value) {
+        char tmp[32];
+        add(std::string_view(tmp, format_double(value, tmp)));
+    }
+
+    void add(long long value) {
+        char tmp[24];
+        add(std::string_view(tmp, static_cast<size_t>(std::to_chars(tmp, tmp + sizeof(tmp), value).ptr - tmp)));
+    }
+
+    // The finished frame; valid until the next reset()/add().
+    std::string_view command() {
+        char header[HEADER_ROOM];
+        header[0] = '*';
+        char *end = std::to_chars(header + 1, header + HEADER_ROOM - 2, argc_).ptr;
+        *end++ = '\r';
+        *end++ = '\n';
+        size_t len = static_cast<size_t>(end - header);
+        buf_.replace(HEADER_ROOM - len, len, header, len);
+        return std::string_view(buf_.data() + HEADER_ROOM - len, buf_.size() - HEADER_ROOM + len);
+    }
+
+    size_t argc() const { return argc_; }
+
+private:
+    static constexpr size_t HEADER_ROOM = 24;  // "*" + 20 digits + "\r\n"
+
+    std::string buf_ = std::string(HEADER_ROOM, '\0');
+    size_t argc_ = 0;
+};
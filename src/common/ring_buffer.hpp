@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bounded lock-free queue of preallocated slots (Vyukov's sequence-numbered
+// ring). Any number of producers and consumers may call it concurrently; in
+// this pipeline it is used MPSC. Capacity is rounded up to a power of two and
+// never grows, so a slow consumer shows up as try_push() failures instead of
+// unbounded memory.
+template <typename T>
+class BoundedRingBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "ring slots are copied by value");
+
+public:
+    explicit BoundedRingBuffer(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedRingBuffer(const BoundedRingBuffer &) = delete;
+    BoundedRingBuffer &operator=(const BoundedRingBuffer &) = delete;
+
+    bool try_push(const T &value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T &out) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = cell.data;
+                    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Appends up to `max` elements to `out`; returns how many were drained.
+    size_t pop_bulk(std::vector<T> &out, size_t max) {
+        size_t n = 0;
+        T value;
+        while (n < max && try_pop(value)) {
+            out.push_back(value);
+            n++;
+        }
+        return n;
+    }
+
+    size_t size_approx() const {
+        size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    alignas(CACHE_LINE) std::atomic<size_t> enqueue_pos_{0};
+    alignas(CACHE_LINE) std::atomic<size_t> dequeue_pos_{0};
+};
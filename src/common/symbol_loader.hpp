@@ -0,0 +1,92 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <hiredis/hiredis.h>
+#include "common/parse_number.hpp"
+#include "common/symbol_table.hpp"
+
+// Symbol dictionaries are loaded at startup so every process assigns the same
+// IDs: ID N is the Nth symbol of the source. Sources:
+//   /path/to/symbols.txt             one ticker per line, '#' starts a comment
+//   redis://host[:port]/key          Redis list, LRANGE key 0 -1
+// Symbols first seen at runtime are appended after the loaded ones.
+
+inline bool load_symbols_file(const std::string &path, SymbolTable &table) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open symbol file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        size_t b = line.find_first_not_of(" \t\r");
+        if (b == std::string::npos) continue;
+        size_t e = line.find_last_not_of(" \t\r");
+        std::string ticker = line.substr(b, e - b + 1);
+
+        if (table.intern(ticker) == SymbolTable::INVALID) {
+            std::cerr << "Cannot intern symbol '" << ticker << "' (raise --max-symbols)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool load_symbols_redis(const std::string &host, int port, const std::string &key, SymbolTable &table) {
+    redisContext *c = redisConnect(host.c_str(), port);
+    if (c == NULL || c->err) {
+        std::cerr << "Symbol load: Redis connection error: " << (c ? c->errstr : "allocate context") << std::endl;
+        if (c) redisFree(c);
+        return false;
+    }
+
+    bool ok = false;
+    redisReply *reply = (redisReply *)redisCommand(c, "LRANGE %s 0 -1", key.c_str());
+    if (reply && reply->type == REDIS_REPLY_ARRAY) {
+        ok = true;
+        for (size_t i = 0; i < reply->elements && ok; i++) {
+            const redisReply *item = reply->element[i];
+            if (item->type != REDIS_REPLY_STRING) continue;
+            if (table.intern(std::string_view(item->str, item->len)) == SymbolTable::INVALID) {
+                std::cerr << "Cannot intern symbol from Redis list " << key << std::endl;
+                ok = false;
+            }
+        }
+    } else {
+        std::cerr << "Symbol load: LRANGE " << key << " failed" << std::endl;
+    }
+
+    if (reply) freeReplyObject(reply);
+    redisFree(c);
+    return ok;
+}
+
+inline bool load_symbols(const std::string &source, SymbolTable &table) {
+    const std::string scheme = "redis://";
+    if (source.compare(0, scheme.size(), scheme) != 0) return load_symbols_file(source, table);
+
+    // redis://host[:port]/key
+    std::string rest = source.substr(scheme.size());
+    size_t slash = rest.find('/');
+    if (slash == std::string::npos || slash + 1 >= rest.size()) {
+        std::cerr << "Symbol source must be redis://host[:port]/key: " << source << std::endl;
+        return false;
+    }
+    std::string hostport = rest.substr(0, slash);
+    std::string key = rest.substr(slash + 1);
+    int port = 6379;
+    size_t colon = hostport.find(':');
+    if (colon != std::string::npos) {
+        if (!parse_number(hostport.substr(colon + 1), port) || port < 1 || port > 65535) {
+            std::cerr << "Invalid port in symbol source: " << source << std::endl;
+            return false;
+        }
+        hostport.resize(colon);
+    }
+    return load_symbols_redis(hostport, port, key, table);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// Interns ticker symbols to dense uint32_t IDs (0, 1, 2, ...) so per-message
+// state can be keyed by a small integer instead of a string.
+//
+// Lookups are lock-free: an open-addressing table of atomic slots is probed
+// and names are compared in place. Inserts take a mutex, write the name first
+// and publish the slot with a release store, so a reader that sees a slot
+// always sees its name. Capacity is fixed at construction.
+//
+// Names of up to MAX_NAME bytes are stored inline. Longer ones are copied to
+// an allocation of their own that lives as long as the table; the inline
+// bytes then hold its address and length.
+class SymbolTable {
+public:
+    static constexpr uint32_t INVALID = 0xFFFFFFFFu;
+    static constexpr size_t MAX_NAME = 15;
+
+    explicit SymbolTable(uint32_t capacity = 1 << 16) : capacity_(capacity), names_(new Name[capacity]) {
+        size_t slots = 2;
+        while (slots < static_cast<size_t>(capacity) * 2) slots <<= 1;
+        mask_ = slots - 1;
+        slots_.reset(new std::atomic<uint32_t>[slots]);
+        for (size_t i = 0; i < slots; i++) slots_[i].store(0, std::memory_order_relaxed);
+    }
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    uint32_t find(std::string_view name) const {
+        for (size_t i = hash(name) & mask_;; i = (i + 1) & mask_) {
+            uint32_t v = slots_[i].load(std::memory_order_acquire);
+            if (v == 0) return INVALID;
+            if (equals(names_[v - 1], name)) return v - 1;
+        }
+    }
+
+    // Returns the existing or newly assigned ID, or INVALID when the table is
+    // full or the name is empty.
+    uint32_t intern(std::string_view name) {
+        uint32_t id = find(name);
+        if (id != INVALID) return id;
+
+        std::lock_guard<std::mutex> lock(insert_mutex_);
+        id = find(name);
+        if (id != INVALID) return id;
+
+        uint32_t next = count_.load(std::memory_order_relaxed);
+        if (next >= capacity_ || name.empty() || name.size() > UINT32_MAX) return INVALID;
+
+        Name &slot_name = names_[next];
+        if (name.size() <= MAX_NAME) {
+            std::memcpy(slot_name.data, name.data(), name.size());
+            slot_name.len = static_cast<uint8_t>(name.size());
+        } else {
+            long_names_.emplace_back(new char[name.size()]);
+            const char *data = long_names_.back().get();
+            std::memcpy(long_names_.back().get(), name.data(), name.size());
+            const uint32_t len = static_cast<uint32_t>(name.size());
+            std::memcpy(slot_name.data, &data, sizeof(data));
+            std::memcpy(slot_name.data + sizeof(data), &len, sizeof(len));
+            slot_name.len = LONG_NAME;
+        }
+
+        size_t i = hash(name) & mask_;
+        while (slots_[i].load(std::memory_order_relaxed) != 0) i = (i + 1) & mask_;
+        slots_[i].store(next + 1, std::memory_order_release);
+        count_.store(next + 1, std::memory_order_release);
+        return next;
+    }
+
+    // `id` must have been returned by intern().
+    std::string_view name(uint32_t id) const { return view(names_[id]); }
+
+    uint32_t size() const { return count_.load(std::memory_order_acquire); }
+    uint32_t capacity() const { return capacity_; }
+
+private:
+    static constexpr uint8_t LONG_NAME = 0xFF;  // Name::len of an out-of-line name
+
+    struct Name {
+        char data[MAX_NAME];
+        uint8_t len = 0;
+    };
+    static_assert(MAX_NAME >= sizeof(const char *) + sizeof(uint32_t), "a long name's address and length fit inline");
+
+    static std::string_view view(const Name &n) {
+        if (n.len != LONG_NAME) return std::string_view(n.data, n.len);
+        const char *data;
+        uint32_t len;
+        std::memcpy(&data, n.data, sizeof(data));
+        std::memcpy(&len, n.data + sizeof(data), sizeof(len));
+        return std::string_view(data, len);
+    }
+
+    static uint64_t hash(std::string_view s) {
+        uint64_t h = 1469598103934665603ULL;  // FNV-1a
+        for (char c : s) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static bool equals(const Name &n, std::string_view s) {
+        if (n.len == LONG_NAME) return s.size() > MAX_NAME && view(n) == s;
+        return n.len == s.size() && std::memcmp(n.data, s.data(), s.size()) == 0;
+    }
+
+    uint32_t capacity_;
+    std::unique_ptr<Name[]> names_;
+    std::unique_ptr<std::atomic<uint32_t>[]> slots_;
+    size_t mask_;
+    std::atomic<uint32_t> count_{0};
+    std::vector<std::unique_ptr<char[]>> long_names_;  // written under insert_mutex_
+    std::mutex insert_mutex_;
+};
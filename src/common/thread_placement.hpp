@@ -0,0 +1,152 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Parses a taskset-style core list, "2-5,8,10-11".
+inline bool parse_cpu_list(const std::string &spec, std::vector<int> &out) {
+    out.clear();
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        size_t dash = item.find('-');
+        char *tail = NULL;
+        long first = std::strtol(item.c_str(), &tail, 10);
+        long last = first;
+        if (tail == item.c_str() || (dash == std::string::npos ? *tail != '\0' : tail != item.c_str() + dash)) {
+            return false;
+        }
+        if (dash != std::string::npos) {
+            const char *from = item.c_str() + dash + 1;
+            last = std::strtol(from, &tail, 10);
+            if (tail == from || *tail != '\0') return false;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return false;
+        for (long c = first; c <= last; c++) out.push_back(static_cast<int>(c));
+        pos = end + 1;
+    }
+    return !out.empty();
+}
+
+// NUMA node of a core from sysfs, -1 if unknown (no NUMA or no sysfs).
+inline int cpu_node(int cpu) {
+    std::error_code ec;
+    std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > 4 && name.compare(0, 4, "node") == 0) return std::atoi(name.c_str() + 4);
+    }
+    return -1;
+}
+
+// Spin-wait hint for busy loops: lets the sibling hyperthread run and saves
+// power without giving up the core.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Core lists per thread role from repeatable --cpus ROLE=LIST options. The
+// Nth thread of a role is pinned to the role's (N mod size)th core; roles
+// without a list keep the default affinity.
+//
+// Memory follows the same plan through Linux's first-touch policy: pages are
+// allocated on the node of the core that first writes them, so queues and
+// pools are constructed inside near() while the constructing thread runs on
+// its owner's core. That holds for large allocations, which malloc serves
+// with fresh pages; small ones may reuse heap pages from anywhere.
+class ThreadPlacement {
+public:
+    explicit ThreadPlacement(std::vector<std::string> roles) : roles_(std::move(roles)) {}
+
+    bool parse(const std::string &spec, std::string &error) {
+        size_t eq = spec.find('=');
+        std::string role = spec.substr(0, eq);
+        if (eq == std::string::npos || std::find(roles_.begin(), roles_.end(), role) == roles_.end()) {
+            error = "--cpus needs ROLE=LIST with ROLE one of";
+            for (const auto &r : roles_) error += " " + r;
+            return false;
+        }
+        if (!parse_cpu_list(spec.substr(eq + 1), cpus_[role])) {
+            error = "--cpus " + role + ": bad core list " + spec.substr(eq + 1);
+            return false;
+        }
+        return true;
+    }
+
+    bool empty() const { return cpus_.empty(); }
+    bool has(const std::string &role) const { return cpus_.count(role) > 0; }
+
+    // Core of the `index`th thread of `role`, -1 if the role is not placed.
+    int cpu(const std::string &role, size_t index) const {
+        auto it = cpus_.find(role);
+        if (it == cpus_.end()) return -1;
+        return it->second[index % it->second.size()];
+    }
+
+    // Pins `thread` (e.g. std::thread::native_handle(), or pthread_self()).
+    bool pin(pthread_t thread, const std::string &role, size_t index) const {
+        int c = cpu(role, index);
+        if (c < 0) return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(c, &set);
+        int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (err != 0) {
+            std::cerr << "Cannot pin " << role << " thread " << index << " to core " << c << ": " << strerror(err)
+                      << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Runs `fn` on the core of the `index`th `role` thread, so what it
+    // allocates and initializes lands on that core's NUMA node, then restores
+    // the caller's affinity.
+    template <typename Fn>
+    void near(const std::string &role, size_t index, Fn &&fn) const {
+        cpu_set_t saved;
+        bool moved = cpu(role, index) >= 0 &&
+                     pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0 &&
+                     pin(pthread_self(), role, index);
+        fn();
+        if (moved) pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+
+    // One line per placed role with the NUMA nodes its cores are on; a role
+    // spanning nodes is called out, as its threads share queues across sockets.
+    void log() const {
+        for (const auto &role : roles_) {
+            auto it = cpus_.find(role);
+            if (it == cpus_.end()) continue;
+            std::vector<int> nodes;
+            for (int c : it->second) {
+                int n = cpu_node(c);
+                if (n >= 0 && std::find(nodes.begin(), nodes.end(), n) == nodes.end()) nodes.push_back(n);
+            }
+            std::cout << "Threads " << role << ": cores";
+            for (int c : it->second) std::cout << " " << c;
+            if (nodes.size() == 1) std::cout << " (node " << nodes[0] << ")";
+            if (nodes.size() > 1) std::cout << " (warning: spans " << nodes.size() << " NUMA nodes)";
+            std::cout << std::endl;
+        }
+    }
+
+private:
+    std::vector<std::string> roles_;
+    std::map<std::string, std::vector<int>> cpus_;
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Recorded ticks for the producer's --replay mode. A capture file is
+//   header (64 bytes) | tick_count x ReplayTick | symbol_count x 16-byte name
+// in host byte order, ticks sorted by timestamp. Ticks name their symbol by
+// index into the capture's own table, so captures do not depend on any
+// --symbols dictionary. Files are mapped read-only and never copied; replay
+// threads stream through the mapping with the page cache behind it.
+//
+// TickCapture::open also reads a CSV export of market_updates:
+//   \copy (SELECT time, ticker, price, volume FROM market_updates
+//          WHERE time >= '...' ORDER BY time) TO 'session.csv' CSV HEADER
+// `time` may be ISO text ("2026-10-14 13:30:00.123456+00") or epoch
+// seconds; columns after volume are ignored.
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "capture files are little-endian");
+
+struct ReplayTick {
+    int64_t timestamp_ns;  // as recorded: the tick's exchange/producer time
+    double price;
+    int32_t volume;
+    uint32_t symbol;       // index into the capture's symbol table
+};
+static_assert(sizeof(ReplayTick) == 24, "capture record layout");
+
+namespace capture {
+
+constexpr char MAGIC[8] = {'T', 'I', 'C', 'K', 'C', 'A', 'P', '1'};
+constexpr size_t HEADER_SIZE = 64;
+constexpr size_t NAME_SIZE = 16;  // SymbolTable::MAX_NAME + NUL
+
+struct Header {
+    char magic[8];
+    uint64_t tick_count;
+    uint64_t symbol_count;
+    uint64_t symbols_offset;
+    int64_t first_ns;
+    int64_t last_ns;
+    uint64_t reserved[2];
+};
+static_assert(sizeof(Header) == HEADER_SIZE, "capture header layout");
+
+// Days since 1970-01-01 of a proleptic Gregorian date (Howard Hinnant's algorithm).
+inline int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// Reads exactly `n` digits at p; false if any is not a digit.
+inline bool read_digits(const char *&p, const char *end, int n, int64_t &out) {
+    out = 0;
+    for (int i = 0; i < n; i++, p++) {
+        if (p >= end || *p < '0' || *p > '9') return false;
+        out = out * 10 + (*p - '0');
+    }
+    return true;
+}
+
+// Digits of a fraction after '.', scaled to nanoseconds; extra digits are dropped.
+inline int64_t read_fraction_ns(const char *&p, const char *end) {
+    int64_t ns = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (digits < 9) {
+            ns = ns * 10 + (*p - '0');
+            digits++;
+        }
+    }
+    for (; digits < 9; digits++) ns *= 10;
+    return ns;
+}
+
+// "YYYY-MM-DD[ T]HH:MM:SS[.f][Z|+HH[:MM]|-HH[:MM]]" (no zone = UTC), or epoch
+// seconds with an optional fraction.
+inline bool parse_timestamp_ns(std::string_view text, int64_t &out) {
+    const char *p = text.data(), *end = text.data() + text.size();
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    if (p == digits) return false;
+    if (p == end || *p == '.') {
+        int64_t seconds = 0;
+        for (const char *q = digits; q < p; q++) seconds = seconds * 10 + (*q - '0');
+        int64_t frac = 0;
+        if (p < end) {
+            p++;
+            frac = read_fraction_ns(p, end);
+        }
+        out = seconds * 1000000000 + frac;
+        return p == end;
+    }
+
+    p = text.data();
+    int64_t y, mo, d, h, mi, s;
+    if (!read_digits(p, end, 4, y) || p >= end || *p++ != '-' || !read_digits(p, end, 2, mo) || p >= end ||
+        *p++ != '-' || !read_digits(p, end, 2, d) || p >= end || (*p != ' ' && *p != 'T') ||
+        !read_digits(++p, end, 2, h) || p >= end || *p++ != ':' || !read_digits(p, end, 2, mi) || p >= end ||
+        *p++ != ':' || !read_digits(p, end, 2, s)) {
+        return false;
+    }
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 60) return false;
+    int64_t frac = 0;
+    if (p < end && *p == '.') frac = read_fraction_ns(++p, end);
+
+    int64_t offset_s = 0;
+    if (p < end && *p == 'Z') {
+        p++;
+    } else if (p < end && (*p == '+' || *p == '-')) {
+        int sign = *p++ == '-' ? -1 : 1;
+        int64_t oh, om = 0;
+        if (!read_digits(p, end, 2, oh)) return false;
+        if (p < end && *p == ':') p++;
+        if (p < end && !read_digits(p, end, 2, om)) return false;
+        offset_s = sign * (oh * 3600 + om * 60);
+    }
+    if (p != end) return false;
+
+    int64_t days = days_from_civil(y, static_cast<unsigned>(mo), static_cast<unsigned>(d));
+    out = ((days * 86400 + h * 3600 + mi * 60 + s) - offset_s) * 1000000000 + frac;
+    return true;
+}
+
+}  // namespace capture
+
+// Builds a capture file. Ticks are held in memory (24 bytes each) until
+// finish() sorts them by time, since consumed partitions interleave, and
+// writes the file in one pass.
+class TickCaptureWriter {
+public:
+    // Returns the capture-local index of `ticker`, or -1 if it cannot be
+    // stored (longer than 15 bytes).
+    int64_t symbol(std::string_view ticker) {
+        if (ticker.size() >= capture::NAME_SIZE) return -1;
+        auto it = index_.find(std::string(ticker));
+        if (it != index_.end()) return it->second;
+        uint32_t id = static_cast<uint32_t>(names_.size());
+        names_.emplace_back(ticker);
+        index_.emplace(names_.back(), id);
+        return id;
+    }
+
+    bool add(std::string_view ticker, double price, int32_t volume, int64_t timestamp_ns) {
+        int64_t id = symbol(ticker);
+        if (id < 0) return false;
+        ticks_.push_back({timestamp_ns, price, volume, static_cast<uint32_t>(id)});
+        return true;
+    }
+
+    size_t size() const { return ticks_.size(); }
+    const std::vector<std::string>& names() const { return names_; }
+
+    bool finish(const std::string& path, std::string& error) {
+        std::stable_sort(ticks_.begin(), ticks_.end(),
+                         [](const ReplayTick& a, const ReplayTick& b) { return a.timestamp_ns < b.timestamp_ns; });
+        capture::Header h = {};
+        memcpy(h.magic, capture::MAGIC, sizeof(h.magic));
+        h.tick_count = ticks_.size();
+        h.symbol_count = names_.size();
+        h.symbols_offset = capture::HEADER_SIZE + ticks_.size() * sizeof(ReplayTick);
+        h.first_ns = ticks_.empty() ? 0 : ticks_.front().timestamp_ns;
+        h.last_ns = ticks_.empty() ? 0 : ticks_.back().timestamp_ns;
+
+        std::string tmp = path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (!f) {
+            error = "cannot create " + tmp + ": " + strerror(errno);
+            return false;
+        }
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+                  (ticks_.empty() || fwrite(ticks_.data(), sizeof(ReplayTick), ticks_.size(), f) == ticks_.size());
+        for (size_t i = 0; ok && i < names_.size(); i++) {
+            char name[capture::NAME_SIZE] = {};
+            memcpy(name, names_[i].data(), names_[i].size());
+            ok = fwrite(name, sizeof(name), 1, f) == 1;
+        }
+        ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+        if (fclose(f) != 0) ok = false;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            error = "cannot write " + path + ": " + strerror(errno);
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<ReplayTick> ticks_;
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, uint32_t> index_;
+};
+
+// Read side: a mapped capture file or a parsed CSV export, sorted by time.
+class TickCapture {
+public:
+    TickCapture() = default;
+    TickCapture(const TickCapture &) = delete;
+    TickCapture &operator=(const TickCapture &) = delete;
+    ~TickCapture() {
+        if (map_) munmap(map_, map_size_);
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+        char magic[sizeof(capture::MAGIC)] = {};
+        bool binary = pread(fd, magic, sizeof(magic), 0) == static_cast<ssize_t>(sizeof(magic)) &&
+                      memcmp(magic, capture::MAGIC, sizeof(magic)) == 0;
+        bool ok = binary ? map(fd, path, error) : parse_csv(path, error);
+        close(fd);
+        return ok;
+    }
+
+    const ReplayTick *ticks() const { return ticks_; }
+    size_t size() const { return count_; }
+    const std::vector<std::string>& symbols() const { return names_; }
+    bool mapped() const { return map_ != NULL; }
+
+    // Recorded time covered, first to last tick.
+    int64_t span_ns() const { return count_ ? ticks_[count_ - 1].timestamp_ns - ticks_[0].timestamp_ns : 0; }
+
+private:
+    bool map(int fd, const std::string& path, std::string& error) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < capture::HEADER_SIZE) {
+            error = path + ": truncated capture header";
+            return false;
+        }
+        map_size_ = static_cast<size_t>(st.st_size);
+        void *p = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            error = "cannot map " + path + ": " + strerror(errno);
+            return false;
+        }
+        map_ = p;
+        madvise(map_, map_size_, MADV_SEQUENTIAL);  // readahead for the replay threads' forward scan
+
+        capture::Header h;
+        memcpy(&h, map_, sizeof(h));
+        if (h.symbols_offset != capture::HEADER_SIZE + h.tick_count * sizeof(ReplayTick) ||
+            h.symbols_offset + h.symbol_count * capture::NAME_SIZE > map_size_) {
+            error = path + ": header does not match the file size (unfinished capture?)";
+            return false;
+        }
+        const char *base = static_cast<const char *>(map_);
+        for (uint64_t i = 0; i < h.symbol_count; i++) {
+            const char *name = base + h.symbols_offset + i * capture::NAME_SIZE;
+            names_.emplace_back(name, strnlen(name, capture::NAME_SIZE - 1));
+        }
+        ticks_ = reinterpret_cast<const ReplayTick *>(base + capture::HEADER_SIZE);
+        count_ = h.tick_count;
+        for (size_t i = 0; i < count_; i++) {
+            if (ticks_[i].symbol >= names_.size() || (i > 0 && ticks_[i].timestamp_ns < ticks_[i - 1].timestamp_ns)) {
+                error = path + ": tick " + std::to_string(i) + " is out of order or names no symbol";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // time,ticker,price,volume[,...] with an optional header line; Postgres
+    // only quotes fields that need it, so quotes are simply stripped.
+    bool parse_csv(const std::string& path, std::string& error) {
+        std::ifstream in(path);
+        if (!in) {
+            error = "cannot open " + path;
+            return false;
+        }
+        TickCaptureWriter symbols;
+        std::string line;
+        std::string_view fields[4];
+        size_t line_no = 0;
+        while (std::getline(in, line)) {
+            line_no++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            std::string_view rest = line;
+            int n = 0;
+            for (; n < 4 && !rest.empty(); n++) {
+                size_t comma = rest.find(',');
+                std::string_view f = rest.substr(0, comma);
+                if (f.size() >= 2 && f.front() == '"' && f.back() == '"') f = f.substr(1, f.size() - 2);
+                fields[n] = f;
+                rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+            }
+
+            ReplayTick t;
+            int64_t id;
+            char *end = NULL;
+            bool ok = n == 4 && capture::parse_timestamp_ns(fields[0], t.timestamp_ns) &&
+                      (id = symbols.symbol(fields[1])) >= 0;
+            if (ok) {
+                std::string price(fields[2]), volume(fields[3]);
+                t.price = strtod(price.c_str(), &end);
+                ok = end != price.c_str() && *end == '\0';
+                if (ok) {
+                    t.volume = static_cast<int32_t>(strtol(volume.c_str(), &end, 10));
+                    ok = end != volume.c_str() && *end == '\0';
+                }
+                t.symbol = static_cast<uint32_t>(id);
+            }
+            if (!ok) {
+                if (line_no == 1) continue;  // column names
+                error = path + ":" + std::to_string(line_no) + ": expected time,ticker,price,volume (tickers up to 15 characters)";
+                return false;
+            }
+            owned_.push_back(t);
+        }
+        std::stable_sort(owned_.begin(), owned_.end(),
+                         [](const ReplayTick& a, const ReplayTick& b) { return a.timestamp_ns < b.timestamp_ns; });
+        names_ = symbols.names();
+        ticks_ = owned_.data();
+        count_ = owned_.size();
+        return true;
+    }
+
+    void *map_ = NULL;
+    size_t map_size_ = 0;
+    std::vector<ReplayTick> owned_;  // CSV input
+    const ReplayTick *ticks_ = NULL;
+    size_t count_ = 0;
+    std::vector<std::string> names_;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Lets one consumer thread sleep until producers have queued enough work or
+// a deadline passes, without a syscall per item. The consumer states how
+// deep its queue must get before it wants to be woken; producers call
+// notify() after each push and only write the eventfd while the consumer is
+// sleeping and that depth is reached.
+//
+// wait() advertises sleeping before re-checking its `ready` predicate and
+// notify() loads the flag after pushing (both seq_cst), so a push can never
+// fall between the check and the poll unnoticed.
+class Wakeup {
+public:
+    Wakeup() : fd_(eventfd(0, EFD_NONBLOCK)) {}
+    ~Wakeup() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    Wakeup(const Wakeup &) = delete;
+    Wakeup &operator=(const Wakeup &) = delete;
+
+    // Consumer: sleeps up to `timeout_ns` unless ready() holds, a producer
+    // sees a queue depth of at least `wake_depth`, or `also_fd` (>= 0, e.g. a
+    // database socket with replies outstanding) becomes readable.
+    template <typename Ready>
+    void wait(long long timeout_ns, size_t wake_depth, Ready ready, int also_fd = -1) {
+        wake_depth_.store(wake_depth, std::memory_order_relaxed);
+        sleeping_.store(true, std::memory_order_seq_cst);
+        if (!ready() && timeout_ns > 0) {
+            struct pollfd pfd[2] = {{fd_, POLLIN, 0}, {also_fd, POLLIN, 0}};
+            struct timespec ts = {static_cast<time_t>(timeout_ns / 1000000000LL), static_cast<long>(timeout_ns % 1000000000LL)};
+            if (ppoll(pfd, also_fd >= 0 ? 2 : 1, &ts, NULL) > 0 && (pfd[0].revents & POLLIN)) {
+                uint64_t v;
+                ssize_t r = read(fd_, &v, sizeof(v));
+                (void)r;
+            }
+        }
+        sleeping_.store(false, std::memory_order_seq_cst);
+    }
+
+    // Producer, after pushing: `depth` is the queue depth it observed.
+    void notify(size_t depth) {
+        if (sleeping_.load(std::memory_order_seq_cst) && depth >= wake_depth_.load(std::memory_order_relaxed)) {
+            notify_now();
+        }
+    }
+
+    // Unconditional, e.g. on shutdown.
+    void notify_now() {
+        uint64_t one = 1;
+        ssize_t r = write(fd_, &one, sizeof(one));
+        (void)r;
+    }
+
+private:
+    int fd_;
+    std::atomic<bool> sleeping_{false};
+    std::atomic<size_t> wake_depth_{1};
+};
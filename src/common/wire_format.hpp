@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Decoded MarketUpdate that borrows the ticker bytes from the message payload.
+struct MarketUpdateView {
+    std::string_view ticker;
+    double price = 0.0;
+    int64_t volume = 0;
+    int64_t timestamp_ns = 0;
+};
+
+namespace wire {
+
+inline bool read_varint(const uint8_t *&p, const uint8_t *end, uint64_t &out) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            out = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Skips one field of the given wire type; false on malformed input.
+inline bool skip_field(const uint8_t *&p, const uint8_t *end, uint32_t wire_type) {
+    uint64_t len;
+    switch (wire_type) {
+        case 0: return read_varint(p, end, len);
+        case 1: if (end - p < 8) return false; p += 8; return true;
+        case 2:
+            if (!read_varint(p, end, len) || static_cast<uint64_t>(end - p) < len) return false;
+            p += len;
+            return true;
+        case 5: if (end - p < 4) return false; p += 4; return true;
+        default: return false;
+    }
+}
+
+}  // namespace wire
+
+// Hand-written protobuf wire-format reader for marketdata.MarketUpdate
+// (market_data.proto). It parses straight from the Kafka payload without
+// building a message object or copying the ticker, and skips unknown fields
+// so newer producers stay compatible. Missing fields keep proto3 defaults.
+inline bool decode_market_update(const void *data, size_t len, MarketUpdateView &out) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + len;
+    out = MarketUpdateView();
+
+    while (p < end) {
+        uint64_t tag;
+        if (!wire::read_varint(p, end, tag)) return false;
+        uint32_t field = static_cast<uint32_t>(tag >> 3);
+        uint32_t wire_type = static_cast<uint32_t>(tag & 7);
+
+        if (field == 1 && wire_type == 2) {
+            uint64_t n;
+            if (!wire::read_varint(p, end, n) || static_cast<uint64_t>(end - p) < n) return false;
+            out.ticker = std::string_view(reinterpret_cast<const char *>(p), static_cast<size_t>(n));
+            p += n;
+        } else if (field == 2 && wire_type == 1) {
+            if (end - p < 8) return false;
+            std::memcpy(&out.price, p, 8);  // fixed64 is little-endian on the wire
+            p += 8;
+        } else if (field == 3 && wire_type == 0) {
+            uint64_t v;
+            if (!wire::read_varint(p, end, v)) return false;
+            out.volume = static_cast<int64_t>(v);
+        } else if (field == 4 && wire_type == 0) {
+            uint64_t v;
+            if (!wire::read_varint(p, end, v)) return false;
+            out.timestamp_ns = static_cast<int64_t>(v);
+        } else if (field == 0 || !wire::skip_field(p, end, wire_type)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// MarketUpdateBatch fields are numbered from 8, so its first tag byte is
+// 0x40 or above while a MarketUpdate's is below 0x28.
+inline bool is_market_update_batch(const void *data, size_t len) {
+    if (len == 0) return false;
+    uint8_t tag = *static_cast<const uint8_t *>(data);
+    return tag < 0x80 && (tag >> 3) >= 8;
+}
+
+// Reused between calls so decoding a batch does not allocate once warm.
+struct MarketUpdateBatchScratch {
+    std::vector<std::string_view> symbols;
+    std::vector<int64_t> last_price;
+};
+
+// Decodes marketdata.MarketUpdateBatch in one pass over the payload, one view
+// per tick in send order; tickers borrow from the payload. Delta columns are
+// recorded as byte ranges and then walked together, so they must each be a
+// single packed run, which is how every encoder writes proto3 scalars.
+inline bool decode_market_update_batch(const void *data, size_t len, std::vector<MarketUpdateView> &out,
+                                       MarketUpdateBatchScratch &scratch) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + len;
+    out.clear();
+    scratch.symbols.clear();
+
+    // symbol_index, price_delta, timestamp_delta_ns, volume
+    const uint8_t *col[4] = {NULL, NULL, NULL, NULL};
+    const uint8_t *col_end[4] = {NULL, NULL, NULL, NULL};
+
+    while (p < end) {
+        uint64_t tag;
+        if (!wire::read_varint(p, end, tag)) return false;
+        uint32_t field = static_cast<uint32_t>(tag >> 3);
+        uint32_t wire_type = static_cast<uint32_t>(tag & 7);
+
+        if (field >= 8 && field <= 13 && wire_type == 2) {
+            uint64_t n;
+            if (!wire::read_varint(p, end, n) || static_cast<uint64_t>(end - p) < n) return false;
+            if (field == 8) {
+                MarketUpdateView view;
+                if (!decode_market_update(p, static_cast<size_t>(n), view)) return false;
+                out.push_back(view);
+            } else if (field == 9) {
+                scratch.symbols.emplace_back(reinterpret_cast<const char *>(p), static_cast<size_t>(n));
+            } else {
+                int c = static_cast<int>(field) - 10;
+                if (col[c]) return false;
+                col[c] = p;
+                col_end[c] = p + n;
+            }
+            p += n;
+        } else if (field == 0 || !wire::skip_field(p, end, wire_type)) {
+            return false;
+        }
+    }
+
+    if (!col[0]) return col[1] == NULL && col[2] == NULL && col[3] == NULL;
+    for (int c = 1; c < 4; c++) {
+        if (!col[c]) return false;
+    }
+
+    scratch.last_price.assign(scratch.symbols.size(), 0);
+    int64_t timestamp_ns = 0;
+    while (col[0] < col_end[0]) {
+        uint64_t index, price_zz, ts_zz, volume;
+        if (!wire::read_varint(col[0], col_end[0], index) || !wire::read_varint(col[1], col_end[1], price_zz) ||
+            !wire::read_varint(col[2], col_end[2], ts_zz) || !wire::read_varint(col[3], col_end[3], volume)) {
+            return false;
+        }
+        if (index >= scratch.symbols.size()) return false;
+
+        int64_t &price = scratch.last_price[index];
+        price += static_cast<int64_t>(price_zz >> 1) ^ -static_cast<int64_t>(price_zz & 1);
+        timestamp_ns += static_cast<int64_t>(ts_zz >> 1) ^ -static_cast<int64_t>(ts_zz & 1);
+
+        MarketUpdateView view;
+        view.ticker = scratch.symbols[index];
+        view.price = price / 1e6;
+        view.volume = static_cast<int64_t>(volume);
+        view.timestamp_ns = timestamp_ns;
+        out.push_back(view);
+    }
+    for (int c = 1; c < 4; c++) {
+        if (col[c] != col_end[c]) return false;  // columns of different lengths
+    }
+    return true;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Target send rate as a function of time since the run started. Specs:
+//   constant                   hold --rate
+//   ramp:S                     0 -> --rate linearly over S seconds, then hold
+//   step:S:N                   N equal steps up to --rate, S seconds each, then hold
+//   spike:P:L:M                --rate, with an L-second burst at M x --rate every P seconds
+//   replay:FILE                one msg/s value per line, one line per second, looped;
+//                              values are scaled so the file's peak equals --rate
+class LoadProfile {
+public:
+    enum Kind { Constant, Ramp, Step, Spike, Replay };
+
+    static bool parse(const std::string &spec, double rate, LoadProfile &out, std::string &error) {
+        out = LoadProfile();
+        out.rate_ = rate;
+        std::vector<std::string> parts;
+        size_t pos = 0;
+        // replay:FILE keeps any ':' in the path
+        size_t limit = spec.compare(0, 7, "replay:") == 0 ? 1 : std::string::npos;
+        while (true) {
+            size_t colon = parts.size() < limit ? spec.find(':', pos) : std::string::npos;
+            parts.push_back(spec.substr(pos, colon == std::string::npos ? std::string::npos : colon - pos));
+            if (colon == std::string::npos) break;
+            pos = colon + 1;
+        }
+
+        const std::string &kind = parts[0];
+        if (kind == "constant" && parts.size() == 1) {
+            out.kind_ = Constant;
+        } else if (kind == "ramp" && parts.size() == 2) {
+            out.kind_ = Ramp;
+            out.a_ = std::atof(parts[1].c_str());
+        } else if (kind == "step" && parts.size() == 3) {
+            out.kind_ = Step;
+            out.a_ = std::atof(parts[1].c_str());
+            out.b_ = std::atof(parts[2].c_str());
+        } else if (kind == "spike" && parts.size() == 4) {
+            out.kind_ = Spike;
+            out.a_ = std::atof(parts[1].c_str());
+            out.b_ = std::atof(parts[2].c_str());
+            out.c_ = std::atof(parts[3].c_str());
+        } else if (kind == "replay" && parts.size() == 2) {
+            out.kind_ = Replay;
+            return out.load_replay(parts[1], error);
+        } else {
+            error = "unknown profile '" + spec + "'";
+            return false;
+        }
+        if ((out.kind_ != Constant && out.a_ <= 0) || (out.kind_ == Step && out.b_ < 1) ||
+            (out.kind_ == Spike && (out.b_ <= 0 || out.c_ <= 0))) {
+            error = "invalid parameters in profile '" + spec + "'";
+            return false;
+        }
+        return true;
+    }
+
+    // msg/s wanted at `t` seconds into the run.
+    double rate_at(double t) const {
+        switch (kind_) {
+            case Constant: return rate_;
+            case Ramp: return t >= a_ ? rate_ : rate_ * t / a_;
+            case Step: {
+                double step = std::floor(t / a_) + 1;
+                return rate_ * std::min(step, b_) / b_;
+            }
+            case Spike: return std::fmod(t, a_) < b_ ? rate_ * c_ : rate_;
+            case Replay: {
+                size_t second = static_cast<size_t>(t) % replay_.size();
+                return replay_[second];
+            }
+        }
+        return rate_;
+    }
+
+private:
+    bool load_replay(const std::string &path, std::string &error) {
+        std::ifstream in(path);
+        if (!in) {
+            error = "cannot open replay file " + path;
+            return false;
+        }
+        std::string line;
+        double peak = 0;
+        while (std::getline(in, line)) {
+            size_t hash = line.find('#');
+            if (hash != std::string::npos) line.resize(hash);
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            double v = std::atof(line.c_str());
+            replay_.push_back(v < 0 ? 0 : v);
+            peak = std::max(peak, replay_.back());
+        }
+        if (replay_.empty() || peak <= 0) {
+            error = "replay file " + path + " has no positive rates";
+            return false;
+        }
+        for (double &v : replay_) v = v * rate_ / peak;
+        return true;
+    }
+
+    Kind kind_ = Constant;
+    double rate_ = 0;
+    double a_ = 0, b_ = 0, c_ = 0;
+    std::vector<double> replay_;
+};
+
+// Open-loop send schedule for one producer thread that carries `share` of the
+// profile's rate. Send times are fixed in advance by integrating the rate, so
+// a stall does not slow the schedule down: the thread sends its backlog as
+// fast as it can and each message keeps its intended send time. Stamping
+// messages with that time (not the time they actually left) keeps measured
+// latency free of coordinated omission.
+class PacedSchedule {
+public:
+    PacedSchedule(const LoadProfile &profile, double share, long long start_ns)
+        : profile_(profile), share_(share), start_ns_(start_ns), next_ns_(start_ns) {}
+
+    // Monotonic ns at which the next message is due; advances the schedule.
+    long long next() {
+        const long long slice_ns = 1000000;
+        for (;;) {
+            double t = (next_ns_ - start_ns_) / 1e9;
+            double rate = profile_.rate_at(t) * share_;
+            double interval_ns = rate > 0 ? 1e9 / rate : 0;
+            if (rate > 0 && interval_ns <= slice_ns) {
+                long long due = next_ns_;
+                next_ns_ += static_cast<long long>(interval_ns);
+                return due;
+            }
+            // Slow or idle stretch (e.g. the start of a ramp): integrate the
+            // rate 1 ms at a time so one tiny rate cannot push the next send
+            // far past the point where the profile speeds up again
+            credit_ += rate * slice_ns / 1e9;
+            next_ns_ += slice_ns;
+            if (credit_ >= 1.0) {
+                credit_ -= 1.0;
+                return next_ns_;
+            }
+        }
+    }
+
+    long long start_ns() const { return start_ns_; }
+
+private:
+    const LoadProfile &profile_;
+    double share_;
+    long long start_ns_;
+    long long next_ns_;
+    double credit_ = 0;  // fractional messages owed while below 1 per slice
+};
+
+// Sleeps until monotonic `due_ns`, spinning for the last stretch because
+// sleep_for overshoots by tens of microseconds. Returns at once when late.
+inline void wait_until_ns(long long due_ns, long long (*now_ns)()) {
+    const long long spin_ns = 50000;
+    long long now = now_ns();
+    if (due_ns - now > spin_ns) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - now - spin_ns));
+    }
+    while (now_ns() < due_ns) {
+    }
+}
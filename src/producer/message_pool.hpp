@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "common/ring_buffer.hpp"
+
+// Fixed-size payload buffers for one producer thread. Messages are
+// serialized straight into a slot and handed to librdkafka without
+// RD_KAFKA_MSG_F_COPY; the delivery report returns the slot. Reports may be
+// served by whichever thread polls, so the free list is the lock-free MPMC
+// ring and release() is safe from any thread.
+class MessagePool {
+public:
+    MessagePool(size_t slots, size_t slot_bytes)
+        : slot_bytes_(slot_bytes), slots_(slots), storage_(new char[slots * slot_bytes]), free_(slots) {
+        for (size_t i = 0; i < slots; i++) free_.try_push(static_cast<uint32_t>(i));
+    }
+
+    MessagePool(const MessagePool &) = delete;
+    MessagePool &operator=(const MessagePool &) = delete;
+
+    // NULL when every slot is in flight.
+    char *acquire() {
+        uint32_t index;
+        if (!free_.try_pop(index)) return NULL;
+        return storage_.get() + static_cast<size_t>(index) * slot_bytes_;
+    }
+
+    // `buf` must come from acquire() on this pool.
+    void release(const void *buf) {
+        size_t offset = static_cast<const char *>(buf) - storage_.get();
+        free_.try_push(static_cast<uint32_t>(offset / slot_bytes_));
+    }
+
+    size_t slot_bytes() const { return slot_bytes_; }
+    size_t slots() const { return slots_; }
+    size_t in_flight() const { return slots_ - free_.size_approx(); }
+
+private:
+    size_t slot_bytes_;
+    size_t slots_;
+    std::unique_ptr<char[]> storage_;
+    BoundedRingBuffer<uint32_t> free_;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "common/parse_number.hpp"
+#include "common/thread_placement.hpp"
+
+enum class PayloadFormat {
+    Protobuf,  // marketdata.MarketUpdate
+    Packed,    // 32-byte fixed layout (common/packed_format.hpp), needs a shared dictionary
+};
+
+struct ProducerOptions {
+    std::string brokers;
+    int metrics_port = 9102;
+    std::string symbols_source;  // file path or redis://host[:port]/key
+    uint32_t max_symbols = 1 << 16;
+    int threads = 4;
+    double rate = 0;                  // total msg/s; 0 = legacy unpaced loop
+    std::string profile = "constant";
+    double duration_s = 0;            // 0 = until interrupted
+    size_t batch_size = 64;           // messages per rd_kafka_produce_batch call
+    size_t pool_slots = 32768;        // payload buffers per thread
+    PayloadFormat format = PayloadFormat::Protobuf;
+    size_t updates_per_record = 1;    // >1 packs ticks into MarketUpdateBatch records
+    long long record_linger_us = 1000;
+    bool record_delta = true;         // delta-encoded columns instead of repeated MarketUpdate
+    std::string replay_path;          // capture file or market_updates CSV export; empty = random ticks
+    double replay_speed = 1;          // multiple of recorded time; 0 = as fast as possible
+    long long replay_loops = 1;       // passes over the capture, 0 = until interrupted
+    ThreadPlacement placement{{"producer", "other"}};  // --cpus ROLE=LIST, repeatable
+    bool clock_sync = false;          // answer aggregator clock probes on the clock-sync topic
+};
+
+inline void print_producer_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " <broker list (e.g., localhost:9092)> [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --metrics-port N        Prometheus /metrics port, 0 disables (default: 9102)" << std::endl;
+    std::cerr << "  --symbols SRC           Symbol universe from a file or redis://host[:port]/key" << std::endl;
+    std::cerr << "                          (default: 8 built-in tickers)" << std::endl;
+    std::cerr << "  --max-symbols N         Symbol table capacity (default: 65536)" << std::endl;
+    std::cerr << "  --threads N             Producer threads (default: 4)" << std::endl;
+    std::cerr << "  --rate N                Open-loop target rate in msg/s over all threads;" << std::endl;
+    std::cerr << "                          0 keeps the unpaced 100us-sleep loop (default: 0)" << std::endl;
+    std::cerr << "  --profile SPEC          constant | ramp:S | step:S:N | spike:P:L:M | replay:FILE" << std::endl;
+    std::cerr << "                          (default: constant, needs --rate)" << std::endl;
+    std::cerr << "  --duration S            Stop after S seconds, 0 = run until interrupted (default: 0)" << std::endl;
+    std::cerr << "  --batch N               Messages per rd_kafka_produce_batch call (default: 64)" << std::endl;
+    std::cerr << "  --pool-slots N          Pooled payload buffers per thread (default: 32768)" << std::endl;
+    std::cerr << "  --format protobuf|packed  Payload format (default: protobuf)" << std::endl;
+    std::cerr << "  --updates-per-record N  Ticks per Kafka record as a MarketUpdateBatch, 1 = one" << std::endl;
+    std::cerr << "                          MarketUpdate per record (default: 1)" << std::endl;
+    std::cerr << "  --record-linger-us N    Max wait for a batch record to fill (default: 1000)" << std::endl;
+    std::cerr << "  --record-encoding plain|delta  Batch record layout (default: delta)" << std::endl;
+    std::cerr << "  --replay FILE           Stream recorded ticks from a tick_capture file or a CSV export" << std::endl;
+    std::cerr << "                          of market_updates (time,ticker,price,volume) instead of random ones" << std::endl;
+    std::cerr << "  --replay-speed X|max    Recorded inter-arrival times divided by X, max = no waiting (default: 1)" << std::endl;
+    std::cerr << "  --replay-loops N        Passes over the capture, 0 = until interrupted (default: 1)" << std::endl;
+    std::cerr << "  --clock-sync on|off     Answer the aggregator's clock probes so it can correct" << std::endl;
+    std::cerr << "                          cross-host latencies (default: off)" << std::endl;
+    std::cerr << "  --cpus ROLE=LIST        Pin a role's threads to cores, e.g. producer=2-5; roles producer," << std::endl;
+    std::cerr << "                          other; payload pools are allocated on those cores' NUMA node;" << std::endl;
+    std::cerr << "                          repeatable (default: no pinning)" << std::endl;
+}
+
+inline bool parse_producer_options(int argc, char **argv, ProducerOptions &opts) {
+    if (argc < 2) return false;
+    opts.brokers = argv[1];
+    bool profile_given = false;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--metrics-port") {
+            if (!parse_number_option(arg, value, opts.metrics_port)) return false;
+        } else if (arg == "--symbols") {
+            opts.symbols_source = value;
+        } else if (arg == "--max-symbols") {
+            if (!parse_number_option(arg, value, opts.max_symbols)) return false;
+            if (opts.max_symbols < 1) {
+                std::cerr << "--max-symbols must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--threads") {
+            if (!parse_number_option(arg, value, opts.threads)) return false;
+            if (opts.threads < 1) {
+                std::cerr << "--threads must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--rate") {
+            if (!parse_number_option(arg, value, opts.rate)) return false;
+        } else if (arg == "--profile") {
+            opts.profile = value;
+            profile_given = true;
+        } else if (arg == "--duration") {
+            if (!parse_number_option(arg, value, opts.duration_s)) return false;
+        } else if (arg == "--batch") {
+            if (!parse_number_option(arg, value, opts.batch_size)) return false;
+            if (opts.batch_size < 1) {
+                std::cerr << "--batch must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--format") {
+            if (value == "protobuf") opts.format = PayloadFormat::Protobuf;
+            else if (value == "packed") opts.format = PayloadFormat::Packed;
+            else {
+                std::cerr << "Unknown --format: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--updates-per-record") {
+            if (!parse_number_option(arg, value, opts.updates_per_record)) return false;
+            if (opts.updates_per_record < 1) {
+                std::cerr << "--updates-per-record must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--record-linger-us") {
+            if (!parse_number_option(arg, value, opts.record_linger_us)) return false;
+            if (opts.record_linger_us < 0) {
+                std::cerr << "--record-linger-us must be >= 0" << std::endl;
+                return false;
+            }
+        } else if (arg == "--record-encoding") {
+            if (value == "plain") opts.record_delta = false;
+            else if (value == "delta") opts.record_delta = true;
+            else {
+                std::cerr << "Unknown --record-encoding: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--replay") {
+            opts.replay_path = value;
+        } else if (arg == "--replay-speed") {
+            if (value == "max") opts.replay_speed = 0;
+            else if (!parse_number_option(arg, value, opts.replay_speed)) return false;
+            if (opts.replay_speed < 0) {
+                std::cerr << "--replay-speed must be positive or max" << std::endl;
+                return false;
+            }
+        } else if (arg == "--replay-loops") {
+            if (!parse_number_option(arg, value, opts.replay_loops)) return false;
+            if (opts.replay_loops < 0) {
+                std::cerr << "--replay-loops must be >= 0" << std::endl;
+                return false;
+            }
+        } else if (arg == "--clock-sync") {
+            if (value == "on") opts.clock_sync = true;
+            else if (value == "off") opts.clock_sync = false;
+            else {
+                std::cerr << "Unknown --clock-sync: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--cpus") {
+            std::string error;
+            if (!opts.placement.parse(value, error)) {
+                std::cerr << error << std::endl;
+                return false;
+            }
+        } else if (arg == "--pool-slots") {
+            if (!parse_number_option(arg, value, opts.pool_slots)) return false;
+            if (opts.pool_slots < 1) {
+                std::cerr << "--pool-slots must be at least 1" << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (opts.updates_per_record > 1 && opts.format == PayloadFormat::Packed) {
+        std::cerr << "--updates-per-record needs --format protobuf" << std::endl;
+        return false;
+    }
+    if (profile_given && opts.rate <= 0) {
+        std::cerr << "--profile shapes the open-loop rate and needs --rate > 0" << std::endl;
+        return false;
+    }
+    if (!opts.replay_path.empty() && opts.rate > 0) {
+        std::cerr << "--replay takes its timing from the capture (scale it with --replay-speed), not --rate" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "market_data.pb.h"
+#include "common/symbol_table.hpp"
+
+// Collects ticks into one MarketUpdateBatch per partition for one producer
+// thread (--updates-per-record). A record is ready once it holds
+// `max_updates` ticks or its oldest tick has waited `linger_ns`. Every symbol
+// maps to a fixed partition, the one librdkafka's default partitioner picks
+// for the ticker key, so per-ticker ordering and the aggregator's partition
+// affinity are unchanged.
+//
+// The delta form sends each ticker once per record, timestamps as deltas
+// from the previous tick and prices as 1e-6 fixed-point deltas from the
+// ticker's previous price, all as packed varints.
+class UpdateBatcher {
+public:
+    UpdateBatcher(const SymbolTable &symbols, const std::vector<int32_t> &symbol_partition, int partitions,
+                  size_t max_updates, long long linger_ns, bool delta)
+        : symbols_(symbols),
+          symbol_partition_(symbol_partition),
+          records_(partitions),
+          max_updates_(max_updates),
+          linger_ns_(linger_ns),
+          delta_(delta),
+          local_index_(symbol_partition.size(), -1),
+          last_price_(symbol_partition.size(), 0) {}
+
+    UpdateBatcher(const UpdateBatcher &) = delete;
+    UpdateBatcher &operator=(const UpdateBatcher &) = delete;
+
+    // Adds one tick. Returns its partition when that record is now full, else -1.
+    int add(uint32_t symbol_id, double price, int64_t volume, int64_t timestamp_ns, long long now_ns) {
+        int32_t partition = symbol_partition_[symbol_id];
+        Record &r = records_[partition];
+        if (r.count == 0) {
+            r.first_ns = now_ns;
+            if (now_ns + linger_ns_ < next_due_ns_) next_due_ns_ = now_ns + linger_ns_;
+        }
+
+        if (delta_) {
+            int32_t &index = local_index_[symbol_id];
+            if (index < 0) {
+                std::string_view name = symbols_.name(symbol_id);
+                index = r.msg.symbols_size();
+                r.msg.add_symbols(name.data(), name.size());
+                r.symbol_ids.push_back(symbol_id);
+                last_price_[symbol_id] = 0;
+            }
+            long long fixed = std::llround(price * 1e6);
+            r.msg.add_symbol_index(static_cast<uint32_t>(index));
+            r.msg.add_price_delta(fixed - last_price_[symbol_id]);
+            r.msg.add_timestamp_delta_ns(r.count == 0 ? timestamp_ns : timestamp_ns - r.last_timestamp_ns);
+            r.msg.add_volume(volume);
+            last_price_[symbol_id] = fixed;
+        } else {
+            marketdata::MarketUpdate *u = r.msg.add_updates();
+            std::string_view name = symbols_.name(symbol_id);
+            u->set_ticker(name.data(), name.size());
+            u->set_price(price);
+            u->set_volume(volume);
+            u->set_timestamp_ns(timestamp_ns);
+        }
+        r.last_timestamp_ns = timestamp_ns;
+        r.count++;
+        return r.count >= max_updates_ ? partition : -1;
+    }
+
+    // True once some record's oldest tick has waited for --record-linger-us.
+    bool linger_due(long long now_ns) const { return now_ns >= next_due_ns_; }
+    long long next_due_ns() const { return next_due_ns_; }
+
+    bool expired(int partition, long long now_ns) const {
+        const Record &r = records_[partition];
+        return r.count > 0 && now_ns - r.first_ns >= linger_ns_;
+    }
+
+    bool empty(int partition) const { return records_[partition].count == 0; }
+    int partitions() const { return static_cast<int>(records_.size()); }
+
+    // Serializes the partition's record into `buf` and starts a new one.
+    // Returns the encoded size, or 0 when it does not fit in `capacity` (the
+    // ticks are dropped). `updates` receives the number of ticks taken.
+    size_t take(int partition, char *buf, size_t capacity, uint32_t &updates) {
+        Record &r = records_[partition];
+        updates = r.count;
+        size_t len = r.msg.ByteSizeLong();
+        if (len <= capacity) r.msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(buf));
+        else len = 0;
+
+        r.msg.Clear();  // keeps allocated sub-messages and column capacity
+        for (uint32_t id : r.symbol_ids) local_index_[id] = -1;
+        r.symbol_ids.clear();
+        r.count = 0;
+
+        next_due_ns_ = LLONG_MAX;
+        for (const Record &other : records_) {
+            if (other.count > 0 && other.first_ns + linger_ns_ < next_due_ns_) next_due_ns_ = other.first_ns + linger_ns_;
+        }
+        return len;
+    }
+
+private:
+    struct Record {
+        marketdata::MarketUpdateBatch msg;
+        std::vector<uint32_t> symbol_ids;  // delta form: IDs behind msg.symbols()
+        uint32_t count = 0;
+        long long first_ns = 0;            // monotonic time of the oldest tick
+        int64_t last_timestamp_ns = 0;
+    };
+
+    const SymbolTable &symbols_;
+    const std::vector<int32_t> &symbol_partition_;
+    std::vector<Record> records_;
+    size_t max_updates_;
+    long long linger_ns_;
+    bool delta_;
+    long long next_due_ns_ = LLONG_MAX;
+    // Delta form, by symbol ID. A symbol only ever lands in one partition, so
+    // one table serves every record.
+    std::vector<int32_t> local_index_;
+    std::vector<long long> last_price_;
+};
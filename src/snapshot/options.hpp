@@ -0,0 +1,84 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "common/parse_number.hpp"
+
+enum class SnapshotSource {
+    Hash,  // HSCAN the aggregator's price hash
+    Keys,  // SCAN ... TYPE string + pipelined MGET (per-tick SET mode)
+};
+
+struct SnapshotOptions {
+    std::string redis_host = "127.0.0.1";
+    int redis_port = 6379;
+    int http_port = 9103;
+    SnapshotSource source = SnapshotSource::Hash;
+    std::string hash_key = "prices";
+    std::string match = "*";
+    int scan_count = 1000;
+    int refresh_ms = 100;
+    bool once = false;
+};
+
+inline void print_snapshot_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [redis_host[:port]] [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --port N                HTTP port for /snapshot, /price/<ticker>, /metrics (default: 9103)" << std::endl;
+    std::cerr << "  --source hash|keys      Read the price hash with HSCAN, or SCAN string keys + MGET (default: hash)" << std::endl;
+    std::cerr << "  --hash KEY              Price hash written by the aggregator (default: prices)" << std::endl;
+    std::cerr << "  --match PATTERN         Key pattern for --source keys (default: *)" << std::endl;
+    std::cerr << "  --scan-count N          COUNT hint per HSCAN/SCAN step (default: 1000)" << std::endl;
+    std::cerr << "  --refresh-ms N          Pause between full refresh passes (default: 100)" << std::endl;
+    std::cerr << "  --once                  Print one snapshot table and exit" << std::endl;
+}
+
+inline bool parse_snapshot_options(int argc, char **argv, SnapshotOptions &opts) {
+    int i = 1;
+    if (argc > 1 && argv[1][0] != '-') {
+        std::string hostport = argv[1];
+        size_t colon = hostport.find(':');
+        if (colon != std::string::npos) {
+            if (!parse_number_option("redis port", hostport.substr(colon + 1), opts.redis_port)) return false;
+            hostport.resize(colon);
+        }
+        opts.redis_host = hostport;
+        i = 2;
+    }
+
+    for (; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--once") {
+            opts.once = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--port") {
+            if (!parse_number_option(arg, value, opts.http_port)) return false;
+        } else if (arg == "--source") {
+            if (value == "hash") opts.source = SnapshotSource::Hash;
+            else if (value == "keys") opts.source = SnapshotSource::Keys;
+            else {
+                std::cerr << "Unknown --source: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--hash") {
+            opts.hash_key = value;
+        } else if (arg == "--match") {
+            opts.match = value;
+        } else if (arg == "--scan-count") {
+            if (!parse_number_option(arg, value, opts.scan_count)) return false;
+        } else if (arg == "--refresh-ms") {
+            if (!parse_number_option(arg, value, opts.refresh_ms)) return false;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// In-memory copy of the latest prices, filled by one refresher thread and read
+// by the HTTP thread. Point lookups take a shared lock on the map; full
+// snapshots are served from a JSON document rendered once per refresh cycle
+// and swapped in atomically, so a read never waits on Redis.
+class PriceCache {
+public:
+    // Refresher only. Prices are kept as the text Redis returned.
+    void update(std::string_view ticker, std::string_view price) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        Entry &e = entries_[std::string(ticker)];
+        e.price.assign(price.data(), price.size());
+        e.cycle = cycle_;
+    }
+
+    // Refresher only: called after a complete keyspace pass. Drops tickers that
+    // were not seen during the pass and publishes a fresh /snapshot document.
+    void end_cycle(long long refreshed_unix_ms) {
+        std::vector<std::pair<std::string, std::string>> rows;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            for (auto it = entries_.begin(); it != entries_.end();) {
+                if (it->second.cycle != cycle_) it = entries_.erase(it);
+                else ++it;
+            }
+            cycle_++;
+            rows.reserve(entries_.size());
+            for (const auto &kv : entries_) rows.emplace_back(kv.first, kv.second.price);
+        }
+
+        auto doc = std::make_shared<std::string>();
+        doc->reserve(64 + rows.size() * 32);
+        *doc += "{\"refreshed_ms\":" + std::to_string(refreshed_unix_ms) +
+                ",\"count\":" + std::to_string(rows.size()) + ",\"prices\":{";
+        for (size_t i = 0; i < rows.size(); i++) {
+            if (i > 0) *doc += ',';
+            append_json_string(*doc, rows[i].first);
+            *doc += ':';
+            append_json_string(*doc, rows[i].second);
+        }
+        *doc += "}}\n";
+        std::atomic_store(&snapshot_, std::shared_ptr<const std::string>(doc));
+        cycles_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool get(const std::string &ticker, std::string &price) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = entries_.find(ticker);
+        if (it == entries_.end()) return false;
+        price = it->second.price;
+        return true;
+    }
+
+    // NULL until the first cycle completes.
+    std::shared_ptr<const std::string> snapshot_json() const { return std::atomic_load(&snapshot_); }
+
+    // Sorted (ticker, price) rows, for --once.
+    std::vector<std::pair<std::string, std::string>> rows() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<std::pair<std::string, std::string>> out;
+        out.reserve(entries_.size());
+        for (const auto &kv : entries_) out.emplace_back(kv.first, kv.second.price);
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+    long long cycles() const { return cycles_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        std::string price;
+        unsigned long long cycle = 0;
+    };
+
+    // Prices are sent as JSON strings so the text Redis holds is returned unchanged.
+    static void append_json_string(std::string &out, const std::string &s) {
+        out += '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+        out += '"';
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    unsigned long long cycle_ = 0;
+    std::shared_ptr<const std::string> snapshot_;
+    std::atomic<long long> cycles_{0};
+};